@@ -0,0 +1,47 @@
+#include <float.h>
+#include <math.h>
+#include "aabb.h"
+
+aabb_t aabb_empty(void) {
+	aabb_t box = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+	return box;
+}
+
+aabb_t aabb_union(aabb_t a, aabb_t b) {
+	aabb_t box = {
+		{ fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y), fminf(a.min.z, b.min.z) },
+		{ fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y), fmaxf(a.max.z, b.max.z) }
+	};
+	return box;
+}
+
+aabb_t aabb_expand(aabb_t box, vec3_t point) {
+	aabb_t point_box = { point, point };
+	return aabb_union(box, point_box);
+}
+
+// Box around the eight transformed corners
+aabb_t aabb_transform(aabb_t box, mat4_t m) {
+	aabb_t result = aabb_empty();
+	for (int i = 0; i < 8; i++) {
+		vec3_t corner = {
+			(i & 1) ? box.max.x : box.min.x,
+			(i & 2) ? box.max.y : box.min.y,
+			(i & 4) ? box.max.z : box.min.z
+		};
+		result = aabb_expand(result, vec3_from_vec4(mat4_mul_vec4(m, vec4_from_vec3(corner))));
+	}
+	return result;
+}
+
+vec3_t aabb_center(aabb_t box) {
+	return vec3_mul(vec3_add(box.min, box.max), 0.5);
+}
+
+float aabb_surface_area(aabb_t box) {
+	vec3_t size = vec3_sub(box.max, box.min);
+	if (size.x < 0 || size.y < 0 || size.z < 0) {
+		return 0;
+	}
+	return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
@@ -0,0 +1,20 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "matrix.h"
+#include "vector.h"
+
+// Axis-aligned bounding box
+typedef struct {
+	vec3_t min;
+	vec3_t max;
+} aabb_t;
+
+aabb_t aabb_empty(void);
+aabb_t aabb_union(aabb_t a, aabb_t b);
+aabb_t aabb_expand(aabb_t box, vec3_t point);
+aabb_t aabb_transform(aabb_t box, mat4_t m);
+vec3_t aabb_center(aabb_t box);
+float aabb_surface_area(aabb_t box);
+
+#endif // !AABB_H
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 16
+
+static size_t align_size(size_t size) {
+	return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static void* block_data(arena_block_t* block) {
+	return (char*)block + align_size(sizeof(arena_block_t));
+}
+
+static arena_block_t* new_block(arena_t* arena, size_t capacity) {
+	arena_block_t* block = (arena_block_t*)malloc(align_size(sizeof(arena_block_t)) + capacity);
+	block->next = arena->blocks;
+	block->capacity = capacity;
+	block->used = 0;
+	arena->blocks = block;
+	arena->num_block_allocations++;
+	return block;
+}
+
+void arena_init(arena_t* arena, size_t capacity) {
+	memset(arena, 0, sizeof(arena_t));
+	new_block(arena, align_size(capacity));
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+	size = align_size(size);
+
+	arena_block_t* block = arena->blocks;
+	if (block->used + size > block->capacity) {
+		// Chain a bigger block, the pointers handed out so far stay valid
+		size_t capacity = block->capacity * 2;
+		while (capacity < size) {
+			capacity *= 2;
+		}
+		block = new_block(arena, capacity);
+	}
+
+	void* ptr = (char*)block_data(block) + block->used;
+	block->used += size;
+	arena->used += size;
+	if (arena->used > arena->peak_used) {
+		arena->peak_used = arena->used;
+	}
+	return ptr;
+}
+
+void* arena_realloc(arena_t* arena, void* ptr, size_t old_size, size_t new_size) {
+	arena_block_t* block = arena->blocks;
+	old_size = align_size(old_size);
+	new_size = align_size(new_size);
+
+	// The last allocation of the current block can grow in place
+	if (ptr != NULL && (char*)ptr + old_size == (char*)block_data(block) + block->used &&
+		block->used - old_size + new_size <= block->capacity) {
+		block->used += new_size - old_size;
+		arena->used += new_size - old_size;
+		if (arena->used > arena->peak_used) {
+			arena->peak_used = arena->used;
+		}
+		return ptr;
+	}
+
+	void* new_ptr = arena_alloc(arena, new_size);
+	if (ptr != NULL) {
+		memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+	}
+	return new_ptr;
+}
+
+void arena_reset(arena_t* arena) {
+	// Merge the blocks chained during the last frame into a single one
+	if (arena->blocks->next != NULL) {
+		size_t capacity = 0;
+		while (arena->blocks != NULL) {
+			arena_block_t* next = arena->blocks->next;
+			capacity += arena->blocks->capacity;
+			free(arena->blocks);
+			arena->blocks = next;
+		}
+		new_block(arena, capacity);
+	}
+
+	arena->blocks->used = 0;
+	arena->used = 0;
+}
+
+size_t arena_capacity(arena_t* arena) {
+	size_t capacity = 0;
+	for (arena_block_t* block = arena->blocks; block != NULL; block = block->next) {
+		capacity += block->capacity;
+	}
+	return capacity;
+}
+
+void arena_free(arena_t* arena) {
+	while (arena->blocks != NULL) {
+		arena_block_t* next = arena->blocks->next;
+		free(arena->blocks);
+		arena->blocks = next;
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Linear allocator for transient data, everything is released at once by
+// resetting it. When a block runs out another one twice as big is chained,
+// and on reset the blocks are merged so the next frames fit in one.
+typedef struct arena_block {
+	struct arena_block* next;
+	size_t capacity;
+	size_t used;
+} arena_block_t;
+
+typedef struct {
+	arena_block_t* blocks;		// current block first
+	size_t used;				// bytes allocated since the last reset
+	size_t peak_used;			// highest number of bytes used by a frame
+	int num_block_allocations;	// number of times memory was requested from the system
+} arena_t;
+
+void arena_init(arena_t* arena, size_t capacity);
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_realloc(arena_t* arena, void* ptr, size_t old_size, size_t new_size);
+void arena_reset(arena_t* arena);
+size_t arena_capacity(arena_t* arena);
+void arena_free(arena_t* arena);
+
+#endif // !ARENA_H
@@ -0,0 +1,216 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL.h>
+#include "benchmark.h"
+#include "clipping.h"
+#include "matrix.h"
+#include "mesh_bvh.h"
+
+#define BENCH_NUM_TRIANGLES 20000
+#define BENCH_NUM_FRAMES 60
+#define BENCH_SPHERE_RINGS 180		// the picking mesh has 2 * rings * rings triangles
+#define BENCH_NUM_RAYS 1000000
+#define BENCH_NUM_BRUTE_FORCE_RAYS 1000
+
+static unsigned int bench_seed = 1234;
+
+static float random_float(float min, float max) {
+	bench_seed = bench_seed * 1664525 + 1013904223;
+	return min + (max - min) * (float)(bench_seed >> 8) / (float)(1 << 24);
+}
+
+static double seconds_since(Uint64 start) {
+	return (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+void run_clipping_benchmark(void) {
+	float znear = 0.1;
+	float zfar = 100.0;
+	mat4_t proj_matrix = mat4_make_perspective(M_PI / 3.0, 9.0 / 16.0, znear, zfar);
+
+	// Small triangles scattered along a corridor in front of the camera
+	vec3_t* triangles = malloc(sizeof(vec3_t) * 3 * BENCH_NUM_TRIANGLES);
+	for (int i = 0; i < BENCH_NUM_TRIANGLES; i++) {
+		vec3_t center = vec3_new(random_float(-3, 3), random_float(-2, 2), random_float(0, 6));
+		for (int j = 0; j < 3; j++) {
+			triangles[i * 3 + j] = vec3_add(
+				center, vec3_new(random_float(-0.5, 0.5), random_float(-0.5, 0.5), random_float(-0.5, 0.5))
+			);
+		}
+	}
+
+	tex2_t texcoords[3] = { { 0, 0 }, { 1, 0 }, { 0, 1 } };
+	vec4_t* clip_vertices = malloc(sizeof(vec4_t) * 3 * BENCH_NUM_TRIANGLES);
+	triangle_t clipped[CLIP_BATCH_SIZE * MAX_NUM_POLY_TRIANGLES];
+	int sources[CLIP_BATCH_SIZE * MAX_NUM_POLY_TRIANGLES];
+
+	double polygon_time = 0;
+	double batch_time = 0;
+	long polygon_output = 0;
+	long batch_output = 0;
+
+	for (int frame = 0; frame < BENCH_NUM_FRAMES; frame++) {
+		// Fly the camera through the corridor so lots of triangles cross the near plane
+		float camera_z = 6.0 * frame / BENCH_NUM_FRAMES;
+		for (int i = 0; i < BENCH_NUM_TRIANGLES * 3; i++) {
+			vec4_t view_vertex = vec4_from_vec3(vec3_sub(triangles[i], vec3_new(0, 0, camera_z)));
+			clip_vertices[i] = mat4_mul_vec4(proj_matrix, view_vertex);
+		}
+
+		// One polygon at a time
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int i = 0; i < BENCH_NUM_TRIANGLES; i++) {
+			polygon_t polygon = create_polygon_from_triangle(
+				clip_vertices[i * 3], clip_vertices[i * 3 + 1], clip_vertices[i * 3 + 2],
+				texcoords[0], texcoords[1], texcoords[2]
+			);
+			clip_polygon(&polygon);
+
+			int num_triangles = 0;
+			if (polygon.num_vertices >= 3) {
+				triangles_from_polygon(&polygon, clipped, &num_triangles);
+			}
+			polygon_output += num_triangles;
+		}
+		polygon_time += seconds_since(start);
+
+		// Batches of triangles
+		start = SDL_GetPerformanceCounter();
+		triangle_batch_t batch;
+		clear_triangle_batch(&batch);
+		for (int i = 0; i < BENCH_NUM_TRIANGLES; i++) {
+			add_triangle_to_batch(&batch, &clip_vertices[i * 3], texcoords);
+			if (batch.num_triangles == CLIP_BATCH_SIZE || i == BENCH_NUM_TRIANGLES - 1) {
+				batch_output += clip_triangle_batch(&batch, clipped, sources);
+				clear_triangle_batch(&batch);
+			}
+		}
+		batch_time += seconds_since(start);
+	}
+
+	double num_input = (double)BENCH_NUM_TRIANGLES * BENCH_NUM_FRAMES;
+	printf("Clipping %d triangles over %d frames of a near plane camera path\n", BENCH_NUM_TRIANGLES, BENCH_NUM_FRAMES);
+	printf("  per polygon: %8.2f Mtris/s (%ld triangles out)\n", num_input / polygon_time / 1e6, polygon_output);
+	printf("  batched:     %8.2f Mtris/s (%ld triangles out)\n", num_input / batch_time / 1e6, batch_output);
+	printf("  speedup:     %8.2fx\n", polygon_time / batch_time);
+
+	free(clip_vertices);
+	free(triangles);
+}
+
+static bool brute_force_intersect(vec3_t* vertices, face_t* faces, int num_faces, vec3_t origin, vec3_t direction, ray_hit_t* hit) {
+	hit->face = -1;
+	hit->distance = 1e30f;
+	for (int i = 0; i < num_faces; i++) {
+		vec3_t v0 = vertices[faces[i].a];
+		vec3_t edge1 = vec3_sub(vertices[faces[i].b], v0);
+		vec3_t edge2 = vec3_sub(vertices[faces[i].c], v0);
+		vec3_t p = vec3_cross(direction, edge2);
+		float determinant = vec3_dot(edge1, p);
+		if (fabsf(determinant) < 1e-12f) continue;
+		vec3_t s = vec3_sub(origin, v0);
+		float u = vec3_dot(s, p) / determinant;
+		vec3_t q = vec3_cross(s, edge1);
+		float v = vec3_dot(direction, q) / determinant;
+		float t = vec3_dot(edge2, q) / determinant;
+		if (u >= 0 && v >= 0 && u + v <= 1 && t >= 0 && t < hit->distance) {
+			hit->face = i;
+			hit->distance = t;
+		}
+	}
+	return hit->face >= 0;
+}
+
+void run_picking_benchmark(void) {
+	// A bumpy sphere, so rays hit a mix of near and far triangles
+	int rings = BENCH_SPHERE_RINGS;
+	vec3_t* vertices = malloc(sizeof(vec3_t) * (rings + 1) * rings);
+	for (int i = 0; i <= rings; i++) {
+		float pitch = M_PI * i / rings - M_PI / 2;
+		for (int j = 0; j < rings; j++) {
+			float yaw = 2 * M_PI * j / rings;
+			float radius = 1 + 0.05 * sinf(7 * yaw) * cosf(5 * pitch);
+			vertices[i * rings + j] = vec3_new(
+				radius * cosf(pitch) * cosf(yaw), radius * sinf(pitch), radius * cosf(pitch) * sinf(yaw)
+			);
+		}
+	}
+	tex2_t* uvs = malloc(sizeof(tex2_t) * (rings + 1) * rings);
+	for (int i = 0; i <= rings; i++) {
+		for (int j = 0; j < rings; j++) {
+			uvs[i * rings + j] = (tex2_t){ (float)j / rings, (float)i / rings };
+		}
+	}
+	int num_faces = 2 * rings * rings;
+	face_t* faces = malloc(sizeof(face_t) * num_faces);
+	for (int i = 0; i < rings; i++) {
+		for (int j = 0; j < rings; j++) {
+			int a = i * rings + j;
+			int b = i * rings + (j + 1) % rings;
+			int c = (i + 1) * rings + j;
+			int d = (i + 1) * rings + (j + 1) % rings;
+			face_t first = { a, b, c };
+			face_t second = { b, d, c };
+			faces[(i * rings + j) * 2] = first;
+			faces[(i * rings + j) * 2 + 1] = second;
+		}
+	}
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	mesh_bvh_t bvh;
+	mesh_bvh_build(&bvh, vertices, faces, num_faces);
+	double build_time = seconds_since(start);
+
+	// Rays from a surrounding sphere towards points around the center
+	vec3_t* origins = malloc(sizeof(vec3_t) * BENCH_NUM_RAYS);
+	vec3_t* directions = malloc(sizeof(vec3_t) * BENCH_NUM_RAYS);
+	for (int i = 0; i < BENCH_NUM_RAYS; i++) {
+		vec3_t origin = vec3_new(random_float(-1, 1), random_float(-1, 1), random_float(-1, 1));
+		vec3_normalize(&origin);
+		origins[i] = vec3_mul(origin, 3);
+		vec3_t target = vec3_new(random_float(-1.2, 1.2), random_float(-1.2, 1.2), random_float(-1.2, 1.2));
+		directions[i] = vec3_sub(target, origins[i]);
+	}
+
+	start = SDL_GetPerformanceCounter();
+	int num_hits = 0;
+	for (int i = 0; i < BENCH_NUM_RAYS; i++) {
+		ray_hit_t hit;
+		num_hits += mesh_bvh_intersect(&bvh, faces, uvs, origins[i], directions[i], 1e30f, &hit);
+	}
+	double closest_time = seconds_since(start);
+
+	start = SDL_GetPerformanceCounter();
+	int num_occluded = 0;
+	for (int i = 0; i < BENCH_NUM_RAYS; i++) {
+		num_occluded += mesh_bvh_occluded(&bvh, origins[i], vec3_add(origins[i], directions[i]));
+	}
+	double occluded_time = seconds_since(start);
+
+	// Check a few rays against every triangle
+	start = SDL_GetPerformanceCounter();
+	int num_mismatches = 0;
+	for (int i = 0; i < BENCH_NUM_BRUTE_FORCE_RAYS; i++) {
+		ray_hit_t expected, hit;
+		brute_force_intersect(vertices, faces, num_faces, origins[i], directions[i], &expected);
+		mesh_bvh_intersect(&bvh, faces, uvs, origins[i], directions[i], 1e30f, &hit);
+		if (expected.face != hit.face && fabsf(expected.distance - hit.distance) > 1e-5f) {
+			num_mismatches++;
+		}
+	}
+	double brute_force_time = seconds_since(start);
+
+	printf("Picking against %d triangles, %d nodes built in %.1f ms\n", num_faces, bvh.num_nodes, build_time * 1000);
+	printf("  closest hit: %8.2f Mrays/s (%d hits)\n", BENCH_NUM_RAYS / closest_time / 1e6, num_hits);
+	printf("  occlusion:   %8.2f Mrays/s (%d occluded)\n", BENCH_NUM_RAYS / occluded_time / 1e6, num_occluded);
+	printf("  brute force: %8.4f Mrays/s (%d of %d rays disagree)\n",
+		BENCH_NUM_BRUTE_FORCE_RAYS / brute_force_time / 1e6, num_mismatches, BENCH_NUM_BRUTE_FORCE_RAYS);
+
+	mesh_bvh_free(&bvh);
+	free(directions);
+	free(origins);
+	free(faces);
+	free(uvs);
+	free(vertices);
+}
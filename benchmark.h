@@ -0,0 +1,7 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+void run_clipping_benchmark(void);
+void run_picking_benchmark(void);
+
+#endif // !BENCHMARK_H
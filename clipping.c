@@ -1,5 +1,7 @@
 #include <math.h>
+#include <string.h>
 #include "clipping.h"
+#include "simd.h"
 
 #define NUM_PLANES 6
 
@@ -43,7 +45,7 @@ void init_frustum_planes(float fovx, float fovy, float z_near, float z_far)
 	frustum_planes[FAR_FRUSTUM_PLANE].normal.z = -1;
 }
 
-polygon_t create_polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2, tex2_t t0, tex2_t t1, tex2_t t2)
+polygon_t create_polygon_from_triangle(vec4_t v0, vec4_t v1, vec4_t v2, tex2_t t0, tex2_t t1, tex2_t t2)
 {
 	polygon_t result = {
 		.vertices = { v0, v1, v2 },
@@ -59,9 +61,9 @@ void triangles_from_polygon(polygon_t* polygon, triangle_t triangles[], int* num
 		int index1 = i + 1;
 		int index2 = i + 2;
 
-		triangles[i].points[0] = vec4_from_vec3(polygon->vertices[index0]);
-		triangles[i].points[1] = vec4_from_vec3(polygon->vertices[index1]);
-		triangles[i].points[2] = vec4_from_vec3(polygon->vertices[index2]);
+		triangles[i].points[0] = polygon->vertices[index0];
+		triangles[i].points[1] = polygon->vertices[index1];
+		triangles[i].points[2] = polygon->vertices[index2];
 		
 		triangles[i].texcoords[0] = polygon->texcoords[index0];
 		triangles[i].texcoords[1] = polygon->texcoords[index1];
@@ -75,36 +77,63 @@ float float_lerp(float a, float b, float t) {
 	return a + t * (b - a);
 }
 
-void clip_polygon_against_plane(polygon_t* polygon, int plane)
+// Signed distance of a clip space vertex to one of the frustum planes, with
+// the side planes pushed out by the given scale
+static float plane_distance(vec4_t v, int plane, float scale)
+{
+	switch (plane) {
+	case LEFT_FRUSTUM_PLANE:   return v.x + scale * v.w;
+	case RIGHT_FRUSTUM_PLANE:  return scale * v.w - v.x;
+	case TOP_FRUSTUM_PLANE:    return scale * v.w - v.y;
+	case BOTTOM_FRUSTUM_PLANE: return v.y + scale * v.w;
+	case NEAR_FRUSTUM_PLANE:   return v.z;
+	default:                   return v.w - v.z;
+	}
+}
+
+int compute_outcode(vec4_t v)
 {
-	vec3_t plane_point = frustum_planes[plane].point;
-	vec3_t plane_normal = frustum_planes[plane].normal;
+	// The low bits flag the planes of the view and the high bits the planes of the guard band
+	int outcode = 0;
+	for (int plane = 0; plane < NUM_PLANES; plane++) {
+		if (plane_distance(v, plane, 1.0) <= 0) {
+			outcode |= 1 << plane;
+		}
+		if (plane_distance(v, plane, GUARD_BAND_SCALE) <= 0) {
+			outcode |= 1 << (plane + NUM_PLANES);
+		}
+	}
+	return outcode;
+}
 
-	vec3_t inside_vertices[MAX_NUM_POLY_VERTICES];
-	tex2_t inside_texcoords[MAX_NUM_POLY_VERTICES];
+// Clip the input polygon against one plane writing the result to a separate
+// output polygon, so successive planes can ping-pong between two buffers
+static void clip_polygon_to_plane(const polygon_t* in, polygon_t* out, int plane)
+{
 	int num_inside_vertices = 0;
 
-	vec3_t* current_vertex = &polygon->vertices[0];
-	tex2_t* current_texcoord = &polygon->texcoords[0];
+	const vec4_t* current_vertex = &in->vertices[0];
+	const tex2_t* current_texcoord = &in->texcoords[0];
 
-	vec3_t* previous_vertex = &polygon->vertices[polygon->num_vertices - 1];
-	tex2_t* previous_texcoord = &polygon->texcoords[polygon->num_vertices - 1];
+	const vec4_t* previous_vertex = &in->vertices[in->num_vertices - 1];
+	const tex2_t* previous_texcoord = &in->texcoords[in->num_vertices - 1];
 
 	float current_dot = 0;
-	float previous_dot = vec3_dot(vec3_sub(*previous_vertex, plane_point), plane_normal);
+	float previous_dot = plane_distance(*previous_vertex, plane, GUARD_BAND_SCALE);
 
-	while (current_vertex != &polygon->vertices[polygon->num_vertices]) {
-		current_dot = vec3_dot(vec3_sub(*current_vertex, plane_point), plane_normal);
+	while (current_vertex != &in->vertices[in->num_vertices]) {
+		current_dot = plane_distance(*current_vertex, plane, GUARD_BAND_SCALE);
 
 		if (current_dot * previous_dot < 0) {
 			// We changed from inside to outside or from outside to inside
 			float t = previous_dot / (previous_dot - current_dot);
 
 			// Calculate intersection point I = Q1 + t(Q2 - Q1)
-			vec3_t intersection_point = {
+			vec4_t intersection_point = {
 				.x = float_lerp(previous_vertex->x, current_vertex->x, t),
 				.y = float_lerp(previous_vertex->y, current_vertex->y, t),
-				.z = float_lerp(previous_vertex->z, current_vertex->z, t)
+				.z = float_lerp(previous_vertex->z, current_vertex->z, t),
+				.w = float_lerp(previous_vertex->w, current_vertex->w, t)
 			};
 
 			// Calculated interpolated texture coords
@@ -114,15 +143,15 @@ void clip_polygon_against_plane(polygon_t* polygon, int plane)
 			};
 
 			// Insert intersection point to list of inside vertices
-			inside_vertices[num_inside_vertices] = vec3_clone(&intersection_point);
-			inside_texcoords[num_inside_vertices] = tex2_clone(&interpolated_texcoord);
+			out->vertices[num_inside_vertices] = intersection_point;
+			out->texcoords[num_inside_vertices] = interpolated_texcoord;
 			num_inside_vertices++;
 		}
 
 		if (current_dot > 0) {
 			// Current vertex is inside the plane
-			inside_vertices[num_inside_vertices] = vec3_clone(current_vertex);
-			inside_texcoords[num_inside_vertices] = tex2_clone(current_texcoord);
+			out->vertices[num_inside_vertices] = *current_vertex;
+			out->texcoords[num_inside_vertices] = *current_texcoord;
 			num_inside_vertices++;
 		}
 
@@ -134,20 +163,233 @@ void clip_polygon_against_plane(polygon_t* polygon, int plane)
 		current_texcoord++;
 	}
 
+	out->num_vertices = num_inside_vertices;
+}
+
+void clip_polygon_against_plane(polygon_t* polygon, int plane)
+{
+	polygon_t inside;
+	clip_polygon_to_plane(polygon, &inside, plane);
+
 	// At the end copy the list of inside vertices to the destination polygon
-	for (int i = 0; i < num_inside_vertices; i++) {
-		polygon->vertices[i] = vec3_clone(&inside_vertices[i]);
-		polygon->texcoords[i] = tex2_clone(&inside_texcoords[i]);
+	*polygon = inside;
+}
+
+void clip_polygon(polygon_t* polygon) {
+	int outcode_and = ~0;
+	int outcode_or = 0;
+	for (int i = 0; i < polygon->num_vertices; i++) {
+		int outcode = compute_outcode(polygon->vertices[i]);
+		outcode_and &= outcode;
+		outcode_or |= outcode;
+	}
+
+	// All the vertices are outside the same plane of the view
+	if (outcode_and & ((1 << NUM_PLANES) - 1)) {
+		polygon->num_vertices = 0;
+		return;
 	}
 
-	polygon->num_vertices = num_inside_vertices;
+	// Only clip against the guard band planes that are actually crossed,
+	// which for most triangles leaves just the near plane
+	for (int plane = 0; plane < NUM_PLANES && polygon->num_vertices > 0; plane++) {
+		if (outcode_or & (1 << (plane + NUM_PLANES))) {
+			clip_polygon_against_plane(polygon, plane);
+		}
+	}
 }
 
-void clip_polygon(polygon_t* polygon) {
-	clip_polygon_against_plane(polygon, LEFT_FRUSTUM_PLANE);
-	clip_polygon_against_plane(polygon, RIGHT_FRUSTUM_PLANE);
-	clip_polygon_against_plane(polygon, TOP_FRUSTUM_PLANE);
-	clip_polygon_against_plane(polygon, BOTTOM_FRUSTUM_PLANE);
-	clip_polygon_against_plane(polygon, NEAR_FRUSTUM_PLANE);
-	clip_polygon_against_plane(polygon, FAR_FRUSTUM_PLANE);
+void clear_triangle_batch(triangle_batch_t* batch)
+{
+	memset(batch, 0, sizeof(triangle_batch_t));
+}
+
+void add_triangle_to_batch(triangle_batch_t* batch, vec4_t vertices[3], tex2_t texcoords[3])
+{
+	int lane = batch->num_triangles;
+	for (int j = 0; j < 3; j++) {
+		batch->x[j][lane] = vertices[j].x;
+		batch->y[j][lane] = vertices[j].y;
+		batch->z[j][lane] = vertices[j].z;
+		batch->w[j][lane] = vertices[j].w;
+		batch->texcoords[j][lane] = texcoords[j];
+	}
+	batch->num_triangles++;
+}
+
+// Find which triangles of the batch are completely outside one plane of the
+// view and which ones cross any of the planes of the guard band, one bit per
+// triangle in each mask
+static void compute_batch_masks(const triangle_batch_t* batch, int* reject_mask, int* clip_mask)
+{
+	*reject_mask = 0;
+	*clip_mask = 0;
+
+#ifdef SIMD_WIDTH
+	simd_float_t zero = simd_set1(0);
+	simd_float_t guard_band = simd_set1(GUARD_BAND_SCALE);
+
+	for (int lane = 0; lane < CLIP_BATCH_SIZE; lane += SIMD_WIDTH) {
+		simd_float_t out_all[NUM_PLANES];
+		simd_float_t out_any = simd_set1(0);
+
+		for (int j = 0; j < 3; j++) {
+			simd_float_t x = simd_load(&batch->x[j][lane]);
+			simd_float_t y = simd_load(&batch->y[j][lane]);
+			simd_float_t z = simd_load(&batch->z[j][lane]);
+			simd_float_t w = simd_load(&batch->w[j][lane]);
+			simd_float_t gw = simd_mul(guard_band, w);
+
+			// Outcodes of the view planes, kept per plane to find trivial rejects
+			simd_float_t out[NUM_PLANES] = {
+				simd_cmple(simd_add(x, w), zero),
+				simd_cmple(simd_sub(w, x), zero),
+				simd_cmple(simd_sub(w, y), zero),
+				simd_cmple(simd_add(y, w), zero),
+				simd_cmple(z, zero),
+				simd_cmple(simd_sub(w, z), zero)
+			};
+			for (int plane = 0; plane < NUM_PLANES; plane++) {
+				out_all[plane] = (j == 0) ? out[plane] : simd_and(out_all[plane], out[plane]);
+			}
+
+			// Outcodes of the guard band planes, only needed to know if any is crossed
+			out_any = simd_or(out_any, simd_cmple(simd_add(x, gw), zero));
+			out_any = simd_or(out_any, simd_cmple(simd_sub(gw, x), zero));
+			out_any = simd_or(out_any, simd_cmple(simd_sub(gw, y), zero));
+			out_any = simd_or(out_any, simd_cmple(simd_add(y, gw), zero));
+			out_any = simd_or(out_any, out[NEAR_FRUSTUM_PLANE]);
+			out_any = simd_or(out_any, out[FAR_FRUSTUM_PLANE]);
+		}
+
+		simd_float_t reject = out_all[0];
+		for (int plane = 1; plane < NUM_PLANES; plane++) {
+			reject = simd_or(reject, out_all[plane]);
+		}
+		*reject_mask |= simd_movemask(reject) << lane;
+		*clip_mask |= simd_movemask(out_any) << lane;
+	}
+#else
+	for (int lane = 0; lane < CLIP_BATCH_SIZE; lane++) {
+		int outcode_and = ~0;
+		int outcode_or = 0;
+		for (int j = 0; j < 3; j++) {
+			vec4_t v = { batch->x[j][lane], batch->y[j][lane], batch->z[j][lane], batch->w[j][lane] };
+			int outcode = compute_outcode(v);
+			outcode_and &= outcode;
+			outcode_or |= outcode;
+		}
+		if (outcode_and & ((1 << NUM_PLANES) - 1)) {
+			*reject_mask |= 1 << lane;
+		}
+		if (outcode_or >> NUM_PLANES) {
+			*clip_mask |= 1 << lane;
+		}
+	}
+#endif
+}
+
+int clip_triangle_batch(const triangle_batch_t* batch, triangle_t triangles[], int sources[])
+{
+	int reject_mask;
+	int clip_mask;
+	compute_batch_masks(batch, &reject_mask, &clip_mask);
+
+	int num_triangles = 0;
+	for (int lane = 0; lane < batch->num_triangles; lane++) {
+		if (reject_mask & (1 << lane)) {
+			continue;
+		}
+
+		if (!(clip_mask & (1 << lane))) {
+			// Trivially accepted, pass the triangle straight through
+			for (int j = 0; j < 3; j++) {
+				triangles[num_triangles].points[j].x = batch->x[j][lane];
+				triangles[num_triangles].points[j].y = batch->y[j][lane];
+				triangles[num_triangles].points[j].z = batch->z[j][lane];
+				triangles[num_triangles].points[j].w = batch->w[j][lane];
+				triangles[num_triangles].texcoords[j] = batch->texcoords[j][lane];
+			}
+			sources[num_triangles] = lane;
+			num_triangles++;
+			continue;
+		}
+
+		// Clip against the crossed planes alternating between two polygons
+		polygon_t polygons[2];
+		polygon_t* current = &polygons[0];
+		polygon_t* next = &polygons[1];
+		int outcode_or = 0;
+		for (int j = 0; j < 3; j++) {
+			vec4_t v = { batch->x[j][lane], batch->y[j][lane], batch->z[j][lane], batch->w[j][lane] };
+			current->vertices[j] = v;
+			current->texcoords[j] = batch->texcoords[j][lane];
+			outcode_or |= compute_outcode(v);
+		}
+		current->num_vertices = 3;
+
+		for (int plane = 0; plane < NUM_PLANES && current->num_vertices > 0; plane++) {
+			if (outcode_or & (1 << (plane + NUM_PLANES))) {
+				clip_polygon_to_plane(current, next, plane);
+				polygon_t* swap = current;
+				current = next;
+				next = swap;
+			}
+		}
+
+		int num_polygon_triangles = 0;
+		if (current->num_vertices >= 3) {
+			triangles_from_polygon(current, &triangles[num_triangles], &num_polygon_triangles);
+		}
+		for (int t = 0; t < num_polygon_triangles; t++) {
+			sources[num_triangles + t] = lane;
+		}
+		num_triangles += num_polygon_triangles;
+	}
+	return num_triangles;
+}
+
+int classify_sphere_against_frustum(vec3_t center, float radius)
+{
+	int result = FRUSTUM_INSIDE;
+	for (int plane = 0; plane < NUM_PLANES; plane++) {
+		float distance = vec3_dot(
+			vec3_sub(center, frustum_planes[plane].point), frustum_planes[plane].normal
+		);
+
+		// The whole sphere is behind one of the planes
+		if (distance < -radius) {
+			return FRUSTUM_OUTSIDE;
+		}
+		// Vertices exactly on a plane are dropped by the clipper, so "inside" must be strict
+		if (distance <= radius) {
+			result = FRUSTUM_INTERSECT;
+		}
+	}
+	return result;
+}
+
+int classify_box_against_frustum(vec3_t corners[8])
+{
+	int result = FRUSTUM_INSIDE;
+	for (int plane = 0; plane < NUM_PLANES; plane++) {
+		int num_inside = 0;
+		for (int i = 0; i < 8; i++) {
+			float distance = vec3_dot(
+				vec3_sub(corners[i], frustum_planes[plane].point), frustum_planes[plane].normal
+			);
+			if (distance > 0) {
+				num_inside++;
+			}
+		}
+
+		// All the corners are behind the same plane
+		if (num_inside == 0) {
+			return FRUSTUM_OUTSIDE;
+		}
+		if (num_inside < 8) {
+			result = FRUSTUM_INTERSECT;
+		}
+	}
+	return result;
 }
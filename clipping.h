@@ -4,6 +4,11 @@
 
 #define MAX_NUM_POLY_VERTICES 10
 #define MAX_NUM_POLY_TRIANGLES 10
+#define CLIP_BATCH_SIZE 8
+
+// Triangles only get clipped against the side planes once they leave this
+// multiple of the viewport, closer ones are scissored by the rasterizer
+#define GUARD_BAND_SCALE 4.0
 
 enum {
   LEFT_FRUSTUM_PLANE,
@@ -14,19 +19,42 @@ enum {
   FAR_FRUSTUM_PLANE
 };
 
+enum {
+  FRUSTUM_OUTSIDE,
+  FRUSTUM_INSIDE,
+  FRUSTUM_INTERSECT
+};
+
 typedef struct {
 	vec3_t point;
 	vec3_t normal;
 } plane_t;
 
 typedef struct {
-	vec3_t vertices[MAX_NUM_POLY_VERTICES];
+	vec4_t vertices[MAX_NUM_POLY_VERTICES];	// vertices in homogeneous clip space
   tex2_t texcoords[MAX_NUM_POLY_VERTICES];
 	int num_vertices;
 } polygon_t;
 
+// A group of clip space triangles stored by vertex and component, so the
+// outcodes of all of them can be computed together with SIMD
+typedef struct {
+	float x[3][CLIP_BATCH_SIZE];
+	float y[3][CLIP_BATCH_SIZE];
+	float z[3][CLIP_BATCH_SIZE];
+	float w[3][CLIP_BATCH_SIZE];
+	tex2_t texcoords[3][CLIP_BATCH_SIZE];
+	int num_triangles;
+} triangle_batch_t;
+
 void init_frustum_planes(float fovx, float fovy, float z_near, float z_far);
-polygon_t create_polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2, tex2_t t0, tex2_t t1, tex2_t t2);
+polygon_t create_polygon_from_triangle(vec4_t v0, vec4_t v1, vec4_t v2, tex2_t t0, tex2_t t1, tex2_t t2);
 void triangles_from_polygon(polygon_t* polygon, triangle_t triangles[], int* num_triangles);
 void clip_polygon(polygon_t* polygon);
 void clip_polygon_against_plane(polygon_t* polygon, int plane);
+int compute_outcode(vec4_t v);
+void clear_triangle_batch(triangle_batch_t* batch);
+void add_triangle_to_batch(triangle_batch_t* batch, vec4_t vertices[3], tex2_t texcoords[3]);
+int clip_triangle_batch(const triangle_batch_t* batch, triangle_t triangles[], int sources[]);
+int classify_sphere_against_frustum(vec3_t center, float radius);
+int classify_box_against_frustum(vec3_t corners[8]);
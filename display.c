@@ -10,8 +10,14 @@ static uint32_t* color_buffer = NULL;
 static float* z_buffer = NULL;
 static SDL_Texture* color_buffer_texture = NULL;
 
+// Where the drawing goes, either the window buffers or an offscreen target
+static render_target_t window_target;
+static render_target_t target;
+static screen_rect_t scissor;	// the only pixels of the target the drawing functions touch
+
 static int render_method = 0;
 static int cull_method = 0;
+static int texture_filter = TEXTURE_FILTER_NEAREST;
 
 int get_window_width(void) {
 	return window_width;
@@ -21,6 +27,33 @@ int get_window_height(void) {
 	return window_height;
 }
 
+// Setting a target also lets the drawing reach all of it again
+void set_render_target(const render_target_t* render_target) {
+	target = render_target ? *render_target : window_target;
+	set_scissor_rect(NULL);
+}
+
+void set_scissor_rect(const screen_rect_t* rect) {
+	screen_rect_t whole_target = screen_rect_new(0, 0, target.width, target.height);
+	scissor = rect ? screen_rect_intersect(*rect, whole_target) : whole_target;
+}
+
+screen_rect_t get_scissor_rect(void) {
+	return scissor;
+}
+
+int get_render_target_width(void) {
+	return target.width;
+}
+
+int get_render_target_height(void) {
+	return target.height;
+}
+
+const render_target_t* get_render_target(void) {
+	return &target;
+}
+
 bool initialize_window(void) {
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
 		fprintf(stderr, "Error initializing SDL.\n");
@@ -65,6 +98,10 @@ bool initialize_window(void) {
 	color_buffer = (uint32_t*)malloc(sizeof(uint32_t) * num_pixels);
 	z_buffer = (float*)malloc(sizeof(float) * num_pixels);
 
+	render_target_t buffers = { color_buffer, z_buffer, window_width, window_height, window_width };
+	window_target = buffers;
+	set_render_target(NULL);
+
 	color_buffer_texture = SDL_CreateTexture(
 		renderer,
 		SDL_PIXELFORMAT_RGBA32,
@@ -86,6 +123,16 @@ bool is_cull_backface(void)
 	return cull_method == CULL_BACKFACE;
 }
 
+void set_texture_filter(int filter)
+{
+	texture_filter = filter;
+}
+
+int get_texture_filter(void)
+{
+	return texture_filter;
+}
+
 bool should_render_filled_triangles(void)
 {
 	return (
@@ -122,6 +169,11 @@ void set_render_method(int method)
 	render_method = method;
 }
 
+int get_render_method(void)
+{
+	return render_method;
+}
+
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color)
 {
 	int delta_x = x1 - x0;
@@ -144,20 +196,23 @@ void draw_line(int x0, int y0, int x1, int y1, uint32_t color)
 
 void draw_grid(void) {
 	uint32_t color = 0xFF808080;
-	for (int j = 0; j < window_height; j += 10) {
-		for (int i = 0; i < window_width; i += 10) {
-				color_buffer[(window_width * j) + i] = color;
+	// First dots of the grid inside the scissor
+	int first_x = (scissor.x0 + 9) / 10 * 10;
+	int first_y = (scissor.y0 + 9) / 10 * 10;
+	for (int j = first_y; j < scissor.y1; j += 10) {
+		for (int i = first_x; i < scissor.x1; i += 10) {
+				target.color_buffer[(target.pitch * j) + i] = color;
 		}
 	}
 }
 
 
 void draw_pixel(int x, int y, uint32_t color) {
-	if (x < 0 || x >= window_width || y < 0 || y >= window_height) {
+	if (x < scissor.x0 || x >= scissor.x1 || y < scissor.y0 || y >= scissor.y1) {
 		return;
 	}
 
-	color_buffer[(window_width * y) + x] = color;
+	target.color_buffer[(target.pitch * y) + x] = color;
 }
 
 
@@ -165,25 +220,26 @@ void draw_rect(int x, int y, int w, int h, uint32_t color) {
 	// Check x and y are inside the 
 	if (x < 0)
 		x = 0;
-	else if (x >= window_width)
-		x = window_width - 1;
+	else if (x >= target.width)
+		x = target.width - 1;
 	if (y < 0)
 		y = 0;
-	else if (y >= window_height)
-		y = window_height;
+	else if (y >= target.height)
+		y = target.height;
 
 	// check w and h
-	int max_w = window_width - 1 - x;
-	int max_h = window_height - 1 - y;
+	int max_w = target.width - 1 - x;
+	int max_h = target.height - 1 - y;
 
 	if (w > max_w)
 		w = max_w;
 	if (h > max_h)
 		h = max_h;
 
-	for (int j = y; j < y + h; j++) {
-		for (int i = x; i < x + w; i++) {
-			color_buffer[(window_width * j) + i] = color;
+	screen_rect_t rect = screen_rect_intersect(screen_rect_new(x, y, x + w, y + h), scissor);
+	for (int j = rect.y0; j < rect.y1; j++) {
+		for (int i = rect.x0; i < rect.x1; i++) {
+			target.color_buffer[(target.pitch * j) + i] = color;
 		}
 	}
 }
@@ -196,28 +252,39 @@ void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t colo
 }
 
 
-void render_color_buffer(void) {
-	SDL_UpdateTexture(
-		color_buffer_texture,
-		NULL,
-		color_buffer,
-		(int)(window_width * sizeof(uint32_t))
-	);
+// Only the rows of the damaged rectangle are uploaded, the texture keeps the rest
+void render_color_buffer(screen_rect_t damaged) {
+	damaged = screen_rect_intersect(damaged, screen_rect_new(0, 0, window_width, window_height));
+	if (!screen_rect_is_empty(damaged)) {
+		SDL_Rect rows = { 0, damaged.y0, window_width, damaged.y1 - damaged.y0 };
+		SDL_UpdateTexture(
+			color_buffer_texture,
+			&rows,
+			color_buffer + window_width * damaged.y0,
+			(int)(window_width * sizeof(uint32_t))
+		);
+	}
 	SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
 	SDL_RenderPresent(renderer);
 }
 
 
 void clear_color_buffer(uint32_t color) {
-	for (int i = 0; i < window_width * window_height; i++) {
-		color_buffer[i] = color;
+	for (int y = scissor.y0; y < scissor.y1; y++) {
+		uint32_t* row = target.color_buffer + target.pitch * y;
+		for (int x = scissor.x0; x < scissor.x1; x++) {
+			row[x] = color;
+		}
 	}
 }
 
 void clear_z_buffer(void)
 {
-	for (int i = 0; i < window_width * window_height; i++) {
-		z_buffer[i] = 1.0;
+	for (int y = scissor.y0; y < scissor.y1; y++) {
+		float* row = target.z_buffer + target.width * y;
+		for (int x = scissor.x0; x < scissor.x1; x++) {
+			row[x] = 1.0;
+		}
 	}
 }
 
@@ -233,17 +300,17 @@ void destroy_window(void) {
 
 float get_zbuffer_at(int x, int y)
 {
-	if (x < 0 || x >= window_width || y < 0 || y >= window_height) {
+	if (x < 0 || x >= target.width || y < 0 || y >= target.height) {
 		return 1.0;
 	}
-	return z_buffer[(window_width * y) + x];
+	return target.z_buffer[(target.width * y) + x];
 }
 
 void update_zbuffer_at(int x, int y, float value)
 {
-	if (x < 0 || x >= window_width || y < 0 || y >= window_height) {
+	if (x < 0 || x >= target.width || y < 0 || y >= target.height) {
 		return;
 	}
-	z_buffer[(window_width * y) + x] = value;
+	target.z_buffer[(target.width * y) + x] = value;
 }
 
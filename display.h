@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <SDL.h>
+#include "screen_rect.h"
 
 #define FPS 60
 #define FRAME_TARGET_TIME (1000 / FPS)
@@ -14,6 +15,11 @@ enum cull_method {
 	CULL_BACKFACE
 };
 
+enum texture_filter {
+	TEXTURE_FILTER_NEAREST,
+	TEXTURE_FILTER_BILINEAR
+};
+
 enum render_method {
 	RENDER_WIRE,
 	RENDER_WIRE_VERTEX,
@@ -23,13 +29,32 @@ enum render_method {
 	RENDER_TEXTURED_WIRED
 };
 
+// Buffers written by the drawing functions, the window unless something else is set
+typedef struct {
+	uint32_t* color_buffer;
+	float* z_buffer;
+	int width;
+	int height;
+	int pitch;				// colors from the start of a row to the start of the next one
+} render_target_t;
+
 bool initialize_window(void);
 int get_window_width(void);
 int get_window_height(void);
 
+void set_render_target(const render_target_t* target);
+int get_render_target_width(void);
+int get_render_target_height(void);
+const render_target_t* get_render_target(void);
+void set_scissor_rect(const screen_rect_t* rect);
+screen_rect_t get_scissor_rect(void);
+
 void set_render_method(int method);
+int get_render_method(void);
 void set_cull_method(int method);
 bool is_cull_backface(void);
+void set_texture_filter(int filter);
+int get_texture_filter(void);
 
 bool should_render_filled_triangles(void);
 bool should_render_textured_triangles(void);
@@ -42,7 +67,7 @@ void draw_pixel(int x, int y, uint32_t color);
 void draw_rect(int x, int y, int w, int h, uint32_t color);
 void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
 
-void render_color_buffer(void);
+void render_color_buffer(screen_rect_t damaged);
 void clear_color_buffer(uint32_t color);
 void clear_z_buffer(void);
 void destroy_window(void);
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include "geometry_cache.h"
+
+#define RENDER_KEY_TEXTURE_MASK (~(uint64_t)0 << RENDER_KEY_TEXTURE_SHIFT)
+
+bool geometry_cache_matches(const geometry_cache_t* cache, const geometry_cache_key_t* key) {
+	return cache->valid &&
+		cache->key.transform_version == key->transform_version &&
+		cache->key.render_method == key->render_method &&
+		cache->key.cull_backface == key->cull_backface &&
+		cache->key.lod_bias == key->lod_bias &&
+		memcmp(&cache->key.view_matrix, &key->view_matrix, sizeof(mat4_t)) == 0 &&
+		memcmp(&cache->key.proj_matrix, &key->proj_matrix, sizeof(mat4_t)) == 0;
+}
+
+static void reserve_streams(geometry_cache_t* cache, int capacity) {
+	if (capacity <= cache->capacity) {
+		return;
+	}
+	free(cache->points);
+	free(cache->w);
+	free(cache->texcoords);
+	free(cache->colors);
+	free(cache->keys);
+	cache->points = malloc(sizeof(vec2_t) * 3 * capacity);
+	cache->w = malloc(sizeof(float) * 3 * capacity);
+	cache->texcoords = malloc(sizeof(tex2_t) * 3 * capacity);
+	cache->colors = malloc(sizeof(uint32_t) * capacity);
+	cache->keys = malloc(sizeof(uint64_t) * capacity);
+	cache->capacity = capacity;
+}
+
+// Keep the triangles the queue got since first_triangle, all from one instance
+// and sampling the texture if any. The handle outlives the texture pointer.
+void geometry_cache_store(geometry_cache_t* cache, const geometry_cache_key_t* key, const render_queue_t* queue, int first_triangle, texture_handle_t texture) {
+	int n = queue->num_triangles - first_triangle;
+	// Nothing queued is kept too, the streams may not exist yet then
+	if (n > 0) {
+		reserve_streams(cache, n);
+		memcpy(cache->points, queue->points + first_triangle * 3, sizeof(vec2_t) * 3 * n);
+		memcpy(cache->w, queue->w + first_triangle * 3, sizeof(float) * 3 * n);
+		memcpy(cache->texcoords, queue->texcoords + first_triangle * 3, sizeof(tex2_t) * 3 * n);
+		memcpy(cache->colors, queue->colors + first_triangle, sizeof(uint32_t) * n);
+	}
+
+	// The triangles of an instance use at most one texture
+	cache->texture = NULL_HANDLE;
+	for (int i = 0; i < n; i++) {
+		uint64_t sort_key = queue->keys[first_triangle + i];
+		if (RENDER_KEY_PASS(sort_key) == RENDER_PASS_TEXTURED) {
+			cache->texture = texture;
+		}
+		cache->keys[i] = sort_key & ~RENDER_KEY_TEXTURE_MASK;
+	}
+
+	cache->key = *key;
+	cache->num_triangles = n;
+	cache->valid = true;
+}
+
+// Add the kept triangles to this frame's queue, false when their texture is
+// gone or doesn't fit in it
+bool geometry_cache_replay(const geometry_cache_t* cache, render_queue_t* queue) {
+	if (cache->num_triangles == 0) {
+		return true;
+	}
+
+	uint64_t texture_bits = 0;
+	if (cache->texture != NULL_HANDLE) {
+		texture_t* texture = get_texture_ptr(cache->texture);
+		int texture_index = texture != NULL ? render_queue_add_texture(queue, texture) : -1;
+		if (texture_index < 0) {
+			return false;
+		}
+		texture_bits = (uint64_t)texture_index << RENDER_KEY_TEXTURE_SHIFT;
+	}
+
+	int n = cache->num_triangles;
+	int first = queue->num_triangles;
+	render_queue_reserve(queue, n);
+	memcpy(queue->points + first * 3, cache->points, sizeof(vec2_t) * 3 * n);
+	memcpy(queue->w + first * 3, cache->w, sizeof(float) * 3 * n);
+	memcpy(queue->texcoords + first * 3, cache->texcoords, sizeof(tex2_t) * 3 * n);
+	memcpy(queue->colors + first, cache->colors, sizeof(uint32_t) * n);
+	for (int i = 0; i < n; i++) {
+		uint64_t sort_key = cache->keys[i];
+		if (RENDER_KEY_PASS(sort_key) == RENDER_PASS_TEXTURED) {
+			sort_key |= texture_bits;
+		}
+		queue->keys[first + i] = sort_key;
+	}
+	queue->num_triangles += n;
+	return true;
+}
+
+void geometry_cache_invalidate(geometry_cache_t* cache) {
+	cache->valid = false;
+}
+
+void geometry_cache_free(geometry_cache_t* cache) {
+	free(cache->points);
+	free(cache->w);
+	free(cache->texcoords);
+	free(cache->colors);
+	free(cache->keys);
+	memset(cache, 0, sizeof(geometry_cache_t));
+}
@@ -0,0 +1,42 @@
+#ifndef GEOMETRY_CACHE_H
+#define GEOMETRY_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "matrix.h"
+#include "render_queue.h"
+#include "texture.h"
+#include "vector.h"
+
+// Everything the projected triangles of an instance depend on, besides the mesh itself
+typedef struct {
+	mat4_t view_matrix;
+	mat4_t proj_matrix;
+	int transform_version;
+	int render_method;
+	bool cull_backface;
+	int lod_bias;
+} geometry_cache_key_t;
+
+// Triangles an instance added to the render queue in an earlier frame, in
+// the same streams as the queue so they are copied back in bulk
+typedef struct {
+	bool valid;
+	geometry_cache_key_t key;
+	texture_handle_t texture;	// of the triangles with the textured pass, NULL_HANDLE for none
+	int num_triangles;
+	int capacity;
+	vec2_t* points;
+	float* w;
+	tex2_t* texcoords;
+	uint32_t* colors;
+	uint64_t* keys;			// sort keys without the texture, which has another index every frame
+} geometry_cache_t;
+
+bool geometry_cache_matches(const geometry_cache_t* cache, const geometry_cache_key_t* key);
+void geometry_cache_store(geometry_cache_t* cache, const geometry_cache_key_t* key, const render_queue_t* queue, int first_triangle, texture_handle_t texture);
+bool geometry_cache_replay(const geometry_cache_t* cache, render_queue_t* queue);
+void geometry_cache_invalidate(geometry_cache_t* cache);
+void geometry_cache_free(geometry_cache_t* cache);
+
+#endif // !GEOMETRY_CACHE_H
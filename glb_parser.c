@@ -0,0 +1,487 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "glb_parser.h"
+#include "mapped_file.h"
+
+#define GLTF_BYTE 5120
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_SHORT 5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+#define GLTF_TRIANGLES 4
+
+enum json_type {
+	JSON_OBJECT,
+	JSON_ARRAY,
+	JSON_STRING,
+	JSON_PRIMITIVE
+};
+
+// Values in the order they appear, so the members of an object or array
+// follow it and next skips over all of them
+typedef struct {
+	int type;
+	int start;				// offsets in the text, strings without their quotes
+	int end;
+	int next;
+} json_token_t;
+
+typedef struct {
+	mapped_file_t file;
+	const char* json;
+	int json_length;
+	const uint8_t* bin;		// the buffer every buffer view of the file points into
+	size_t bin_length;
+	json_token_t* tokens;	// dynamic array, the root object first
+	int parse_position;
+	int accessors;			// tokens of the arrays at the root, -1 if missing
+	int buffer_views;
+} glb_t;
+
+// Elements of an accessor in the binary chunk, stride bytes apart
+typedef struct {
+	const uint8_t* data;
+	int count;
+	size_t stride;
+	int component_type;
+	int num_components;
+} glb_accessor_t;
+
+typedef struct {
+	glb_accessor_t positions;
+	glb_accessor_t tex_coords;	// data is NULL without texture coordinates
+	glb_accessor_t indices;		// data is NULL for primitives that aren't indexed
+	int num_triangles;
+} glb_primitive_t;
+
+static bool json_is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static void json_skip_spaces(glb_t* glb) {
+	while (glb->parse_position < glb->json_length && json_is_space(glb->json[glb->parse_position])) {
+		glb->parse_position++;
+	}
+}
+
+static bool json_expect(glb_t* glb, char c) {
+	json_skip_spaces(glb);
+	if (glb->parse_position >= glb->json_length || glb->json[glb->parse_position] != c) {
+		return false;
+	}
+	glb->parse_position++;
+	return true;
+}
+
+static bool json_parse_value(glb_t* glb, int depth) {
+	json_skip_spaces(glb);
+	if (glb->parse_position >= glb->json_length || depth > GLB_JSON_MAX_DEPTH) {
+		return false;
+	}
+
+	// The token array may move while the members are parsed, so it is only used by index
+	int index = array_length(glb->tokens);
+	json_token_t token = { JSON_PRIMITIVE, glb->parse_position, glb->parse_position, 0 };
+	array_push(glb->tokens, token);
+
+	char c = glb->json[glb->parse_position];
+	if (c == '{' || c == '[') {
+		char close = (c == '{') ? '}' : ']';
+		glb->tokens[index].type = (c == '{') ? JSON_OBJECT : JSON_ARRAY;
+		glb->parse_position++;
+		json_skip_spaces(glb);
+		if (glb->parse_position < glb->json_length && glb->json[glb->parse_position] == close) {
+			glb->parse_position++;
+		}
+		else {
+			for (;;) {
+				if (c == '{') {
+					json_skip_spaces(glb);
+					if (glb->parse_position >= glb->json_length || glb->json[glb->parse_position] != '"' ||
+						!json_parse_value(glb, depth + 1) || !json_expect(glb, ':')) {
+						return false;
+					}
+				}
+				if (!json_parse_value(glb, depth + 1)) {
+					return false;
+				}
+				if (json_expect(glb, close)) {
+					break;
+				}
+				if (!json_expect(glb, ',')) {
+					return false;
+				}
+			}
+		}
+		glb->tokens[index].end = glb->parse_position;
+	}
+	else if (c == '"') {
+		int position = glb->parse_position + 1;
+		while (position < glb->json_length && glb->json[position] != '"') {
+			position += (glb->json[position] == '\\') ? 2 : 1;
+		}
+		if (position >= glb->json_length) {
+			return false;
+		}
+		glb->tokens[index].type = JSON_STRING;
+		glb->tokens[index].start = glb->parse_position + 1;
+		glb->tokens[index].end = position;
+		glb->parse_position = position + 1;
+	}
+	else {
+		while (glb->parse_position < glb->json_length && !json_is_space(glb->json[glb->parse_position]) &&
+			strchr(",:]}", glb->json[glb->parse_position]) == NULL) {
+			glb->parse_position++;
+		}
+		if (glb->parse_position == glb->tokens[index].start) {
+			return false;
+		}
+		glb->tokens[index].end = glb->parse_position;
+	}
+	glb->tokens[index].next = array_length(glb->tokens);
+	return true;
+}
+
+static bool json_string_equals(const glb_t* glb, int token, const char* s) {
+	if (token < 0) {
+		return false;
+	}
+	const json_token_t* t = &glb->tokens[token];
+	size_t length = strlen(s);
+	return t->type == JSON_STRING && (size_t)(t->end - t->start) == length && memcmp(glb->json + t->start, s, length) == 0;
+}
+
+// Value of a member of an object, -1 if it has none by that name
+static int json_get(const glb_t* glb, int object, const char* key) {
+	if (object < 0 || glb->tokens[object].type != JSON_OBJECT) {
+		return -1;
+	}
+	for (int i = object + 1; i < glb->tokens[object].next; i = glb->tokens[i + 1].next) {
+		if (json_string_equals(glb, i, key)) {
+			return i + 1;
+		}
+	}
+	return -1;
+}
+
+static int json_at(const glb_t* glb, int array, int64_t index) {
+	if (array < 0 || glb->tokens[array].type != JSON_ARRAY || index < 0) {
+		return -1;
+	}
+	int n = 0;
+	for (int i = array + 1; i < glb->tokens[array].next; i = glb->tokens[i].next, n++) {
+		if (n == index) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Integer member of an object, glTF only uses integers for indices, counts and offsets
+static int64_t json_get_int(const glb_t* glb, int object, const char* key, int64_t default_value) {
+	int token = json_get(glb, object, key);
+	if (token < 0 || glb->tokens[token].type != JSON_PRIMITIVE) {
+		return default_value;
+	}
+	const char* p = glb->json + glb->tokens[token].start;
+	const char* end = glb->json + glb->tokens[token].end;
+	bool negative = p < end && *p == '-';
+	p += negative;
+	int64_t value = 0;
+	for (; p < end && *p >= '0' && *p <= '9' && value < INT32_MAX; p++) {
+		value = value * 10 + (*p - '0');
+	}
+	return negative ? -value : value;
+}
+
+static void close_glb(glb_t* glb) {
+	array_free(glb->tokens);
+	unmap_file(&glb->file);
+	memset(glb, 0, sizeof(glb_t));
+}
+
+// Maps the file and finds its JSON and binary chunks, only the JSON is parsed
+static bool open_glb(glb_t* glb, const char* filename) {
+	memset(glb, 0, sizeof(glb_t));
+	if (!map_file(&glb->file, filename)) {
+		return false;
+	}
+
+	uint32_t header[3];
+	if (glb->file.size < sizeof(header)) {
+		close_glb(glb);
+		return false;
+	}
+	memcpy(header, glb->file.data, sizeof(header));
+	if (header[0] != GLB_MAGIC || header[1] != 2 || header[2] > glb->file.size) {
+		close_glb(glb);
+		return false;
+	}
+
+	size_t position = sizeof(header);
+	while (position + 8 <= header[2]) {
+		uint32_t chunk[2];
+		memcpy(chunk, glb->file.data + position, sizeof(chunk));
+		position += 8;
+		if (chunk[0] > header[2] - position) {
+			break;
+		}
+		if (chunk[1] == GLB_CHUNK_JSON && glb->json == NULL) {
+			glb->json = glb->file.data + position;
+			glb->json_length = (int)chunk[0];
+		}
+		else if (chunk[1] == GLB_CHUNK_BIN && glb->bin == NULL) {
+			glb->bin = (const uint8_t*)glb->file.data + position;
+			glb->bin_length = chunk[0];
+		}
+		position += (chunk[0] + 3) & ~3u;
+	}
+
+	if (glb->json == NULL || !json_parse_value(glb, 0) || glb->tokens[0].type != JSON_OBJECT) {
+		close_glb(glb);
+		return false;
+	}
+	glb->accessors = json_get(glb, 0, "accessors");
+	glb->buffer_views = json_get(glb, 0, "bufferViews");
+	return true;
+}
+
+// Bytes of a buffer view, which have to be in the binary chunk of the file
+static bool get_buffer_view(const glb_t* glb, int64_t index, const uint8_t** data, size_t* length) {
+	int view = json_at(glb, glb->buffer_views, index);
+	if (view < 0 || json_get_int(glb, view, "buffer", 0) != 0) {
+		return false;
+	}
+	int64_t offset = json_get_int(glb, view, "byteOffset", 0);
+	int64_t byte_length = json_get_int(glb, view, "byteLength", -1);
+	if (offset < 0 || byte_length < 0 || (uint64_t)(offset + byte_length) > glb->bin_length) {
+		return false;
+	}
+	*data = glb->bin + offset;
+	*length = (size_t)byte_length;
+	return true;
+}
+
+static bool get_accessor(const glb_t* glb, int64_t index, glb_accessor_t* accessor) {
+	memset(accessor, 0, sizeof(glb_accessor_t));
+	int token = json_at(glb, glb->accessors, index);
+	if (token < 0 || json_get(glb, token, "sparse") >= 0) {
+		return false;
+	}
+
+	int component_type = (int)json_get_int(glb, token, "componentType", 0);
+	int component_size =
+		(component_type == GLTF_BYTE || component_type == GLTF_UNSIGNED_BYTE) ? 1 :
+		(component_type == GLTF_SHORT || component_type == GLTF_UNSIGNED_SHORT) ? 2 :
+		(component_type == GLTF_UNSIGNED_INT || component_type == GLTF_FLOAT) ? 4 : 0;
+	int type = json_get(glb, token, "type");
+	int num_components =
+		json_string_equals(glb, type, "SCALAR") ? 1 :
+		json_string_equals(glb, type, "VEC2") ? 2 :
+		json_string_equals(glb, type, "VEC3") ? 3 :
+		json_string_equals(glb, type, "VEC4") ? 4 : 0;
+	int64_t count = json_get_int(glb, token, "count", 0);
+	int64_t offset = json_get_int(glb, token, "byteOffset", 0);
+	if (component_size == 0 || num_components == 0 || count <= 0 || count > INT32_MAX || offset < 0) {
+		return false;
+	}
+
+	int64_t view_index = json_get_int(glb, token, "bufferView", -1);
+	const uint8_t* view_data;
+	size_t view_length;
+	if (!get_buffer_view(glb, view_index, &view_data, &view_length)) {
+		return false;
+	}
+	int view = json_at(glb, glb->buffer_views, view_index);
+	size_t element_size = (size_t)component_size * num_components;
+	int64_t stride = json_get_int(glb, view, "byteStride", 0);
+	if (stride == 0) {
+		stride = element_size;
+	}
+	if (stride < (int64_t)element_size ||
+		(uint64_t)offset + (uint64_t)stride * (count - 1) + element_size > view_length) {
+		return false;
+	}
+
+	accessor->data = view_data + offset;
+	accessor->count = (int)count;
+	accessor->stride = (size_t)stride;
+	accessor->component_type = component_type;
+	accessor->num_components = num_components;
+	return true;
+}
+
+static uint32_t read_index(const glb_accessor_t* indices, int i) {
+	const uint8_t* element = indices->data + indices->stride * i;
+	if (indices->component_type == GLTF_UNSIGNED_BYTE) {
+		return element[0];
+	}
+	if (indices->component_type == GLTF_UNSIGNED_SHORT) {
+		uint16_t index;
+		memcpy(&index, element, sizeof(index));
+		return index;
+	}
+	uint32_t index;
+	memcpy(&index, element, sizeof(index));
+	return index;
+}
+
+// Triangle primitive with float positions and indices in range, false for anything else
+static bool get_primitive(const glb_t* glb, int token, glb_primitive_t* primitive) {
+	memset(primitive, 0, sizeof(glb_primitive_t));
+	int attributes = json_get(glb, token, "attributes");
+	if (json_get_int(glb, token, "mode", GLTF_TRIANGLES) != GLTF_TRIANGLES ||
+		!get_accessor(glb, json_get_int(glb, attributes, "POSITION", -1), &primitive->positions) ||
+		primitive->positions.component_type != GLTF_FLOAT || primitive->positions.num_components != 3) {
+		return false;
+	}
+
+	if (!get_accessor(glb, json_get_int(glb, attributes, "TEXCOORD_0", -1), &primitive->tex_coords) ||
+		primitive->tex_coords.component_type != GLTF_FLOAT || primitive->tex_coords.num_components != 2 ||
+		primitive->tex_coords.count != primitive->positions.count) {
+		primitive->tex_coords.data = NULL;
+	}
+
+	int64_t indices = json_get_int(glb, token, "indices", -1);
+	if (indices < 0) {
+		primitive->num_triangles = primitive->positions.count / 3;
+		return true;
+	}
+	glb_accessor_t* index_accessor = &primitive->indices;
+	if (!get_accessor(glb, indices, index_accessor) || index_accessor->num_components != 1 ||
+		(index_accessor->component_type != GLTF_UNSIGNED_BYTE &&
+		index_accessor->component_type != GLTF_UNSIGNED_SHORT &&
+		index_accessor->component_type != GLTF_UNSIGNED_INT)) {
+		return false;
+	}
+	for (int i = 0; i < index_accessor->count; i++) {
+		if (read_index(index_accessor, i) >= (uint32_t)primitive->positions.count) {
+			return false;
+		}
+	}
+	primitive->num_triangles = index_accessor->count / 3;
+	return true;
+}
+
+// Reads the vertices, texture coordinates and triangles of every mesh in a
+// binary glTF file into new dynamic arrays, in the space of the meshes themselves without the node transforms.
+// Primitives that aren't float triangles in the binary chunk are skipped.
+bool parse_glb_file(const char* filename, vec3_t** vertices, tex2_t** uvs, face_t** faces) {
+	glb_t glb;
+	if (!open_glb(&glb, filename)) {
+		return false;
+	}
+
+	// Every primitive is checked first so the outputs get their exact size
+	glb_primitive_t* primitives = NULL;
+	int num_vertices = 0;
+	int num_faces = 0;
+	int meshes = json_get(&glb, 0, "meshes");
+	for (int mesh = json_at(&glb, meshes, 0); mesh >= 0 && mesh < glb.tokens[meshes].next; mesh = glb.tokens[mesh].next) {
+		int primitive_tokens = json_get(&glb, mesh, "primitives");
+		for (int token = json_at(&glb, primitive_tokens, 0); token >= 0 && token < glb.tokens[primitive_tokens].next; token = glb.tokens[token].next) {
+			glb_primitive_t primitive;
+			if (get_primitive(&glb, token, &primitive) && primitive.num_triangles > 0) {
+				array_push(primitives, primitive);
+				num_vertices += primitive.positions.count;
+				num_faces += primitive.num_triangles;
+			}
+		}
+	}
+
+	vec3_t* mesh_vertices = (num_vertices > 0) ? array_hold(NULL, num_vertices, sizeof(vec3_t)) : NULL;
+	tex2_t* mesh_uvs = (num_vertices > 0) ? array_hold(NULL, num_vertices, sizeof(tex2_t)) : NULL;
+	face_t* mesh_faces = (num_faces > 0) ? array_hold(NULL, num_faces, sizeof(face_t)) : NULL;
+	vec3_t* vertex = mesh_vertices;
+	face_t* face = mesh_faces;
+	for (int p = 0; p < array_length(primitives); p++) {
+		const glb_primitive_t* primitive = &primitives[p];
+		const glb_accessor_t* positions = &primitive->positions;
+		int first_vertex = (int)(vertex - mesh_vertices);
+
+		// Tightly packed positions have the layout of vec3_t already
+		if (positions->stride == sizeof(vec3_t)) {
+			memcpy(vertex, positions->data, sizeof(vec3_t) * positions->count);
+		}
+		else {
+			for (int i = 0; i < positions->count; i++) {
+				memcpy(&vertex[i], positions->data + positions->stride * i, sizeof(vec3_t));
+			}
+		}
+		vertex += positions->count;
+
+		tex2_t* uv = mesh_uvs + first_vertex;
+		for (int i = 0; i < positions->count; i++) {
+			uv[i] = (tex2_t){ 0, 0 };
+			if (primitive->tex_coords.data != NULL) {
+				memcpy(&uv[i], primitive->tex_coords.data + primitive->tex_coords.stride * i, sizeof(tex2_t));
+				// glTF puts the origin of the texture at the top, OBJ files at the bottom
+				uv[i].v = 1 - uv[i].v;
+			}
+		}
+
+		for (int t = 0; t < primitive->num_triangles; t++) {
+			uint32_t corners[3];
+			for (int j = 0; j < 3; j++) {
+				corners[j] = (primitive->indices.data != NULL) ? read_index(&primitive->indices, t * 3 + j) : (uint32_t)(t * 3 + j);
+			}
+			face->a = first_vertex + (int)corners[0];
+			face->b = first_vertex + (int)corners[1];
+			face->c = first_vertex + (int)corners[2];
+			face++;
+		}
+	}
+
+	array_free(primitives);
+	close_glb(&glb);
+	*vertices = mesh_vertices;
+	*uvs = mesh_uvs;
+	*faces = mesh_faces;
+	return true;
+}
+
+// Decodes the PNG embedded for the base color of the first material that has
+// one, or else the first image of the file. NULL if there is no such image.
+upng_t* load_glb_png(const char* filename) {
+	glb_t glb;
+	if (!open_glb(&glb, filename)) {
+		return NULL;
+	}
+
+	int images = json_get(&glb, 0, "images");
+	int image = json_at(&glb, images, 0);
+	int materials = json_get(&glb, 0, "materials");
+	for (int material = json_at(&glb, materials, 0); material >= 0 && material < glb.tokens[materials].next; material = glb.tokens[material].next) {
+		int base_color = json_get(&glb, json_get(&glb, material, "pbrMetallicRoughness"), "baseColorTexture");
+		int texture = json_at(&glb, json_get(&glb, 0, "textures"), json_get_int(&glb, base_color, "index", -1));
+		int source = json_at(&glb, images, json_get_int(&glb, texture, "source", -1));
+		if (source >= 0) {
+			image = source;
+			break;
+		}
+	}
+
+	// Images stored outside the file, or in other formats, are not supported
+	upng_t* png_image = NULL;
+	int mime_type = json_get(&glb, image, "mimeType");
+	const uint8_t* data;
+	size_t length;
+	if (image >= 0 && (mime_type < 0 || json_string_equals(&glb, mime_type, "image/png")) &&
+		get_buffer_view(&glb, json_get_int(&glb, image, "bufferView", -1), &data, &length)) {
+		// The decoded pixels don't refer to the mapped bytes, which go away below
+		png_image = upng_new_from_bytes(data, (unsigned long)length);
+		if (png_image != NULL) {
+			upng_decode(png_image);
+			if (upng_get_error(png_image) != UPNG_EOK) {
+				upng_free(png_image);
+				png_image = NULL;
+			}
+		}
+	}
+
+	close_glb(&glb);
+	return png_image;
+}
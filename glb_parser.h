@@ -0,0 +1,17 @@
+#ifndef GLB_PARSER_H
+#define GLB_PARSER_H
+
+#include <stdbool.h>
+#include "triangle.h"
+#include "upng.h"
+#include "vector.h"
+
+#define GLB_MAGIC 0x46546C67		// "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+#define GLB_JSON_MAX_DEPTH 64
+
+bool parse_glb_file(const char* filename, vec3_t** vertices, tex2_t** uvs, face_t** faces);
+upng_t* load_glb_png(const char* filename);
+
+#endif // !GLB_PARSER_H
@@ -0,0 +1,241 @@
+#include <math.h>
+#include <stdlib.h>
+#include "array.h"
+#include "display.h"
+#include "impostor.h"
+#include "light.h"
+#include "mesh_quantize.h"
+#include "triangle.h"
+
+#define IMPOSTOR_ATLAS_SIZE (IMPOSTOR_CELL_SIZE * IMPOSTOR_ATLAS_CELLS)
+#define IMPOSTOR_NUM_CELLS (IMPOSTOR_ATLAS_CELLS * IMPOSTOR_ATLAS_CELLS)
+// Distance of the impostor camera from the center, in bounding sphere radii
+#define IMPOSTOR_CAMERA_DISTANCE 10.0
+
+// What is rendered in each cell of the atlas
+typedef struct {
+	mesh_handle_t mesh_handle;	// NULL_HANDLE while the cell is free
+	int bucket;				// view direction bucket
+	bool textured;
+	unsigned int last_used;	// frame the cell was last drawn in
+} impostor_cell_t;
+
+static texture_t atlas;
+static float cell_z_buffer[IMPOSTOR_CELL_SIZE * IMPOSTOR_CELL_SIZE];
+static impostor_cell_t cells[IMPOSTOR_NUM_CELLS];
+static unsigned int frame = 0;
+
+void init_impostors(void) {
+	atlas.width = IMPOSTOR_ATLAS_SIZE;
+	atlas.height = IMPOSTOR_ATLAS_SIZE;
+	atlas.pixels = calloc(IMPOSTOR_ATLAS_SIZE * IMPOSTOR_ATLAS_SIZE, sizeof(uint32_t));
+	for (int i = 0; i < IMPOSTOR_NUM_CELLS; i++) {
+		cells[i].mesh_handle = NULL_HANDLE;
+	}
+}
+
+void begin_impostor_frame(void) {
+	frame++;
+}
+
+// The images of a mesh that changed are rendered again when next needed
+void invalidate_mesh_impostors(mesh_handle_t mesh_handle) {
+	for (int i = 0; i < IMPOSTOR_NUM_CELLS; i++) {
+		if (cells[i].mesh_handle == mesh_handle) {
+			cells[i].mesh_handle = NULL_HANDLE;
+		}
+	}
+}
+
+void free_impostors(void) {
+	free(atlas.pixels);
+	atlas.pixels = NULL;
+}
+
+// Buckets are centered on the axes, so the common views straight from the
+// front or the side are rendered from exactly their direction
+static int direction_bucket(vec3_t direction) {
+	float yaw = atan2f(direction.x, direction.z);
+	float pitch = asinf(fmaxf(-1.0f, fminf(1.0f, direction.y)));
+	int yaw_bucket = (int)((yaw + M_PI) / (2 * M_PI) * IMPOSTOR_YAW_BUCKETS + 0.5) % IMPOSTOR_YAW_BUCKETS;
+	int pitch_bucket = (int)((pitch + M_PI / 2) / M_PI * (IMPOSTOR_PITCH_BUCKETS - 1) + 0.5);
+	return pitch_bucket * IMPOSTOR_YAW_BUCKETS + yaw_bucket;
+}
+
+static vec3_t bucket_direction(int bucket) {
+	float yaw = (bucket % IMPOSTOR_YAW_BUCKETS) / (float)IMPOSTOR_YAW_BUCKETS * 2 * M_PI - M_PI;
+	float pitch = (bucket / IMPOSTOR_YAW_BUCKETS) / (float)(IMPOSTOR_PITCH_BUCKETS - 1) * M_PI - M_PI / 2;
+	return vec3_new(sinf(yaw) * cosf(pitch), sinf(pitch), cosf(yaw) * cosf(pitch));
+}
+
+// Camera axes looking at the mesh from a bucket direction, without roll
+static void bucket_axes(int bucket, vec3_t* x_axis, vec3_t* y_axis, vec3_t* z_axis) {
+	vec3_t to_camera = bucket_direction(bucket);
+	*z_axis = vec3_mul(to_camera, -1);
+	vec3_t up = fabsf(to_camera.y) > 0.99 ? vec3_new(0, 0, 1) : vec3_new(0, 1, 0);
+	*x_axis = vec3_cross(up, *z_axis);
+	vec3_normalize(x_axis);
+	*y_axis = vec3_cross(*z_axis, *x_axis);
+}
+
+// Render the mesh into its cell with a camera that fits the bounding sphere
+static void render_cell(int cell, mesh_t* mesh, int bucket, bool textured) {
+	vec3_t x_axis, y_axis, z_axis;
+	bucket_axes(bucket, &x_axis, &y_axis, &z_axis);
+	float radius = mesh->bounds_radius > 0 ? mesh->bounds_radius : 1;
+	float distance = IMPOSTOR_CAMERA_DISTANCE * radius;
+	vec3_t eye = vec3_sub(mesh->bounds_center, vec3_mul(z_axis, distance));
+	float focal = sqrtf(distance * distance - radius * radius) / radius;
+
+	// One texel of border stays transparent so sampling never bleeds into the next cell
+	int cell_x = (cell % IMPOSTOR_ATLAS_CELLS) * IMPOSTOR_CELL_SIZE;
+	int cell_y = (cell / IMPOSTOR_ATLAS_CELLS) * IMPOSTOR_CELL_SIZE;
+	render_target_t target = {
+		atlas.pixels + cell_y * IMPOSTOR_ATLAS_SIZE + cell_x,
+		cell_z_buffer,
+		IMPOSTOR_CELL_SIZE,
+		IMPOSTOR_CELL_SIZE,
+		IMPOSTOR_ATLAS_SIZE
+	};
+	float half_size = (IMPOSTOR_CELL_SIZE - 2) / 2.0;
+
+	set_render_target(&target);
+	clear_color_buffer(0x00000000);
+	clear_z_buffer();
+
+	face_t* faces = mesh->lods[0];
+	int num_faces = array_length(faces);
+	for (int i = 0; i < num_faces; i++) {
+		face_t face = faces[i];
+		int indices[3] = { face.a, face.b, face.c };
+
+		vec4_t view_vertices[3];
+		vec4_t screen_vertices[3];
+		for (int j = 0; j < 3; j++) {
+			vec3_t p = vec3_sub(get_mesh_vertex(mesh, indices[j]), eye);
+			view_vertices[j] = vec4_from_vec3(vec3_new(vec3_dot(p, x_axis), vec3_dot(p, y_axis), vec3_dot(p, z_axis)));
+			screen_vertices[j].x = 1 + half_size + focal * view_vertices[j].x / view_vertices[j].z * half_size;
+			screen_vertices[j].y = 1 + half_size - focal * view_vertices[j].y / view_vertices[j].z * half_size;
+			screen_vertices[j].w = view_vertices[j].z;
+		}
+
+		vec3_t normal = get_triangle_normal(view_vertices);
+		vec3_t camera_ray = vec3_mul(vec3_from_vec4(view_vertices[0]), -1);
+		if (vec3_dot(normal, camera_ray) < 0) {
+			continue;
+		}
+
+		if (textured) {
+			tex2_t uvs[3] = { get_mesh_uv(mesh, face.a), get_mesh_uv(mesh, face.b), get_mesh_uv(mesh, face.c) };
+			draw_textured_triangle(
+				screen_vertices[0].x, screen_vertices[0].y, screen_vertices[0].w, uvs[0].u, uvs[0].v,
+				screen_vertices[1].x, screen_vertices[1].y, screen_vertices[1].w, uvs[1].u, uvs[1].v,
+				screen_vertices[2].x, screen_vertices[2].y, screen_vertices[2].w, uvs[2].u, uvs[2].v,
+				get_texture_ptr(mesh->texture)
+			);
+		}
+		else {
+			// Lit like the rest of the scene, with the light relative to the camera
+			float lambert_factor = -vec3_dot(normal, get_light_direction());
+			draw_filled_triangle(
+				screen_vertices[0].x, screen_vertices[0].y, screen_vertices[0].w,
+				screen_vertices[1].x, screen_vertices[1].y, screen_vertices[1].w,
+				screen_vertices[2].x, screen_vertices[2].y, screen_vertices[2].w,
+				light_apply_intensity(MESH_COLOR, lambert_factor)
+			);
+		}
+	}
+
+	set_render_target(NULL);
+}
+
+// Find the cell with the image of the mesh from a direction, rendering it if
+// needed in a cell that isn't used this frame, returns -1 if all of them are
+static int find_cell(instance_t* instance, mesh_t* mesh, int bucket, bool textured) {
+	impostor_cell_t* cached = instance->impostor_cell >= 0 ? &cells[instance->impostor_cell] : NULL;
+	if (cached && cached->mesh_handle == instance->mesh_handle && cached->bucket == bucket && cached->textured == textured) {
+		cached->last_used = frame;
+		return instance->impostor_cell;
+	}
+
+	// Free cells come first, then the least recently used ones
+	int oldest = -1;
+	for (int i = 0; i < IMPOSTOR_NUM_CELLS; i++) {
+		if (cells[i].mesh_handle == instance->mesh_handle && cells[i].bucket == bucket && cells[i].textured == textured) {
+			cells[i].last_used = frame;
+			return i;
+		}
+		if (cells[i].mesh_handle == NULL_HANDLE) {
+			if (oldest < 0 || cells[oldest].mesh_handle != NULL_HANDLE) oldest = i;
+		}
+		else if (cells[i].last_used != frame) {
+			if (oldest < 0 || (cells[oldest].mesh_handle != NULL_HANDLE && cells[i].last_used < cells[oldest].last_used)) oldest = i;
+		}
+	}
+	if (oldest < 0) {
+		return -1;
+	}
+
+	impostor_cell_t cell = { instance->mesh_handle, bucket, textured, frame };
+	cells[oldest] = cell;
+	render_cell(oldest, mesh, bucket, textured);
+	return oldest;
+}
+
+// Fill a camera facing quad in view space that shows the prerendered image of
+// the instance, returns the atlas to texture it with or NULL if there is no room
+texture_t* build_impostor_quad(
+	instance_t* instance, mesh_t* mesh, mat4_t world_view_matrix, bool textured,
+	vec4_t quad_vertices[4], tex2_t quad_texcoords[4]
+) {
+	if (atlas.pixels == NULL) {
+		return NULL;
+	}
+
+	// Move the camera to the local space of the mesh, the scale is uniform
+	vec3_t column_x = vec3_new(world_view_matrix.m[0][0], world_view_matrix.m[1][0], world_view_matrix.m[2][0]);
+	vec3_t column_y = vec3_new(world_view_matrix.m[0][1], world_view_matrix.m[1][1], world_view_matrix.m[2][1]);
+	vec3_t column_z = vec3_new(world_view_matrix.m[0][2], world_view_matrix.m[1][2], world_view_matrix.m[2][2]);
+	vec3_t translation = vec3_new(world_view_matrix.m[0][3], world_view_matrix.m[1][3], world_view_matrix.m[2][3]);
+	float scale_squared = vec3_dot(column_x, column_x);
+	vec3_t camera = vec3_div(
+		vec3_new(-vec3_dot(column_x, translation), -vec3_dot(column_y, translation), -vec3_dot(column_z, translation)),
+		scale_squared
+	);
+	vec3_t to_camera = vec3_sub(camera, mesh->bounds_center);
+	vec3_normalize(&to_camera);
+
+	int bucket = direction_bucket(to_camera);
+	int cell = find_cell(instance, mesh, bucket, textured);
+	if (cell < 0) {
+		return NULL;
+	}
+	instance->impostor_cell = cell;
+
+	// The quad spans the silhouette of the bounding sphere seen from the impostor camera
+	vec3_t x_axis, y_axis, z_axis;
+	bucket_axes(bucket, &x_axis, &y_axis, &z_axis);
+	vec4_t center = mat4_mul_vec4(world_view_matrix, vec4_from_vec3(mesh->bounds_center));
+	vec3_t right = vec3_from_vec4(mat4_mul_vec4(world_view_matrix, (vec4_t) { x_axis.x, x_axis.y, x_axis.z, 0 }));
+	vec3_t up = vec3_from_vec4(mat4_mul_vec4(world_view_matrix, (vec4_t) { y_axis.x, y_axis.y, y_axis.z, 0 }));
+	float half_size = IMPOSTOR_CAMERA_DISTANCE / sqrtf(IMPOSTOR_CAMERA_DISTANCE * IMPOSTOR_CAMERA_DISTANCE - 1);
+	right = vec3_mul(right, half_size * mesh->bounds_radius);
+	up = vec3_mul(up, half_size * mesh->bounds_radius);
+
+	float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+	float u0 = ((cell % IMPOSTOR_ATLAS_CELLS) * IMPOSTOR_CELL_SIZE + 1) / (float)IMPOSTOR_ATLAS_SIZE;
+	float v0 = ((cell / IMPOSTOR_ATLAS_CELLS) * IMPOSTOR_CELL_SIZE + 1) / (float)IMPOSTOR_ATLAS_SIZE;
+	float texcoord_size = (IMPOSTOR_CELL_SIZE - 2) / (float)IMPOSTOR_ATLAS_SIZE;
+	for (int i = 0; i < 4; i++) {
+		vec3_t corner = vec3_add(
+			vec3_from_vec4(center),
+			vec3_add(vec3_mul(right, corners[i][0]), vec3_mul(up, corners[i][1]))
+		);
+		quad_vertices[i] = vec4_from_vec3(corner);
+
+		// The textured rasterizer flips v, so the top of the cell is v = 1
+		quad_texcoords[i].u = u0 + (corners[i][0] * 0.5 + 0.5) * texcoord_size;
+		quad_texcoords[i].v = 1 - (v0 + (0.5 - corners[i][1] * 0.5) * texcoord_size);
+	}
+	return &atlas;
+}
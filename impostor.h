@@ -0,0 +1,26 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include <stdbool.h>
+#include "instance.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "texture.h"
+
+// Instances smaller than this radius in pixels are drawn as a quad with a prerendered image
+#define IMPOSTOR_SCREEN_RADIUS 12.0
+#define IMPOSTOR_CELL_SIZE 48
+#define IMPOSTOR_ATLAS_CELLS 16		// cells in each row and column of the atlas
+#define IMPOSTOR_YAW_BUCKETS 16		// view directions the images are rendered from
+#define IMPOSTOR_PITCH_BUCKETS 9
+
+void init_impostors(void);
+void begin_impostor_frame(void);
+texture_t* build_impostor_quad(
+	instance_t* instance, mesh_t* mesh, mat4_t world_view_matrix, bool textured,
+	vec4_t quad_vertices[4], tex2_t quad_texcoords[4]
+);
+void invalidate_mesh_impostors(mesh_handle_t mesh_handle);
+void free_impostors(void);
+
+#endif // !IMPOSTOR_H
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include "array.h"
+#include "instance.h"
+
+static instance_t* instances = NULL;	// dynamic array of instances
+static int* dirty_instances = NULL;	// dynamic array of instances whose transform changed
+
+int create_instance(mesh_handle_t mesh_handle, vec3_t scale, vec3_t rotation, vec3_t translation)
+{
+  instance_t instance = {
+    .mesh_handle = mesh_handle,
+    .scale = scale,
+    .rotation = rotation,
+    .translation = translation,
+    .impostor_cell = -1
+  };
+  array_push(instances, instance);
+  return array_length(instances) - 1;
+}
+
+int get_num_instances(void)
+{
+  return array_length(instances);
+}
+
+instance_t* get_instance_ptr(int index)
+{
+  if (index < 0 || index >= array_length(instances))
+    return NULL;
+  return &instances[index];
+}
+
+static void mark_dirty(int index)
+{
+  instances[index].transform_version++;
+  if (!instances[index].transform_dirty) {
+    instances[index].transform_dirty = true;
+    array_push(dirty_instances, index);
+  }
+}
+
+void set_instance_scale(int index, vec3_t scale)
+{
+  instances[index].scale = scale;
+  mark_dirty(index);
+}
+
+void set_instance_rotation(int index, vec3_t rotation)
+{
+  instances[index].rotation = rotation;
+  mark_dirty(index);
+}
+
+void set_instance_translation(int index, vec3_t translation)
+{
+  instances[index].translation = translation;
+  mark_dirty(index);
+}
+
+// The mesh of these instances changed under them, so their bounds and the
+// triangles queued for them are updated like after a move
+void mark_mesh_instances_dirty(mesh_handle_t mesh_handle)
+{
+  for (int i = 0; i < array_length(instances); i++) {
+    if (instances[i].mesh_handle == mesh_handle) {
+      mark_dirty(i);
+    }
+  }
+}
+
+mat4_t get_instance_world_matrix(instance_t* instance)
+{
+  mat4_t scale_matrix = mat4_make_scale(instance->scale.x, instance->scale.y, instance->scale.z);
+  mat4_t translation_matrix = mat4_make_translation(
+    instance->translation.x, instance->translation.y, instance->translation.z
+  );
+  mat4_t rotation_matrix_x = mat4_make_rotation_x(instance->rotation.x);
+  mat4_t rotation_matrix_y = mat4_make_rotation_y(instance->rotation.y);
+  mat4_t rotation_matrix_z = mat4_make_rotation_z(instance->rotation.z);
+
+  // Scale first, then rotate around z, y and x, and finally translate
+  mat4_t world_matrix = mat4_identity();
+  world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
+  mat4_t rotation_matrix = mat4_identity();
+  rotation_matrix = mat4_mul_mat4(rotation_matrix_z, rotation_matrix);
+  rotation_matrix = mat4_mul_mat4(rotation_matrix_y, rotation_matrix);
+  rotation_matrix = mat4_mul_mat4(rotation_matrix_x, rotation_matrix);
+  world_matrix = mat4_mul_mat4(rotation_matrix, world_matrix);
+  world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+  return world_matrix;
+}
+
+// Instances moved with the setters since the last clear
+int* get_dirty_instances(int* num_dirty)
+{
+  *num_dirty = array_length(dirty_instances);
+  return dirty_instances;
+}
+
+void clear_dirty_instances(void)
+{
+  for (int i = 0; i < array_length(dirty_instances); i++) {
+    instances[dirty_instances[i]].transform_dirty = false;
+  }
+  array_free(dirty_instances);
+  dirty_instances = NULL;
+}
+
+void free_instances(void)
+{
+  for (int i = 0; i < array_length(instances); i++) {
+    geometry_cache_free(&instances[i].geometry_cache);
+  }
+  array_free(dirty_instances);
+  dirty_instances = NULL;
+  array_free(instances);
+  instances = NULL;
+}
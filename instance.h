@@ -0,0 +1,38 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <stdbool.h>
+#include "geometry_cache.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "screen_rect.h"
+#include "vector.h"
+
+// A placement of a mesh in the scene, many instances can share the same mesh
+typedef struct {
+	mesh_handle_t mesh_handle;	// mesh resource drawn by this instance
+	vec3_t scale;
+	vec3_t rotation;		// rotation with x, y, z values
+	vec3_t translation;
+	int lod_level;			// level of detail drawn in the last frame
+	bool transform_dirty;	// changed since the scene last took the dirty instances
+	int transform_version;	// bumped every time the transform is set
+	int impostor_cell;		// atlas cell last used to draw it as an impostor, -1 for none
+	geometry_cache_t geometry_cache;	// triangles queued in an earlier frame
+	screen_rect_t screen_bounds;	// pixels its triangles covered when last drawn
+	int drawn_frame;		// last frame it went through the pipeline
+} instance_t;
+
+int create_instance(mesh_handle_t mesh_handle, vec3_t scale, vec3_t rotation, vec3_t translation);
+int get_num_instances(void);
+instance_t* get_instance_ptr(int index);
+void set_instance_scale(int index, vec3_t scale);
+void set_instance_rotation(int index, vec3_t rotation);
+void set_instance_translation(int index, vec3_t translation);
+void mark_mesh_instances_dirty(mesh_handle_t mesh_handle);
+mat4_t get_instance_world_matrix(instance_t* instance);
+int* get_dirty_instances(int* num_dirty);
+void clear_dirty_instances(void);
+void free_instances(void);
+
+#endif // !INSTANCE_H
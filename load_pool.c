@@ -0,0 +1,121 @@
+#include <stdbool.h>
+#include <SDL.h>
+#include "array.h"
+#include "load_pool.h"
+
+typedef struct {
+	load_job_function_t function;
+	void* data;
+} load_job_t;
+
+// Threads loading assets in the background. The lock only guards the list of
+// jobs, what the jobs produce is handed back by the callers themselves.
+static SDL_Thread* threads[LOAD_POOL_MAX_THREADS];
+static int num_threads = 0;
+static SDL_mutex* lock = NULL;
+static SDL_cond* job_added = NULL;
+static SDL_cond* jobs_finished = NULL;
+static load_job_t* jobs = NULL;		// dynamic array, taken in order from next_job
+static int next_job = 0;
+static int num_running = 0;
+static bool quitting = false;
+
+static int run_load_thread(void* data) {
+	(void)data;
+	SDL_LockMutex(lock);
+	while (true) {
+		while (next_job == array_length(jobs) && !quitting) {
+			SDL_CondWait(job_added, lock);
+		}
+		if (next_job == array_length(jobs)) {
+			break;
+		}
+		load_job_t job = jobs[next_job++];
+		num_running++;
+		SDL_UnlockMutex(lock);
+
+		job.function(job.data);
+
+		SDL_LockMutex(lock);
+		num_running--;
+		if (next_job == array_length(jobs) && num_running == 0) {
+			// Everything submitted is done, start the list over
+			array_free(jobs);
+			jobs = NULL;
+			next_job = 0;
+			SDL_CondBroadcast(jobs_finished);
+		}
+	}
+	SDL_UnlockMutex(lock);
+	return 0;
+}
+
+// The threads start with the first job, one less than the cores so the main
+// thread keeps drawing frames
+static void init_load_pool(void) {
+	lock = SDL_CreateMutex();
+	job_added = SDL_CreateCond();
+	jobs_finished = SDL_CreateCond();
+	quitting = false;
+
+	int num_cores = SDL_GetCPUCount();
+	int count = num_cores > 1 ? num_cores - 1 : 1;
+	count = count < LOAD_POOL_MAX_THREADS ? count : LOAD_POOL_MAX_THREADS;
+	for (num_threads = 0; num_threads < count; num_threads++) {
+		threads[num_threads] = SDL_CreateThread(run_load_thread, "load", NULL);
+		if (threads[num_threads] == NULL) {
+			break;
+		}
+	}
+}
+
+// Runs the function on a loader thread, or right away if there are none
+void submit_load_job(load_job_function_t function, void* data) {
+	if (lock == NULL) {
+		init_load_pool();
+	}
+	if (num_threads == 0) {
+		function(data);
+		return;
+	}
+	load_job_t job = { function, data };
+	SDL_LockMutex(lock);
+	array_push(jobs, job);
+	SDL_CondSignal(job_added);
+	SDL_UnlockMutex(lock);
+}
+
+// Blocks until every submitted job has finished
+void wait_load_jobs(void) {
+	if (lock == NULL) {
+		return;
+	}
+	SDL_LockMutex(lock);
+	while (next_job < array_length(jobs) || num_running > 0) {
+		SDL_CondWait(jobs_finished, lock);
+	}
+	SDL_UnlockMutex(lock);
+}
+
+// Finishes the jobs left and stops the threads
+void free_load_pool(void) {
+	if (lock == NULL) {
+		return;
+	}
+	SDL_LockMutex(lock);
+	quitting = true;
+	SDL_CondBroadcast(job_added);
+	SDL_UnlockMutex(lock);
+	for (int i = 0; i < num_threads; i++) {
+		SDL_WaitThread(threads[i], NULL);
+	}
+	num_threads = 0;
+
+	array_free(jobs);
+	jobs = NULL;
+	next_job = 0;
+	SDL_DestroyCond(jobs_finished);
+	SDL_DestroyCond(job_added);
+	SDL_DestroyMutex(lock);
+	lock = NULL;
+}
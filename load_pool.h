@@ -0,0 +1,13 @@
+#ifndef LOAD_POOL_H
+#define LOAD_POOL_H
+
+#define LOAD_POOL_MAX_THREADS 8
+
+// Work done on a loader thread, data is owned by the caller
+typedef void (*load_job_function_t)(void* data);
+
+void submit_load_job(load_job_function_t function, void* data);
+void wait_load_jobs(void);
+void free_load_pool(void);
+
+#endif // !LOAD_POOL_H
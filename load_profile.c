@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "load_profile.h"
+
+static const char* phase_names[NUM_LOAD_PHASES] = {
+	"cache", "parse", "setup", "png_read", "png_inflate", "png_unfilter", "publish"
+};
+
+// Only the main thread adds profiles, each is then filled in by whichever thread loads its asset
+static load_profile_t profiles[MAX_NUM_LOAD_PROFILES];
+static int num_profiles = 0;
+
+static Uint64 startup_start = 0;
+static bool has_window = false;		// the headless modes report no window or setup times
+static double window_seconds = 0;
+static double setup_seconds = 0;
+
+static double seconds_since(Uint64 start) {
+	return (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+// NULL once the report is full, the phase functions ignore it then
+load_profile_t* begin_load_profile(const char* name) {
+	if (num_profiles == MAX_NUM_LOAD_PROFILES) {
+		return NULL;
+	}
+	load_profile_t* profile = &profiles[num_profiles++];
+	memset(profile, 0, sizeof(load_profile_t));
+	snprintf(profile->name, sizeof(profile->name), "%s", name);
+	return profile;
+}
+
+// Adds the time since start, from SDL_GetPerformanceCounter, to the phase
+void end_load_phase(load_profile_t* profile, load_phase_t phase, Uint64 start) {
+	add_load_seconds(profile, phase, seconds_since(start));
+}
+
+void add_load_seconds(load_profile_t* profile, load_phase_t phase, double seconds) {
+	if (profile != NULL) {
+		profile->seconds[phase] += seconds;
+	}
+}
+
+void add_load_bytes(load_profile_t* profile, size_t bytes_read, size_t bytes_held) {
+	if (profile == NULL) {
+		return;
+	}
+	profile->bytes_read += bytes_read;
+	if (bytes_held > profile->peak_bytes) {
+		profile->peak_bytes = bytes_held;
+	}
+}
+
+// 0 for a file that can't be found
+size_t get_file_size(const char* filename) {
+	struct stat info;
+	if (stat(filename, &info) != 0) {
+		return 0;
+	}
+	return (size_t)info.st_size;
+}
+
+// Startup is timed from here, the first thing main does
+void begin_startup_profile(void) {
+	startup_start = SDL_GetPerformanceCounter();
+}
+
+void set_startup_seconds(double window, double setup) {
+	has_window = true;
+	window_seconds = window;
+	setup_seconds = setup;
+}
+
+static double get_total_seconds(const load_profile_t* profile) {
+	double total = 0;
+	for (int phase = 0; phase < NUM_LOAD_PHASES; phase++) {
+		total += profile->seconds[phase];
+	}
+	return total;
+}
+
+static void write_json_string(FILE* fp, const char* string) {
+	fputc('"', fp);
+	for (const char* c = string; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', fp);
+		}
+		fputc(*c, fp);
+	}
+	fputc('"', fp);
+}
+
+static bool write_load_report(FILE* fp, double loaded_seconds) {
+	fprintf(fp, "{\n");
+	if (has_window) {
+		fprintf(fp, "\t\"window_seconds\": %.6f,\n", window_seconds);
+		fprintf(fp, "\t\"setup_seconds\": %.6f,\n", setup_seconds);
+	}
+	fprintf(fp, "\t\"loaded_seconds\": %.6f,\n", loaded_seconds);
+	fprintf(fp, "\t\"assets\": [");
+	for (int i = 0; i < num_profiles; i++) {
+		const load_profile_t* profile = &profiles[i];
+		fprintf(fp, "%s\n\t\t{\n\t\t\t\"name\": ", i > 0 ? "," : "");
+		write_json_string(fp, profile->name);
+		fprintf(fp, ",\n\t\t\t\"cached\": %s,\n", profile->cached ? "true" : "false");
+		fprintf(fp, "\t\t\t\"bytes_read\": %zu,\n", profile->bytes_read);
+		fprintf(fp, "\t\t\t\"peak_bytes\": %zu,\n", profile->peak_bytes);
+		fprintf(fp, "\t\t\t\"vertices\": %d,\n", profile->num_vertices);
+		fprintf(fp, "\t\t\t\"faces\": %d,\n", profile->num_faces);
+		fprintf(fp, "\t\t\t\"vertex_bytes\": %zu,\n", profile->vertex_bytes);
+		fprintf(fp, "\t\t\t\"quantized\": %s,\n", profile->quantized ? "true" : "false");
+		fprintf(fp, "\t\t\t\"acmr_before\": %.4f,\n", profile->order_stats.acmr_before);
+		fprintf(fp, "\t\t\t\"acmr_after\": %.4f,\n", profile->order_stats.acmr_after);
+		fprintf(fp, "\t\t\t\"overdraw_before\": %.4f,\n", profile->order_stats.overdraw_before);
+		fprintf(fp, "\t\t\t\"overdraw_after\": %.4f,\n", profile->order_stats.overdraw_after);
+		fprintf(fp, "\t\t\t\"chunks\": %d,\n", profile->num_chunks);
+		fprintf(fp, "\t\t\t\"seconds\": {");
+		for (int phase = 0; phase < NUM_LOAD_PHASES; phase++) {
+			fprintf(fp, "%s \"%s\": %.6f", phase > 0 ? "," : "", phase_names[phase], profile->seconds[phase]);
+		}
+		fprintf(fp, " }\n\t\t}");
+	}
+	fprintf(fp, "\n\t]\n}\n");
+	return !ferror(fp);
+}
+
+// Once every asset of the scene is loaded. Prints where the startup time went
+// and writes it as JSON too if a filename is given, false if that fails.
+bool end_startup_profile(const char* report_filename) {
+	double loaded_seconds = startup_start != 0 ? seconds_since(startup_start) : 0;
+	if (has_window) {
+		printf(
+			"Startup: window %.3f s, setup %.3f s, assets loaded after %.3f s\n",
+			window_seconds, setup_seconds, loaded_seconds
+		);
+	}
+	else {
+		printf("Startup: assets loaded after %.3f s\n", loaded_seconds);
+	}
+	for (int i = 0; i < num_profiles; i++) {
+		const load_profile_t* profile = &profiles[i];
+		printf(
+			"  %s: %.3f s%s, %zu KB read, peak %zu KB\n  ",
+			profile->name, get_total_seconds(profile), profile->cached ? " from cache" : "",
+			profile->bytes_read / 1024, profile->peak_bytes / 1024
+		);
+		for (int phase = 0; phase < NUM_LOAD_PHASES; phase++) {
+			if (profile->seconds[phase] > 0) {
+				printf("  %s %.2f ms", phase_names[phase], profile->seconds[phase] * 1000);
+			}
+		}
+		printf("\n");
+		if (profile->num_chunks > 0) {
+			printf("    %d chunks\n", profile->num_chunks);
+		}
+		if (profile->num_faces > 0) {
+			printf(
+				"    %d %svertices in %zu KB, %d faces, %.3f vertices per face and %.3f overdraw, from %.3f and %.3f before reordering\n",
+				profile->num_vertices, profile->quantized ? "quantized " : "", profile->vertex_bytes / 1024, profile->num_faces,
+				profile->order_stats.acmr_after, profile->order_stats.overdraw_after,
+				profile->order_stats.acmr_before, profile->order_stats.overdraw_before
+			);
+		}
+	}
+
+	if (report_filename == NULL) {
+		return true;
+	}
+	FILE* fp = fopen(report_filename, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not write %s\n", report_filename);
+		return false;
+	}
+	bool written = write_load_report(fp, loaded_seconds);
+	written = fclose(fp) == 0 && written;
+	printf(written ? "Saved %s\n" : "Could not write %s\n", report_filename);
+	return written;
+}
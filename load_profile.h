@@ -0,0 +1,49 @@
+#ifndef LOAD_PROFILE_H
+#define LOAD_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <SDL.h>
+#include "mesh.h"
+
+// Most assets a startup report lists, later ones are loaded but not profiled
+#define MAX_NUM_LOAD_PROFILES 256
+
+// Steps the load of an asset goes through, not all of them happen for every asset
+typedef enum {
+	LOAD_PHASE_CACHE,		// mapping the binary cache, the whole load when it is up to date
+	LOAD_PHASE_PARSE,		// reading the OBJ or glTF file into arrays
+	LOAD_PHASE_SETUP,		// bounds, levels of detail, face order, hierarchy and writing the cache
+	LOAD_PHASE_PNG_READ,
+	LOAD_PHASE_PNG_INFLATE,
+	LOAD_PHASE_PNG_UNFILTER,
+	LOAD_PHASE_PUBLISH,		// main thread time taking over what the loader thread made
+	NUM_LOAD_PHASES
+} load_phase_t;
+
+// Each phase is written by one thread, the loader's or the main one, and read once the asset is done
+typedef struct {
+	char name[260];
+	double seconds[NUM_LOAD_PHASES];
+	size_t bytes_read;
+	size_t peak_bytes;		// most the buffers of the load held at once, counted rather than measured
+	bool cached;			// came from an up to date binary cache
+	// What the mesh came out as
+	int num_vertices;
+	int num_faces;
+	size_t vertex_bytes;	// of the stored positions and texture coordinates
+	bool quantized;
+	mesh_order_stats_t order_stats;
+	int num_chunks;			// of a streamed mesh
+} load_profile_t;
+
+load_profile_t* begin_load_profile(const char* name);
+void end_load_phase(load_profile_t* profile, load_phase_t phase, Uint64 start);
+void add_load_seconds(load_profile_t* profile, load_phase_t phase, double seconds);
+void add_load_bytes(load_profile_t* profile, size_t bytes_read, size_t bytes_held);
+size_t get_file_size(const char* filename);
+void begin_startup_profile(void);
+void set_startup_seconds(double window_seconds, double setup_seconds);
+bool end_startup_profile(const char* report_filename);
+
+#endif // !LOAD_PROFILE_H
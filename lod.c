@@ -0,0 +1,363 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "lod.h"
+
+#define MAX_VERTEX_NEIGHBORS 64
+
+// Symmetric 4x4 matrix accumulating the squared distance to a set of planes
+typedef struct {
+	double q[10];
+} quadric_t;
+
+typedef struct {
+	int from;
+	int to;
+	double cost;
+} collapse_t;
+
+typedef struct {
+	vec3_t* vertices;
+	face_t* faces;			// working copy of the faces being simplified
+	bool* face_alive;
+	int num_faces;
+	int num_alive;
+	quadric_t* quadrics;
+	bool* locked;			// vertices on borders that must stay in place, UV seams included
+	int* face_offsets;		// faces around each vertex, built at the start of every pass
+	int* vertex_faces;
+} simplifier_t;
+
+static void quadric_add_plane(quadric_t* quadric, double a, double b, double c, double d, double weight) {
+	double* q = quadric->q;
+	q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c; q[3] += weight * a * d;
+	q[4] += weight * b * b; q[5] += weight * b * c; q[6] += weight * b * d;
+	q[7] += weight * c * c; q[8] += weight * c * d;
+	q[9] += weight * d * d;
+}
+
+static double quadric_error(const quadric_t* quadric, vec3_t v) {
+	const double* q = quadric->q;
+	double x = v.x, y = v.y, z = v.z;
+	return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+		q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+		q[7] * z * z + 2 * q[8] * z +
+		q[9];
+}
+
+static int face_corner(face_t* face, int vertex) {
+	if (face->a == vertex) return 0;
+	if (face->b == vertex) return 1;
+	if (face->c == vertex) return 2;
+	return -1;
+}
+
+static int* corner_index(face_t* face, int corner) {
+	return corner == 0 ? &face->a : corner == 1 ? &face->b : &face->c;
+}
+
+static vec3_t face_cross(vec3_t a, vec3_t b, vec3_t c) {
+	return vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+}
+
+static int compare_edges(const void* a, const void* b) {
+	const long long* ea = a;
+	const long long* eb = b;
+	return (*ea > *eb) - (*ea < *eb);
+}
+
+static int compare_collapses(const void* a, const void* b) {
+	const collapse_t* ca = a;
+	const collapse_t* cb = b;
+	return (ca->cost > cb->cost) - (ca->cost < cb->cost);
+}
+
+// Lock the vertices on edges that don't have exactly two faces, so borders
+// are kept. Vertices are split where the texture coordinates change, which
+// makes every UV seam a border as well.
+static void lock_borders(simplifier_t* s) {
+	long long* edges = malloc(sizeof(long long) * s->num_faces * 3);
+	int num_edges = 0;
+
+	for (int f = 0; f < s->num_faces; f++) {
+		face_t* face = &s->faces[f];
+		for (int corner = 0; corner < 3; corner++) {
+			int v = *corner_index(face, corner);
+			int w = *corner_index(face, (corner + 1) % 3);
+			long long lo = v < w ? v : w;
+			long long hi = v < w ? w : v;
+			edges[num_edges++] = (lo << 32) | hi;
+		}
+	}
+
+	qsort(edges, num_edges, sizeof(long long), compare_edges);
+	for (int i = 0; i < num_edges;) {
+		int j = i;
+		while (j < num_edges && edges[j] == edges[i]) {
+			j++;
+		}
+		if (j - i != 2) {
+			s->locked[edges[i] >> 32] = true;
+			s->locked[edges[i] & 0xFFFFFFFF] = true;
+		}
+		i = j;
+	}
+
+	free(edges);
+}
+
+static void build_vertex_faces(simplifier_t* s, int num_vertices) {
+	memset(s->face_offsets, 0, sizeof(int) * (num_vertices + 1));
+	for (int f = 0; f < s->num_faces; f++) {
+		if (!s->face_alive[f]) continue;
+		s->face_offsets[s->faces[f].a + 1]++;
+		s->face_offsets[s->faces[f].b + 1]++;
+		s->face_offsets[s->faces[f].c + 1]++;
+	}
+	for (int v = 0; v < num_vertices; v++) {
+		s->face_offsets[v + 1] += s->face_offsets[v];
+	}
+
+	int* fill = malloc(sizeof(int) * num_vertices);
+	memcpy(fill, s->face_offsets, sizeof(int) * num_vertices);
+	for (int f = 0; f < s->num_faces; f++) {
+		if (!s->face_alive[f]) continue;
+		s->vertex_faces[fill[s->faces[f].a]++] = f;
+		s->vertex_faces[fill[s->faces[f].b]++] = f;
+		s->vertex_faces[fill[s->faces[f].c]++] = f;
+	}
+	free(fill);
+}
+
+// Collect the vertices connected to v, returns -1 if there are too many
+static int vertex_neighbors(simplifier_t* s, int v, int neighbors[]) {
+	int count = 0;
+	for (int i = s->face_offsets[v]; i < s->face_offsets[v + 1]; i++) {
+		face_t* face = &s->faces[s->vertex_faces[i]];
+		if (!s->face_alive[s->vertex_faces[i]]) continue;
+		int corners[3] = { face->a, face->b, face->c };
+		for (int c = 0; c < 3; c++) {
+			int w = corners[c];
+			bool found = (w == v);
+			for (int n = 0; n < count && !found; n++) {
+				found = (neighbors[n] == w);
+			}
+			if (!found) {
+				if (count == MAX_VERTEX_NEIGHBORS) return -1;
+				neighbors[count++] = w;
+			}
+		}
+	}
+	return count;
+}
+
+static bool can_collapse(simplifier_t* s, int from, int to) {
+	// The faces sharing the edge disappear, the link condition keeps the surface manifold
+	int shared_faces = 0;
+	for (int i = s->face_offsets[from]; i < s->face_offsets[from + 1]; i++) {
+		int f = s->vertex_faces[i];
+		if (s->face_alive[f] && face_corner(&s->faces[f], to) >= 0) {
+			shared_faces++;
+		}
+	}
+	if (shared_faces == 0) {
+		return false;
+	}
+
+	int from_neighbors[MAX_VERTEX_NEIGHBORS];
+	int to_neighbors[MAX_VERTEX_NEIGHBORS];
+	int num_from = vertex_neighbors(s, from, from_neighbors);
+	int num_to = vertex_neighbors(s, to, to_neighbors);
+	if (num_from < 0 || num_to < 0) {
+		return false;
+	}
+	int common = 0;
+	for (int i = 0; i < num_from; i++) {
+		for (int j = 0; j < num_to; j++) {
+			if (from_neighbors[i] == to_neighbors[j]) common++;
+		}
+	}
+	if (common != shared_faces) {
+		return false;
+	}
+
+	// Moving the vertex must not flip or squash any of the remaining faces
+	for (int i = s->face_offsets[from]; i < s->face_offsets[from + 1]; i++) {
+		int f = s->vertex_faces[i];
+		face_t* face = &s->faces[f];
+		if (!s->face_alive[f] || face_corner(face, to) >= 0) continue;
+
+		vec3_t p[3] = { s->vertices[face->a], s->vertices[face->b], s->vertices[face->c] };
+		vec3_t before = face_cross(p[0], p[1], p[2]);
+		p[face_corner(face, from)] = s->vertices[to];
+		vec3_t after = face_cross(p[0], p[1], p[2]);
+		if (vec3_dot(before, after) <= 0.2 * vec3_length(before) * vec3_length(after)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The target keeps its texture coordinate, which is right for the faces of
+// the source because the source isn't on a seam
+static void collapse_edge(simplifier_t* s, int from, int to) {
+	for (int i = s->face_offsets[from]; i < s->face_offsets[from + 1]; i++) {
+		int f = s->vertex_faces[i];
+		face_t* face = &s->faces[f];
+		if (!s->face_alive[f]) continue;
+
+		if (face_corner(face, to) >= 0) {
+			s->face_alive[f] = false;
+			s->num_alive--;
+		}
+		else {
+			*corner_index(face, face_corner(face, from)) = to;
+		}
+	}
+
+	for (int k = 0; k < 10; k++) {
+		s->quadrics[to].q[k] += s->quadrics[from].q[k];
+	}
+}
+
+static face_t* simplify_faces(vec3_t* vertices, int num_vertices, face_t* source, int target_faces) {
+	simplifier_t s;
+	s.vertices = vertices;
+	s.num_faces = array_length(source);
+	s.num_alive = s.num_faces;
+	s.faces = malloc(sizeof(face_t) * s.num_faces);
+	memcpy(s.faces, source, sizeof(face_t) * s.num_faces);
+	s.face_alive = malloc(sizeof(bool) * s.num_faces);
+	memset(s.face_alive, true, sizeof(bool) * s.num_faces);
+	s.quadrics = calloc(num_vertices, sizeof(quadric_t));
+	s.locked = calloc(num_vertices, sizeof(bool));
+	s.face_offsets = malloc(sizeof(int) * (num_vertices + 1));
+	s.vertex_faces = malloc(sizeof(int) * s.num_faces * 3);
+
+	// Every vertex starts with the planes of the faces around it, weighted by area
+	for (int f = 0; f < s.num_faces; f++) {
+		face_t* face = &s.faces[f];
+		vec3_t normal = face_cross(vertices[face->a], vertices[face->b], vertices[face->c]);
+		float length = vec3_length(normal);
+		if (length == 0) continue;
+		normal = vec3_div(normal, length);
+		double d = -vec3_dot(normal, vertices[face->a]);
+		for (int corner = 0; corner < 3; corner++) {
+			quadric_add_plane(&s.quadrics[*corner_index(face, corner)], normal.x, normal.y, normal.z, d, length * 0.5);
+		}
+	}
+
+	lock_borders(&s);
+
+	collapse_t* collapses = malloc(sizeof(collapse_t) * s.num_faces * 6);
+	bool* touched = malloc(sizeof(bool) * num_vertices);
+	int neighbors[MAX_VERTEX_NEIGHBORS];
+
+	// Every pass collapses the cheapest edges that don't share vertices
+	while (s.num_alive > target_faces) {
+		build_vertex_faces(&s, num_vertices);
+
+		int num_collapses = 0;
+		for (int f = 0; f < s.num_faces; f++) {
+			if (!s.face_alive[f]) continue;
+			int corners[3] = { s.faces[f].a, s.faces[f].b, s.faces[f].c };
+			for (int c = 0; c < 3; c++) {
+				int u = corners[c];
+				int v = corners[(c + 1) % 3];
+				quadric_t q;
+				for (int k = 0; k < 10; k++) {
+					q.q[k] = s.quadrics[u].q[k] + s.quadrics[v].q[k];
+				}
+				if (!s.locked[u]) {
+					collapse_t collapse = { u, v, quadric_error(&q, vertices[v]) };
+					collapses[num_collapses++] = collapse;
+				}
+				if (!s.locked[v]) {
+					collapse_t collapse = { v, u, quadric_error(&q, vertices[u]) };
+					collapses[num_collapses++] = collapse;
+				}
+			}
+		}
+		qsort(collapses, num_collapses, sizeof(collapse_t), compare_collapses);
+
+		memset(touched, false, sizeof(bool) * num_vertices);
+		int num_collapsed = 0;
+		for (int i = 0; i < num_collapses && s.num_alive > target_faces; i++) {
+			int from = collapses[i].from;
+			int to = collapses[i].to;
+			if (touched[from] || touched[to] || !can_collapse(&s, from, to)) {
+				continue;
+			}
+
+			int num_neighbors = vertex_neighbors(&s, from, neighbors);
+			for (int n = 0; n < num_neighbors; n++) {
+				touched[neighbors[n]] = true;
+			}
+			touched[from] = true;
+
+			collapse_edge(&s, from, to);
+			num_collapsed++;
+		}
+
+		if (num_collapsed == 0) {
+			break;
+		}
+	}
+
+	face_t* result = NULL;
+	for (int f = 0; f < s.num_faces; f++) {
+		if (s.face_alive[f]) {
+			array_push(result, s.faces[f]);
+		}
+	}
+
+	free(touched);
+	free(collapses);
+	free(s.vertex_faces);
+	free(s.face_offsets);
+	free(s.locked);
+	free(s.quadrics);
+	free(s.face_alive);
+	free(s.faces);
+	return result;
+}
+
+void generate_mesh_lods(mesh_t* mesh) {
+	int num_vertices = array_length(mesh->vertices);
+	int num_faces = array_length(mesh->faces);
+
+	mesh->lods[0] = mesh->faces;
+	mesh->num_lods = 1;
+
+	// Each level aims for half the triangles of the previous one
+	for (int level = 1; level < MAX_NUM_LODS; level++) {
+		face_t* previous = mesh->lods[level - 1];
+		face_t* simplified = simplify_faces(mesh->vertices, num_vertices, previous, num_faces >> level);
+
+		// Stop when the seams and borders don't leave anything else to remove
+		if (array_length(simplified) == 0 || array_length(simplified) > array_length(previous) * 9 / 10) {
+			array_free(simplified);
+			break;
+		}
+		mesh->lods[level] = simplified;
+		mesh->num_lods++;
+	}
+}
+
+int select_lod_level(int current_level, int num_levels, float screen_radius) {
+	int level = current_level < num_levels ? current_level : num_levels - 1;
+
+	// Level n is meant for radii between LOD_BASE_SCREEN_RADIUS / 2^n and twice that,
+	// but only switch once the radius gets clearly past the threshold
+	while (level < num_levels - 1 &&
+		screen_radius < (LOD_BASE_SCREEN_RADIUS / (1 << level)) * (1.0 - LOD_HYSTERESIS)) {
+		level++;
+	}
+	while (level > 0 &&
+		screen_radius > (LOD_BASE_SCREEN_RADIUS / (1 << (level - 1))) * (1.0 + LOD_HYSTERESIS)) {
+		level--;
+	}
+	return level;
+}
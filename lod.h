@@ -0,0 +1,15 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "mesh.h"
+
+// Screen radius in pixels below which the first simplified level is used,
+// every following level kicks in at half the radius of the previous one
+#define LOD_BASE_SCREEN_RADIUS 120.0
+// Fraction the screen radius has to move past a threshold before switching
+#define LOD_HYSTERESIS 0.15
+
+void generate_mesh_lods(mesh_t* mesh);
+int select_lod_level(int current_level, int num_levels, float screen_radius);
+
+#endif // !LOD_H
@@ -1,36 +1,97 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 #include "upng.h"
+#include "arena.h"
 #include "array.h"
+#include "benchmark.h"
 #include "camera.h"
 #include "clipping.h"
 #include "display.h"
+#include "impostor.h"
+#include "instance.h"
 #include "light.h"
+#include "load_pool.h"
+#include "load_profile.h"
+#include "lod.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "mesh_optimize.h"
+#include "mesh_quantize.h"
+#include "mesh_stream.h"
+#include "occlusion.h"
+#include "pvs.h"
+#include "refinement.h"
+#include "render_queue.h"
+#include "scene_bvh.h"
 #include "vector.h"
 #include "texture.h"
 #include "triangle.h"
 
 
-#define MAX_TRIANGLES_PER_MESH 10000
+// Memory for the data that only lives during one frame, like the triangles to render
+#define FRAME_ARENA_INITIAL_SIZE (1024 * 1024)
+// Pixels around the triangles of an instance that its vertex markers and wireframe can reach
+#define DAMAGE_MARGIN 8
+// Frames of camera motion ahead of which the chunks of streamed meshes are read
+#define STREAM_PREFETCH_FRAMES 30
 
-triangle_t triangles_to_render[MAX_TRIANGLES_PER_MESH];
-int num_triangles_to_render = 0;
+arena_t frame_arena;
+scene_bvh_t scene_bvh;
+occlusion_buffer_t occlusion_buffer;
+pvs_t pvs;
+bool pvs_checked = false;	// the sets are only checked against the scene once its meshes are loaded
+char* streamed_mesh_filename = NULL;	// chunked mesh added to the scene, if any
+char* load_report_filename = NULL;	// JSON copy of the startup report, if any
+
+render_queue_t render_queue;
+
+// Part of the screen that changed since the last render, the rest is left as it is
+screen_rect_t damage_rect;
+int frame_number = 0;
 
 float fov_factor = 640;
 
+vec3_t previous_camera_position;
+vec3_t camera_motion;		// since the last frame
+
 mat4_t view_matrix;
 mat4_t proj_matrix;
+mat4_t unjittered_proj_matrix;
+float znear = 0.1;
+float zfar = 100.0;
 
 
 bool is_running = false;
 float delta_time = 0;
 int previous_frame_time = 0;
 
+void load_scene(void) {
+	// The meshes load in the background, the first frames draw what is there
+	mesh_handle_t f22_mesh = load_mesh_async("./assets/f22.obj", "./assets/f22.png");
+	mesh_handle_t efa_mesh = load_mesh_async("./assets/efa.obj", "./assets/efa.png");
+
+	create_instance(f22_mesh, vec3_new(1, 1, 1), vec3_new(0, 0, 0), vec3_new(-3, 0, 5));
+	create_instance(efa_mesh, vec3_new(1, 1, 1), vec3_new(0, 0, 0), vec3_new(+3, 0, 5));
+
+	// Too big to load, its chunks are read as they come into view
+	if (streamed_mesh_filename != NULL) {
+		mesh_handle_t streamed_mesh = load_streamed_mesh(streamed_mesh_filename);
+		create_instance(streamed_mesh, vec3_new(1, 1, 1), vec3_new(0, 0, 0), vec3_new(0, 0, 0));
+	}
+
+	// The hierarchy over the instances is built on the first update
+	scene_bvh_init(&scene_bvh);
+}
+
 void setup(void) {
+	arena_init(&frame_arena, FRAME_ARENA_INITIAL_SIZE);
+	init_impostors();
+
 	set_render_method(RENDER_FILL_TRIANGLE);
 	set_cull_method(CULL_NONE);
 
@@ -45,16 +106,18 @@ void setup(void) {
 	float fovy = M_PI / 3.0; // 60 in radians
 	float fovx = 2.0 * atan(tan(fovy / 2) * aspectx);
 
-	
-	float znear = 0.1;
-	float zfar = 100.0;
-	proj_matrix = mat4_make_perspective(fovy, aspecty, znear, zfar);
+	unjittered_proj_matrix = mat4_make_perspective(fovy, aspecty, znear, zfar);
+	proj_matrix = unjittered_proj_matrix;
 
 	// Initialize frustum planes with a point and a normal
 	init_frustum_planes(fovx, fovy, znear, zfar);
 
-	load_mesh("./assets/f22.obj", "./assets/f22.png", vec3_new(1, 1, 1), vec3_new(0, 0, 0), vec3_new(-3, 0, 5));
-	load_mesh("./assets/efa.obj", "./assets/efa.png", vec3_new(1, 1, 1), vec3_new(0, 0, 0), vec3_new(+3, 0, 5));
+	// Nothing has been drawn yet
+	damage_rect = screen_rect_new(0, 0, window_width, window_height);
+	init_refinement(window_width, window_height);
+	previous_camera_position = get_camera_position();
+
+	load_scene();
 }
 
 void handle_input(void) {
@@ -70,74 +133,94 @@ void handle_input(void) {
 				is_running = false;
 				break;
 			}
+			if (event.key.keysym.sym == SDLK_p)
+			{
+				set_progressive_rendering(!is_progressive_rendering());
+				damage_rect = screen_rect_new(0, 0, get_window_width(), get_window_height());
+				break;
+			}
 			if (event.key.keysym.sym == SDLK_1)
 			{
 				set_render_method(RENDER_WIRE_VERTEX);
+				refresh_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_2)
 			{
 				set_render_method(RENDER_WIRE);
+				refresh_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_3)
 			{
 				set_render_method(RENDER_FILL_TRIANGLE);
+				refresh_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_4)
 			{
 				set_render_method(RENDER_FILL_TRIANGLE_WIRE);
+				refresh_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_5)
 			{
 				set_render_method(RENDER_TEXTURED);
+				refresh_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_6)
 			{
 				set_render_method(RENDER_TEXTURED_WIRED);
+				refresh_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_c)
 			{
 				set_cull_method(CULL_BACKFACE);
+				refresh_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_d)
 			{
 				set_cull_method(CULL_NONE);
+				refresh_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_UP)
 			{
 				set_camera_forward_velocity(vec3_mul(get_camera_direction(), 5.0 * delta_time));
 				update_camera_position();
+				restart_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_DOWN)
 			{
 				set_camera_forward_velocity(vec3_mul(get_camera_direction(), -5.0 * delta_time));
 				update_camera_position();
+				restart_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_LEFT)
 			{
 				add_camera_yaw(-1.0 * delta_time);
+				restart_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_RIGHT)
 			{
 				add_camera_yaw(1.0 * delta_time);
+				restart_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_w) {
 				add_camera_pitch(3.0 * delta_time);
+				restart_refinement();
 				break;
 			}
 			if (event.key.keysym.sym == SDLK_s) {
 				add_camera_pitch(-3.0 * delta_time);
+				restart_refinement();
 				break;
 			}
 			break;
@@ -147,56 +230,127 @@ void handle_input(void) {
 	}
 }
 
-void process_graphics_pipeline_stages(mesh_t* mesh) {
+void project_triangles(triangle_t triangles[], int num_triangles, int sources[], uint32_t colors[], int texture_index, int pass) {
+	// Loop all of the assembled triangles after clipping
+	for (int t = 0; t < num_triangles; t++) {
 
-	// Create the view matrix
-	vec3_t target = get_camera_target();
-	vec3_t up_direction = { 0, 1, 0 };
+		triangle_t triangle_after_clipping = triangles[t];
 
-	view_matrix = mat4_look_at(get_camera_position(), target, up_direction);
+		// Loop all three vertices to perform projection
+		vec4_t projected_points[3];
+		for (int j = 0; j < 3; j++) {
+			// Perform the perspective divide of the clipped vertex
+			projected_points[j] = triangle_after_clipping.points[j];
+			if (projected_points[j].w != 0.0) {
+				projected_points[j].x /= projected_points[j].w;
+				projected_points[j].y /= projected_points[j].w;
+				projected_points[j].z /= projected_points[j].w;
+			}
 
-	// Create a scale matrix that will be used to multiply the mesh vertices
-	mat4_t scale_matrix = mat4_make_scale(mesh->scale.x, mesh->scale.y, mesh->scale.z);
-	mat4_t translation_matrix = mat4_make_translation(
-		mesh->translation.x, mesh->translation.y, mesh->translation.z
-	);
-	mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh->rotation.x);
-	mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh->rotation.y);
-	mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh->rotation.z);
+			// Scale and translate the projected points to the middle of the screen
+			projected_points[j].x *= (get_window_width() / 2.0);
+			projected_points[j].y *= (get_window_height() / 2.0);
+
+			// Invert y axis to use screen coordinates
+			projected_points[j].y *= -1;
+
+			projected_points[j].x += (get_window_width() / 2.0);
+			projected_points[j].y += (get_window_height() / 2.0);
+		}
+
+		// Save the projected triangle in the queue of triangles to render
+		render_queue_push(
+			&render_queue,
+			projected_points,
+			triangle_after_clipping.texcoords,
+			colors[sources[t]],
+			texture_index,
+			pass
+		);
+	}
+}
+
+void flush_triangle_batch(triangle_batch_t* batch, uint32_t colors[], int texture_index, int pass) {
+	triangle_t triangles_after_clipping[CLIP_BATCH_SIZE * MAX_NUM_POLY_TRIANGLES];
+	int sources[CLIP_BATCH_SIZE * MAX_NUM_POLY_TRIANGLES];
+
+	int num_triangles_after_clipping = clip_triangle_batch(batch, triangles_after_clipping, sources);
+	project_triangles(triangles_after_clipping, num_triangles_after_clipping, sources, colors, texture_index, pass);
+
+	clear_triangle_batch(batch);
+}
+
+// Index of the texture of the mesh in the render queue, -1 for an untextured mesh
+int add_mesh_texture(mesh_t* mesh) {
+	texture_t* texture = get_texture_ptr(mesh->texture);
+	return texture != NULL ? render_queue_add_texture(&render_queue, texture) : -1;
+}
+
+bool draw_impostor(instance_t* instance, mesh_t* mesh, mat4_t world_view_matrix) {
+	bool textured = should_render_textured_triangles() && get_texture_ptr(mesh->texture) != NULL;
+
+	vec4_t quad_vertices[4];
+	tex2_t quad_texcoords[4];
+	texture_t* atlas = build_impostor_quad(instance, mesh, world_view_matrix, textured, quad_vertices, quad_texcoords);
+	if (atlas == NULL) {
+		return false;
+	}
+	int atlas_index = render_queue_add_texture(&render_queue, atlas);
+	if (atlas_index < 0) {
+		return false;
+	}
+
+	// The two triangles of the quad always sample the atlas, whatever the render method
+	triangle_batch_t batch;
+	uint32_t colors[CLIP_BATCH_SIZE] = { 0xFFFFFFFF, 0xFFFFFFFF };
+	int quad_triangles[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+	clear_triangle_batch(&batch);
+	for (int t = 0; t < 2; t++) {
+		vec4_t clip_vertices[3];
+		tex2_t texcoords[3];
+		for (int j = 0; j < 3; j++) {
+			clip_vertices[j] = mat4_mul_vec4(proj_matrix, quad_vertices[quad_triangles[t][j]]);
+			texcoords[j] = quad_texcoords[quad_triangles[t][j]];
+		}
+		add_triangle_to_batch(&batch, clip_vertices, texcoords);
+	}
+	flush_triangle_batch(&batch, colors, atlas_index, RENDER_PASS_TEXTURED);
+	return true;
+}
+
+// Transform, clip and project the faces of a mesh into the render queue, the
+// vertex matrix taking its stored vertices to world space
+void queue_mesh_faces(mesh_t* mesh, face_t* faces, mat4_t vertex_matrix, int frustum_class, int texture_index, int pass) {
+	// Triangles that may need clipping are gathered in batches
+	triangle_batch_t batch;
+	uint32_t batch_colors[CLIP_BATCH_SIZE];
+	clear_triangle_batch(&batch);
+
+	// Faces sharing recently transformed vertices reuse them, the mesh faces are ordered for it
+	vertex_cache_t vertex_cache;
+	vertex_cache_clear(&vertex_cache);
 
 	// Loop all triangle faces of our mesh
-	int num_faces = array_length(mesh->faces);
+	int num_faces = array_length(faces);
 	for (int i = 0; i < num_faces; i++) {
-		face_t mesh_face = mesh->faces[i];
-
-		vec3_t face_vertices[3];
-		face_vertices[0] = mesh->vertices[mesh_face.a];
-		face_vertices[1] = mesh->vertices[mesh_face.b];
-		face_vertices[2] = mesh->vertices[mesh_face.c];
+		face_t mesh_face = faces[i];
+		int face_indices[3] = { mesh_face.a, mesh_face.b, mesh_face.c };
 
 		vec4_t transformed_vertices[3];
 
 		// Loop all three vertices of this current face and apply transformations
 		for (int j = 0; j < 3; j++) {
-			vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
-
-			mat4_t world_matrix = mat4_identity();
-			// Use a matrix to scale
-			world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-			// Use matrix to rotate
-			mat4_t rotation_matrix = mat4_identity();
-			rotation_matrix = mat4_mul_mat4(rotation_matrix_z, rotation_matrix);
-			rotation_matrix = mat4_mul_mat4(rotation_matrix_y, rotation_matrix);
-			rotation_matrix = mat4_mul_mat4(rotation_matrix_x, rotation_matrix);
-			world_matrix = mat4_mul_mat4(rotation_matrix, world_matrix);
-			// Use matrix to translate
-			world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
-
-			transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-			transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
+			int slot;
+			if (!vertex_cache_access(&vertex_cache, face_indices[j], &slot)) {
+				vec4_t transformed_vertex = get_mesh_stored_vertex(mesh, face_indices[j]);
+
+				transformed_vertex = mat4_mul_vec4(vertex_matrix, transformed_vertex);
+				transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
+				vertex_cache.vertices[slot] = transformed_vertex;
+			}
 
 			// Save transformed vertex in the array of transformed vertices
-			transformed_vertices[j] = transformed_vertex;
+			transformed_vertices[j] = vertex_cache.vertices[slot];
 		}
 
 		// Calculate the triangle face normal
@@ -217,72 +371,227 @@ void process_graphics_pipeline_stages(mesh_t* mesh) {
 			}
 		}
 
-		polygon_t polygon = create_polygon_from_triangle(
-			vec3_from_vec4(transformed_vertices[0]),
-			vec3_from_vec4(transformed_vertices[1]),
-			vec3_from_vec4(transformed_vertices[2]),
-			mesh_face.a_uv,
-			mesh_face.b_uv,
-			mesh_face.c_uv
-		);
-
-		clip_polygon(&polygon);
+		// Calculate color from flat shading
+		float lambert_factor = -vec3_dot(face_normal, get_light_direction());
+		uint32_t triangle_color = light_apply_intensity(MESH_COLOR, lambert_factor);
 
-		triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLES];
-		int num_triangles_after_clipping = 0;
+		// Move the vertices to homogeneous clip space, where the clipping happens
+		vec4_t clip_vertices[3];
+		for (int j = 0; j < 3; j++) {
+			clip_vertices[j] = mat4_mul_vec4(proj_matrix, transformed_vertices[j]);
+		}
+		tex2_t texcoords[3] = { get_mesh_uv(mesh, mesh_face.a), get_mesh_uv(mesh, mesh_face.b), get_mesh_uv(mesh, mesh_face.c) };
 
-		triangles_from_polygon(
-			&polygon, triangles_after_clipping, &num_triangles_after_clipping
-		);
+		// Meshes fully inside the frustum can't have a triangle crossing any plane
+		if (frustum_class == FRUSTUM_INSIDE) {
+			triangle_t triangle = {
+				.points = { clip_vertices[0], clip_vertices[1], clip_vertices[2] },
+				.texcoords = { texcoords[0], texcoords[1], texcoords[2] }
+			};
+			int source = 0;
+			project_triangles(&triangle, 1, &source, &triangle_color, texture_index, pass);
+			continue;
+		}
 
-		// Loop all of the assembled triangles after clipping
-		for (int t = 0; t < num_triangles_after_clipping; t++) {
+		// Collect the triangles to clip a whole batch at once
+		batch_colors[batch.num_triangles] = triangle_color;
+		add_triangle_to_batch(&batch, clip_vertices, texcoords);
+		if (batch.num_triangles == CLIP_BATCH_SIZE) {
+			flush_triangle_batch(&batch, batch_colors, texture_index, pass);
+		}
+	}	// end of for loop all triangle faces of our mesh
 
-			triangle_t triangle_after_clipping = triangles_after_clipping[t];
+	// Clip what is left in the last batch
+	flush_triangle_batch(&batch, batch_colors, texture_index, pass);
+}
 
-			// Loop all three vertices to perform projection
-			vec4_t projected_points[3];
-			for (int j = 0; j < 3; j++) {
-				// Project the current vertex
-				projected_points[j] = mat4_mul_vec4_project(proj_matrix, triangle_after_clipping.points[j]);
+// Streamed meshes draw the chunks in memory and boxes in place of the others,
+// asking for the visible chunks nearest first and then for the ones ahead of
+// the camera motion. False while some visible chunk is drawn as its box.
+bool queue_streamed_triangles(mesh_t* mesh, mat4_t world_matrix, mat4_t world_view_matrix) {
+	int texture_index = add_mesh_texture(mesh);
+	int pass = render_queue_choose_pass(&render_queue, texture_index);
+
+	// Where the camera will be if it keeps moving the same way, in view space
+	vec3_t ahead = vec3_add(get_camera_position(), vec3_mul(camera_motion, STREAM_PREFETCH_FRAMES));
+	vec3_t ahead_offset = vec3_from_vec4(mat4_mul_vec4(view_matrix, vec4_from_vec3(ahead)));
+	bool prefetch = vec3_length(camera_motion) > 0;
+
+	bool complete = true;
+	mesh_stream_t* stream = mesh->stream;
+	for (int c = 0; c < stream->num_chunks; c++) {
+		mesh_chunk_t* chunk = &stream->chunks[c];
+		vec3_t corners[8];
+		for (int i = 0; i < 8; i++) {
+			vec3_t corner = {
+				(i & 1) ? chunk->bounds_max.x : chunk->bounds_min.x,
+				(i & 2) ? chunk->bounds_max.y : chunk->bounds_min.y,
+				(i & 4) ? chunk->bounds_max.z : chunk->bounds_min.z
+			};
+			corners[i] = vec3_from_vec4(mat4_mul_vec4(world_view_matrix, vec4_from_vec3(corner)));
+		}
+		vec3_t center = vec3_mul(vec3_add(corners[0], corners[7]), 0.5);
+		int frustum_class = classify_box_against_frustum(corners);
+
+		// Chunks coming into view are asked for after all the visible ones, past the far plane
+		if (frustum_class == FRUSTUM_OUTSIDE) {
+			if (prefetch) {
+				for (int i = 0; i < 8; i++) {
+					corners[i] = vec3_sub(corners[i], ahead_offset);
+				}
+				if (classify_box_against_frustum(corners) != FRUSTUM_OUTSIDE) {
+					request_mesh_chunk(stream, c, zfar + vec3_length(vec3_sub(center, ahead_offset)));
+				}
+			}
+			continue;
+		}
 
-				// Scale and translate the projected points to the middle of the screen
-				projected_points[j].x *= (get_window_width() / 2.0);
-				projected_points[j].y *= (get_window_height() / 2.0);
+		if (request_mesh_chunk(stream, c, vec3_length(center))) {
+			queue_mesh_faces(&chunk->mesh, chunk->mesh.faces, world_matrix, frustum_class, texture_index, pass);
+		}
+		else {
+			queue_mesh_faces(&chunk->placeholder, chunk->placeholder.faces, world_matrix, frustum_class, texture_index, pass);
+			complete = false;
+		}
+	}
+	return complete;
+}
 
-				// Invert y axis to use screen coordinates
-				projected_points[j].y *= -1;
+// Transform, clip and project the triangles of an instance into the render
+// queue, false when what was queued can't be reused in later frames
+bool queue_instance_triangles(instance_t* instance) {
+	mesh_t* mesh = get_mesh_ptr(instance->mesh_handle);
+	if (mesh == NULL || mesh->load_state == MESH_LOADING) {
+		return true;
+	}
 
-				projected_points[j].x += (get_window_width() / 2.0);
-				projected_points[j].y += (get_window_height() / 2.0);
-			}
+	// Create the world matrix of the instance once for all the vertices of the mesh
+	mat4_t world_matrix = get_instance_world_matrix(instance);
 
-			// Calculate color from flat shading
-			float lambert_factor = -vec3_dot(face_normal, get_light_direction());
-			uint32_t triangle_color = light_apply_intensity(mesh_face.color, lambert_factor);
-
-			triangle_t triangle_to_render = {
-				.points = {
-					{ projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
-					{ projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w },
-					{ projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w }
-				},
-				.texcoords = {
-					{ triangles_after_clipping->texcoords[0].u, triangles_after_clipping->texcoords[0].v },
-					{ triangles_after_clipping->texcoords[1].u, triangles_after_clipping->texcoords[1].v },
-					{ triangles_after_clipping->texcoords[2].u, triangles_after_clipping->texcoords[2].v },
-				},
-				.color = triangle_color,
-				.texture = mesh->texture
+	// Test the bounding sphere of the mesh against the frustum in view space
+	mat4_t world_view_matrix = mat4_mul_mat4(view_matrix, world_matrix);
+	vec3_t sphere_center = vec3_from_vec4(
+		mat4_mul_vec4(world_view_matrix, vec4_from_vec3(mesh->bounds_center))
+	);
+	float max_scale = fmaxf(fabsf(instance->scale.x), fmaxf(fabsf(instance->scale.y), fabsf(instance->scale.z)));
+	int frustum_class = classify_sphere_against_frustum(sphere_center, mesh->bounds_radius * max_scale);
+
+	// The sphere is loose for long meshes, so refine with the corners of the bounding box
+	if (frustum_class == FRUSTUM_INTERSECT) {
+		vec3_t corners[8];
+		for (int i = 0; i < 8; i++) {
+			vec3_t corner = {
+				(i & 1) ? mesh->bounds_max.x : mesh->bounds_min.x,
+				(i & 2) ? mesh->bounds_max.y : mesh->bounds_min.y,
+				(i & 4) ? mesh->bounds_max.z : mesh->bounds_min.z
 			};
+			corners[i] = vec3_from_vec4(mat4_mul_vec4(world_view_matrix, vec4_from_vec3(corner)));
+		}
+		frustum_class = classify_box_against_frustum(corners);
+	}
 
-			if (num_triangles_to_render < MAX_TRIANGLES_PER_MESH) {
-				// Save the projected triangle in the array of triangles to render
-				triangles_to_render[num_triangles_to_render] = triangle_to_render;
-				num_triangles_to_render++;
-			}
+	// Bypass the meshes that are completely outside the view
+	if (frustum_class == FRUSTUM_OUTSIDE) {
+		return true;
+	}
+	if (mesh->stream != NULL) {
+		return queue_streamed_triangles(mesh, world_matrix, world_view_matrix);
+	}
+
+	// Pick the level of detail from the radius of the bounding sphere on screen
+	float sphere_radius = mesh->bounds_radius * max_scale;
+	float sphere_distance = vec3_length(sphere_center);
+	float screen_radius = (sphere_distance > sphere_radius)
+		? sphere_radius * proj_matrix.m[1][1] * (get_window_height() / 2.0) / sphere_distance
+		: (float)get_window_height();
+	instance->lod_level = select_lod_level(instance->lod_level, mesh->num_lods, screen_radius);
+
+	// Previews draw a coarser level than the size on screen asks for
+	int level = instance->lod_level + get_refinement_lod_bias();
+	if (level > mesh->num_lods - 1) {
+		level = mesh->num_lods - 1;
+	}
+	face_t* faces = mesh->lods[level];
+
+	// Far instances with filled triangles are drawn as a quad with a prerendered image
+	bool uniform_scale = instance->scale.x == instance->scale.y && instance->scale.y == instance->scale.z;
+	if (screen_radius < IMPOSTOR_SCREEN_RADIUS && uniform_scale &&
+		(should_render_filled_triangles() || should_render_textured_triangles())) {
+		// The atlas cell has to be looked up every frame to stay in the atlas
+		if (draw_impostor(instance, mesh, world_view_matrix)) {
+			return false;
 		}
-	}	// end of for loop all triangle faces of our mesh
+	}
+
+	// All the triangles of the mesh share its texture and the way they are rasterized
+	int texture_index = add_mesh_texture(mesh);
+	int pass = render_queue_choose_pass(&render_queue, texture_index);
+
+	// Quantized vertices are turned back into mesh space by the world transform itself
+	mat4_t vertex_matrix = world_matrix;
+	if (is_mesh_quantized(mesh)) {
+		vertex_matrix = mat4_mul_mat4(world_matrix, get_mesh_dequantize_matrix(mesh));
+	}
+	queue_mesh_faces(mesh, faces, vertex_matrix, frustum_class, texture_index, pass);
+	return true;
+}
+
+void process_graphics_pipeline_stages(instance_t* instance) {
+	geometry_cache_t* cache = &instance->geometry_cache;
+	geometry_cache_key_t key = {
+		.view_matrix = view_matrix,
+		.proj_matrix = proj_matrix,
+		.transform_version = instance->transform_version,
+		.render_method = get_render_method(),
+		.cull_backface = is_cull_backface(),
+		.lod_bias = get_refinement_lod_bias()
+	};
+
+	// An unloaded mesh draws nothing, where it was is redrawn as for any
+	// instance left out of the frame
+	if (get_mesh_ptr(instance->mesh_handle) == NULL) {
+		geometry_cache_invalidate(cache);
+		return;
+	}
+
+	// With the same camera and transform, the triangles from the last time are
+	// still good and cover the same pixels as before
+	instance->drawn_frame = frame_number;
+	if (geometry_cache_matches(cache, &key) && geometry_cache_replay(cache, &render_queue)) {
+		return;
+	}
+
+	int first_triangle = render_queue.num_triangles;
+	if (queue_instance_triangles(instance)) {
+		mesh_t* mesh = get_mesh_ptr(instance->mesh_handle);
+		geometry_cache_store(cache, &key, &render_queue, first_triangle, mesh->texture);
+	}
+	else {
+		geometry_cache_invalidate(cache);
+	}
+
+	// Both where the instance was and where it is now have to be drawn again
+	screen_rect_t bounds = render_queue_bounds(&render_queue, first_triangle, DAMAGE_MARGIN);
+	damage_rect = screen_rect_union(damage_rect, screen_rect_union(instance->screen_bounds, bounds));
+	instance->screen_bounds = bounds;
+}
+
+// Cull the scene for the current camera and queue what is left
+void queue_visible_instances(void) {
+	// Only the instances with bounds in the frustum go through the pipeline
+	mat4_t view_projection_matrix = mat4_mul_mat4(proj_matrix, view_matrix);
+	int num_visible;
+	int* visible = scene_bvh_query_frustum(&scene_bvh, view_projection_matrix, &frame_arena, &num_visible);
+
+	// The biggest instances are drawn into a small depth buffer, and the ones hidden behind them are skipped
+	render_occluders(&occlusion_buffer, visible, num_visible, view_matrix, proj_matrix);
+	for (int i = 0; i < num_visible; i++) {
+		instance_t* instance = get_instance_ptr(visible[i]);
+		if (is_instance_occluded(&occlusion_buffer, instance, view_projection_matrix)) {
+			continue;
+		}
+		process_graphics_pipeline_stages(instance);
+	}
 }
 
 void update(void) {
@@ -296,116 +605,334 @@ void update(void) {
 	}
 
 	previous_frame_time = SDL_GetTicks();
+	frame_number++;
+	begin_refinement_frame();
+
+	// Samples of the progressive mode move the projection by a fraction of a pixel
+	vec2_t jitter = get_refinement_jitter();
+	mat4_t jitter_matrix = mat4_make_translation(jitter.x * 2 / get_window_width(), -jitter.y * 2 / get_window_height(), 0);
+	proj_matrix = mat4_mul_mat4(jitter_matrix, unjittered_proj_matrix);
 
-	// initialize counter of triangles to render
-	num_triangles_to_render = 0;
+	// Release the memory of the previous frame and start a new queue of triangles to render
+	arena_reset(&frame_arena);
+	render_queue_init(&render_queue, &frame_arena);
+	begin_impostor_frame();
+
+	// Create the view matrix once for all the instances
+	vec3_t target = get_camera_target();
+	vec3_t up_direction = { 0, 1, 0 };
+
+	view_matrix = mat4_look_at(get_camera_position(), target, up_direction);
+	camera_motion = vec3_sub(get_camera_position(), previous_camera_position);
+	previous_camera_position = get_camera_position();
+
+	// Move the instances with the setters, so the scene hierarchy refits them
+	// for (int instance_idx = 0; instance_idx < get_num_instances(); instance_idx++) {
+	// 	instance_t* instance = get_instance_ptr(instance_idx);
+	// 	set_instance_rotation(instance_idx, vec3_add(instance->rotation, vec3_new(0.005, 0.005, 0.01)));
+	// 	set_instance_scale(instance_idx, vec3_add(instance->scale, vec3_new(0.002, 0.001, 0)));
+	// 	set_instance_translation(instance_idx, vec3_add(instance->translation, vec3_new(0, 0.01, 0)));
+	// }
+	// Meshes the loader threads got further with replace what was drawn for them
+	for (int i = 0; i < get_num_meshes(); i++) {
+		mesh_handle_t mesh = get_mesh_handle(i);
+		if (publish_mesh_load(mesh)) {
+			mark_mesh_instances_dirty(mesh);
+			invalidate_mesh_impostors(mesh);
+		}
+	}
 
-	for (int mesh_idx = 0; mesh_idx < get_num_meshes(); mesh_idx++) {
-		mesh_t* mesh = get_mesh_ptr(mesh_idx);
+	// Chunks read since the last frame replace their boxes, then the ones asked for in it are read
+	if (update_mesh_streams() > 0) {
+		restart_refinement();
+	}
 
-		// mesh.rotation.x += 0.005;
-		// mesh.rotation.y += 0.005;
-		// mesh.rotation.z += 0.01;
+	// The sets hold for where the instances were when they were built, moving any of them makes them stale
+	int num_moved;
+	get_dirty_instances(&num_moved);
+	if (num_moved > 0) {
+		pvs_free(&pvs);
+		restart_refinement();
+	}
+	scene_bvh_update(&scene_bvh);
+
+	// Precomputed visibility, ignored unless it was built for this scene
+	if (!pvs_checked && are_meshes_loaded()) {
+		pvs_checked = true;
+		end_startup_profile(load_report_filename);
+		if (pvs_load(&pvs, PVS_FILENAME)) {
+			printf("Loaded potentially visible sets from %s\n", PVS_FILENAME);
+		}
+	}
 
-		// mesh.scale.x += 0.002;
-		// mesh.scale.y += 0.001;
+	// A converged progressive view is already on screen
+	if (is_progressive_rendering() && get_refinement_stage() == REFINEMENT_CONVERGED) {
+		return;
+	}
 
-		// mesh.translation.y += 0.01;
-		// Translate the vertices away from the camera
-		// mesh->translation.z = 5.0;
+	// Inside the grid of precomputed sets, the cell of the camera tells which instances to process
+	const uint32_t* potentially_visible = pvs_lookup(&pvs, get_camera_position());
+	if (potentially_visible != NULL) {
+		for (int i = 0; i < get_num_instances(); i++) {
+			if (potentially_visible[i >> 5] & (1u << (i & 31))) {
+				process_graphics_pipeline_stages(get_instance_ptr(i));
+			}
+		}
+	}
+	else {
+		queue_visible_instances();
+	}
 
-		// Process the graphics pipeline stages for every mesh of our 3D scene
-		process_graphics_pipeline_stages(mesh);
+	// The instances drawn last frame and culled in this one leave their pixels
+	// behind. Their cached triangles go too, a replay wouldn't track its bounds.
+	for (int i = 0; i < get_num_instances(); i++) {
+		instance_t* instance = get_instance_ptr(i);
+		if (instance->drawn_frame != frame_number) {
+			damage_rect = screen_rect_union(damage_rect, instance->screen_bounds);
+			instance->screen_bounds = screen_rect_empty();
+			geometry_cache_invalidate(&instance->geometry_cache);
+		}
 	}
 }
 
 
-void render(void) {
-	
+// Rasterize the queued triangles that touch the damaged part of the screen,
+// scaling their positions to the current render target
+void draw_render_queue(screen_rect_t damaged, float scale) {
 	clear_color_buffer(0xFF000000);
 	clear_z_buffer();
 	
 	draw_grid();
 
-	for (int i = 0; i < num_triangles_to_render; i++) {
-		triangle_t triangle = triangles_to_render[i];
-
-		if (should_render_filled_triangles()) {
-			// draw fill triangle
-			draw_filled_triangle(
-				triangle.points[0].x,
-				triangle.points[0].y,
-				triangle.points[0].z,
-				triangle.points[0].w,
-				triangle.points[1].x,
-				triangle.points[1].y,
-				triangle.points[1].z,
-				triangle.points[1].w,
-				triangle.points[2].x,
-				triangle.points[2].y,
-				triangle.points[2].z,
-				triangle.points[2].w,
-				triangle.color
-			);
+	// Sort the triangles so the ones with the same texture and pass are drawn together
+	render_queue_sort(&render_queue);
+
+	vec2_t* points = render_queue.points;
+	float* w = render_queue.w;
+	tex2_t* uv = render_queue.texcoords;
+
+	int run_start = 0;
+	while (run_start < render_queue.num_triangles) {
+		uint64_t run_key = render_queue.keys[render_queue.order[run_start]];
+		int run_end = run_start + 1;
+		while (run_end < render_queue.num_triangles &&
+			RENDER_KEY_STATE(render_queue.keys[render_queue.order[run_end]]) == RENDER_KEY_STATE(run_key)) {
+			run_end++;
 		}
 
-		if (should_render_textured_triangles()) {
-			draw_textured_triangle(
-				triangle.points[0].x,
-				triangle.points[0].y,
-				triangle.points[0].z,
-				triangle.points[0].w,
-				triangle.texcoords[0].u,
-				triangle.texcoords[0].v,
-				triangle.points[1].x,
-				triangle.points[1].y,
-				triangle.points[1].z,
-				triangle.points[1].w,
-				triangle.texcoords[1].u,
-				triangle.texcoords[1].v,
-				triangle.points[2].x,
-				triangle.points[2].y,
-				triangle.points[2].z,
-				triangle.points[2].w,
-				triangle.texcoords[2].u,
-				triangle.texcoords[2].v,
-				triangle.texture
-			);
+		if (RENDER_KEY_PASS(run_key) == RENDER_PASS_FILL) {
+			for (int r = run_start; r < run_end; r++) {
+				if (!render_queue_triangle_overlaps(&render_queue, render_queue.order[r], damaged)) {
+					continue;
+				}
+				int i = render_queue.order[r] * 3;
+				draw_filled_triangle(
+					points[i].x * scale, points[i].y * scale, w[i],
+					points[i + 1].x * scale, points[i + 1].y * scale, w[i + 1],
+					points[i + 2].x * scale, points[i + 2].y * scale, w[i + 2],
+					render_queue.colors[render_queue.order[r]]
+				);
+			}
+		}
+
+		if (RENDER_KEY_PASS(run_key) == RENDER_PASS_TEXTURED) {
+			texture_t* texture = render_queue.textures[RENDER_KEY_TEXTURE(run_key)];
+			for (int r = run_start; r < run_end; r++) {
+				if (!render_queue_triangle_overlaps(&render_queue, render_queue.order[r], damaged)) {
+					continue;
+				}
+				int i = render_queue.order[r] * 3;
+				draw_textured_triangle(
+					points[i].x * scale, points[i].y * scale, w[i], uv[i].u, uv[i].v,
+					points[i + 1].x * scale, points[i + 1].y * scale, w[i + 1], uv[i + 1].u, uv[i + 1].v,
+					points[i + 2].x * scale, points[i + 2].y * scale, w[i + 2], uv[i + 2].u, uv[i + 2].v,
+					texture
+				);
+			}
 		}
-		
-		if (should_render_wireframe()) {
-			// draw wireframe
+
+		run_start = run_end;
+	}
+
+	// The wireframe goes on top of everything else
+	if (should_render_wireframe()) {
+		for (int i = 0; i < render_queue.num_triangles * 3; i += 3) {
+			if (!render_queue_triangle_overlaps(&render_queue, i / 3, damaged)) {
+				continue;
+			}
 			draw_triangle(
-				triangle.points[0].x,
-				triangle.points[0].y,
-				triangle.points[1].x,
-				triangle.points[1].y,
-				triangle.points[2].x,
-				triangle.points[2].y,
+				points[i].x * scale, points[i].y * scale,
+				points[i + 1].x * scale, points[i + 1].y * scale,
+				points[i + 2].x * scale, points[i + 2].y * scale,
 				0xFFFFFFFF
 			);
 		}
-		
-		if (should_render_wire_vertex()) {
-			int size = 6;
-			draw_rect(triangle.points[0].x, triangle.points[0].y - size / 2, size, size, 0xFFFF0000);
-			draw_rect(triangle.points[1].x, triangle.points[1].y - size / 2, size, size, 0xFFFF0000);
-			draw_rect(triangle.points[2].x, triangle.points[2].y - size / 2, size, size, 0xFFFF0000);
+	}
+
+	if (should_render_wire_vertex()) {
+		int size = 6;
+		for (int i = 0; i < render_queue.num_triangles * 3; i++) {
+			draw_rect(points[i].x * scale, points[i].y * scale - size / 2, size, size, 0xFFFF0000);
+		}
+	}
+}
+
+void render(void) {
+	screen_rect_t window_rect = screen_rect_new(0, 0, get_window_width(), get_window_height());
+
+	// Only the damaged part of the screen is cleared and drawn again
+	screen_rect_t damaged = screen_rect_intersect(damage_rect, window_rect);
+	damage_rect = screen_rect_empty();
+
+	// The progressive mode draws the whole view until it has converged
+	if (is_progressive_rendering()) {
+		damaged = (get_refinement_stage() == REFINEMENT_CONVERGED) ? screen_rect_empty() : window_rect;
+	}
+	if (screen_rect_is_empty(damaged)) {
+		render_color_buffer(damaged);
+		return;
+	}
+
+	// Previews go to a smaller target, scaled up to the window once drawn
+	float scale = get_refinement_resolution_scale();
+	if (scale < 1) {
+		set_render_target(get_refinement_preview_target());
+		draw_render_queue(damaged, scale);
+		set_render_target(NULL);
+		upscale_refinement_preview();
+	}
+	else {
+		set_scissor_rect(&damaged);
+		draw_render_queue(damaged, 1);
+		if (is_progressive_rendering() && get_refinement_stage() >= REFINEMENT_FILTERED) {
+			accumulate_refinement_sample();
 		}
 	}
 
-	render_color_buffer();
+	render_color_buffer(damaged);
+	set_scissor_rect(NULL);
 }
 
 void free_resources(void) {
+	printf(
+		"Frame arena: peak %zu KB of %zu KB, %d block allocations\n",
+		frame_arena.peak_used / 1024,
+		arena_capacity(&frame_arena) / 1024,
+		frame_arena.num_block_allocations
+	);
+	arena_free(&frame_arena);
+	pvs_free(&pvs);
+	scene_bvh_free(&scene_bvh);
+	free_refinement();
+	free_impostors();
+	free_instances();
 	free_meshes();
+	free_textures();
+	free_load_pool();
 	destroy_window();
 }
 
 int main(int argc, char* argv[]) {
+	begin_startup_profile();
+
+	// Every flag is read before any mode runs, so their order doesn't matter
+	char* chunks_filename = NULL;
+	bool bench_clipping = false;
+	bool bench_picking = false;
+	bool build_pvs = false;
+	bool load_only = false;
+	for (int i = 1; i < argc; i++) {
+		// Compact vertices for scenes with many distinct meshes, before anything is loaded
+		if (strcmp(argv[i], "--quantize-meshes") == 0) {
+			set_mesh_quantization(true);
+		}
+		// Read and eviction statistics of the streamed meshes, printed as they are closed
+		if (strcmp(argv[i], "--mesh-stats") == 0) {
+			set_mesh_stats(true);
+		}
+		// A mesh split into chunks by --build-chunks, and the memory its chunks may take
+		if (strcmp(argv[i], "--stream-mesh") == 0 && i + 1 < argc) {
+			streamed_mesh_filename = argv[++i];
+		}
+		if (strcmp(argv[i], "--stream-budget") == 0 && i + 1 < argc) {
+			const char* text = argv[++i];
+			char* end;
+			unsigned long megabytes = strtoul(text, &end, 10);
+			if (text[0] < '0' || text[0] > '9' || *end != '\0' || megabytes == 0 || megabytes > SIZE_MAX / (1024 * 1024)) {
+				fprintf(stderr, "Invalid --stream-budget %s, expected a number of megabytes.\n", text);
+				return 1;
+			}
+			set_mesh_stream_budget((size_t)megabytes * 1024 * 1024);
+		}
+		if (strcmp(argv[i], "--build-chunks") == 0 && i + 1 < argc) {
+			chunks_filename = argv[++i];
+		}
+		// Where the startup report is written as JSON, for tracking load times across asset changes
+		if (strcmp(argv[i], "--load-report") == 0 && i + 1 < argc) {
+			load_report_filename = argv[++i];
+		}
+		if (strcmp(argv[i], "--load-only") == 0) {
+			load_only = true;
+		}
+		if (strcmp(argv[i], "--bench-clipping") == 0) {
+			bench_clipping = true;
+		}
+		if (strcmp(argv[i], "--bench-picking") == 0) {
+			bench_picking = true;
+		}
+		if (strcmp(argv[i], "--build-pvs") == 0) {
+			build_pvs = true;
+		}
+	}
+
+	// Offline steps and micro-benchmarks run headless and exit
+	if (chunks_filename != NULL) {
+		return build_streamed_mesh(chunks_filename) ? 0 : 1;
+	}
+	if (bench_clipping) {
+		run_clipping_benchmark();
+		return 0;
+	}
+	if (bench_picking) {
+		run_picking_benchmark();
+		return 0;
+	}
+	// Offline step for static scenes, writes the sets next to the assets
+	if (build_pvs) {
+		load_scene();
+		finish_mesh_loads();
+		scene_bvh_update(&scene_bvh);
+		pvs_build(&pvs, &scene_bvh, znear, zfar);
+		bool saved = pvs_save(&pvs, PVS_FILENAME);
+		printf(saved ? "Saved %s\n" : "Could not write %s\n", PVS_FILENAME);
+		pvs_free(&pvs);
+		scene_bvh_free(&scene_bvh);
+		free_instances();
+		free_meshes();
+		free_textures();
+		free_load_pool();
+		return saved ? 0 : 1;
+	}
+	// Loads the scene without a window, prints the startup report and exits
+	if (load_only) {
+		load_scene();
+		finish_mesh_loads();
+		bool reported = end_startup_profile(load_report_filename);
+		scene_bvh_free(&scene_bvh);
+		free_instances();
+		free_meshes();
+		free_textures();
+		free_load_pool();
+		return reported ? 0 : 1;
+	}
+
+	Uint64 start = SDL_GetPerformanceCounter();
 	is_running = initialize_window();
+	double window_seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
 
+	start = SDL_GetPerformanceCounter();
 	setup();
+	set_startup_seconds(window_seconds, (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency());
 
 	while (is_running) {
 		handle_input();
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool map_file(mapped_file_t* file, const char* filename) {
+	memset(file, 0, sizeof(mapped_file_t));
+	HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size)) {
+		CloseHandle(handle);
+		return false;
+	}
+	file->file = handle;
+	file->size = (size_t)size.QuadPart;
+	if (file->size == 0) {
+		return true;
+	}
+
+	file->mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (file->mapping != NULL) {
+		file->data = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (file->data == NULL) {
+		unmap_file(file);
+		return false;
+	}
+	return true;
+}
+
+void unmap_file(mapped_file_t* file) {
+	if (file->data != NULL) {
+		UnmapViewOfFile(file->data);
+	}
+	if (file->mapping != NULL) {
+		CloseHandle(file->mapping);
+	}
+	if (file->file != NULL) {
+		CloseHandle(file->file);
+	}
+	memset(file, 0, sizeof(mapped_file_t));
+}
+
+bool replace_file(const char* from, const char* to) {
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+#else
+
+bool map_file(mapped_file_t* file, const char* filename) {
+	memset(file, 0, sizeof(mapped_file_t));
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return false;
+	}
+	file->size = (size_t)info.st_size;
+	if (file->size == 0) {
+		close(fd);
+		return true;
+	}
+
+	// The mapping keeps the file open, the descriptor is not needed anymore
+	void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		file->size = 0;
+		return false;
+	}
+	madvise(data, file->size, MADV_SEQUENTIAL);
+	file->data = data;
+	return true;
+}
+
+void unmap_file(mapped_file_t* file) {
+	if (file->data != NULL) {
+		munmap((void*)file->data, file->size);
+	}
+	memset(file, 0, sizeof(mapped_file_t));
+}
+
+bool replace_file(const char* from, const char* to) {
+	return rename(from, to) == 0;
+}
+
+#endif
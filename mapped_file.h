@@ -0,0 +1,22 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Read only view of a whole file in memory, paged in by the OS as it is read
+typedef struct {
+	const char* data;		// not NUL terminated, NULL for an empty file
+	size_t size;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#endif
+} mapped_file_t;
+
+bool map_file(mapped_file_t* file, const char* filename);
+void unmap_file(mapped_file_t* file);
+// Moves a file over another one. Mappings of the one replaced keep seeing its old contents.
+bool replace_file(const char* from, const char* to);
+
+#endif // !MAPPED_FILE_H
@@ -1,110 +1,540 @@
+#include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <SDL.h>
 #include "array.h"
+#include "glb_parser.h"
+#include "impostor.h"
+#include "instance.h"
+#include "load_pool.h"
+#include "load_profile.h"
+#include "lod.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimize.h"
+#include "mesh_quantize.h"
+#include "mesh_stream.h"
+#include "obj_parser.h"
+#include "registry.h"
 
-#define MAX_NUM_MESHES 10
+#define MAX_CACHE_FILENAME_LENGTH 260
 
-static mesh_t meshes[MAX_NUM_MESHES];
-static int mesh_count = 0;
+// A mesh being loaded in the background, handed over to the main thread in stages
+typedef struct {
+  char filename[MAX_CACHE_FILENAME_LENGTH];
+  char png_filename[MAX_CACHE_FILENAME_LENGTH];  // empty for none
+  bool quantize;
+  mesh_t geometry;      // built by the loader thread
+  upng_t* png_image;    // decoded by the loader thread, the texture is made on the main thread
+  SDL_atomic_t state;   // last stage the loader thread finished
+  bool geometry_taken;  // by the mesh, once published
+  load_profile_t* profile;  // of the startup report, NULL once it is full
+} mesh_load_t;
 
-void load_mesh(char* obj_filename, char* png_filename, vec3_t scale, vec3_t rotation, vec3_t translation)
+typedef struct {
+  mesh_t mesh;
+  mesh_load_t* load;    // NULL unless still loading
+} mesh_entry_t;
+
+static registry_t meshes = REGISTRY_INITIALIZER(mesh_entry_t);
+static mesh_load_t** abandoned_loads = NULL;  // dynamic array of loads of unloaded meshes still running
+static bool quantize_meshes = false;
+static bool print_mesh_stats = false;
+
+// Meshes loaded from now on store 16 bit vertices, for scenes with many of them
+void set_mesh_quantization(bool enabled) {
+  quantize_meshes = enabled;
+}
+
+// Prints what streaming did for each streamed mesh as it is closed. The load
+// stats of every mesh are in the startup report.
+void set_mesh_stats(bool enabled) {
+  print_mesh_stats = enabled;
+}
+
+static bool has_extension(const char* filename, const char* extension) {
+  size_t length = strlen(filename);
+  size_t extension_length = strlen(extension);
+  return length >= extension_length && strcmp(filename + length - extension_length, extension) == 0;
+}
+
+static void free_mesh(mesh_t* mesh)
+{
+  destroy_texture(mesh->texture);
+  if (mesh->stream != NULL) {
+    if (print_mesh_stats) {
+      print_mesh_stream_stats(mesh->stream);
+    }
+    close_mesh_stream(mesh->stream);
+  }
+
+  // Arrays in a cache mapping go away with it
+  if (mesh->cache_file.data != NULL) {
+    unmap_file(&mesh->cache_file);
+    return;
+  }
+  mesh_bvh_free(&mesh->bvh);
+  for (int level = 1; level < mesh->num_lods; level++) {
+    array_free(mesh->lods[level]);
+  }
+  array_free(mesh->faces);
+  array_free(mesh->vertices);
+  array_free(mesh->uvs);
+  array_free(mesh->packed_vertices);
+  array_free(mesh->packed_uvs);
+}
+
+// Bytes of the arrays of a mesh built in memory, for the startup report
+static size_t get_mesh_bytes(const mesh_t* mesh)
+{
+  size_t bytes = (size_t)array_length(mesh->vertices) * sizeof(vec3_t) +
+    (size_t)array_length(mesh->uvs) * sizeof(tex2_t) +
+    (size_t)array_length(mesh->packed_vertices) * sizeof(packed_vec3_t) +
+    (size_t)array_length(mesh->packed_uvs) * sizeof(packed_tex2_t) +
+    (size_t)mesh->bvh.num_nodes * sizeof(mesh_bvh_node_t) +
+    (size_t)mesh->bvh.num_triangles * sizeof(mesh_bvh_triangle_t);
+  for (int level = 0; level < mesh->num_lods; level++) {
+    bytes += (size_t)array_length(mesh->lods[level]) * sizeof(face_t);
+  }
+  if (mesh->num_lods == 0) {
+    bytes += (size_t)array_length(mesh->faces) * sizeof(face_t);
+  }
+  return bytes;
+}
+
+// Everything derived from the OBJ or glTF file, from its binary cache when that
+// is up to date. The progress, if any, is told once the bounds are known.
+static void load_mesh_geometry(mesh_t* mesh, char* filename, bool quantize, SDL_atomic_t* progress, load_profile_t* profile)
+{
+  char cache_filename[MAX_CACHE_FILENAME_LENGTH];
+  get_mesh_cache_filename(cache_filename, sizeof(cache_filename), filename);
+  Uint64 start = SDL_GetPerformanceCounter();
+  bool cached = load_mesh_cache(mesh, cache_filename, filename, quantize);
+  end_load_phase(profile, LOAD_PHASE_CACHE, start);
+  if (cached) {
+    add_load_bytes(profile, mesh->cache_file.size, mesh->cache_file.size);
+    if (profile != NULL) {
+      profile->cached = true;
+    }
+  }
+  else {
+    // Load the OBJ or binary glTF file to our mesh
+    start = SDL_GetPerformanceCounter();
+    if (has_extension(filename, ".glb")) {
+      load_glb_file(mesh, filename);
+    }
+    else {
+      load_obj_file(mesh, filename);
+    }
+    end_load_phase(profile, LOAD_PHASE_PARSE, start);
+    // The file is mapped while the arrays are filled
+    size_t file_size = get_file_size(filename);
+    add_load_bytes(profile, file_size, file_size + get_mesh_bytes(mesh));
+    start = SDL_GetPerformanceCounter();
+
+    // Precompute the bounding volumes used for frustum culling
+    compute_mesh_bounds(mesh);
+    if (progress != NULL) {
+      SDL_AtomicSet(progress, MESH_PLACEHOLDER);
+    }
+
+    // Simplify the mesh into coarser levels of detail for when it is far away
+    generate_mesh_lods(mesh);
+
+    // Reorder the faces of every level for the vertex cache and less overdraw
+    optimize_mesh_order(mesh);
+
+    // Build the hierarchy used for picking and line of sight tests
+    mesh_bvh_build(&mesh->bvh, mesh->vertices, mesh->faces, array_length(mesh->faces));
+
+    // Everything above needs the float vertices, rendering doesn't
+    if (quantize) {
+      quantize_mesh(mesh);
+    }
+
+    save_mesh_cache(mesh, cache_filename, filename);
+    end_load_phase(profile, LOAD_PHASE_SETUP, start);
+    add_load_bytes(profile, 0, get_mesh_bytes(mesh));
+  }
+  if (profile != NULL) {
+    profile->num_vertices = get_mesh_num_vertices(mesh);
+    profile->num_faces = array_length(mesh->faces);
+    profile->vertex_bytes = get_mesh_vertex_bytes(mesh);
+    profile->quantized = is_mesh_quantized(mesh);
+    profile->order_stats = mesh->order_stats;
+  }
+}
+
+// Decodes the PNG file, binary glTF files may embed their own. Safe on a loader
+// thread. The geometry bytes are what the load already holds meanwhile.
+static upng_t* load_mesh_png(char* filename, char* png_filename, load_profile_t* profile, size_t geometry_bytes)
+{
+  Uint64 start = SDL_GetPerformanceCounter();
+  upng_t* png_image = NULL;
+  if (has_extension(filename, ".glb")) {
+    png_image = load_glb_png(filename);
+  }
+  if (png_image == NULL && png_filename != NULL) {
+    png_image = load_png_file(png_filename);
+  }
+  if (png_image != NULL) {
+    // Reading covers the rest, like finding the image in a glTF file
+    const upng_stats* stats = upng_get_stats(png_image);
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+    add_load_seconds(profile, LOAD_PHASE_PNG_READ, seconds - stats->inflate_seconds - stats->unfilter_seconds);
+    add_load_seconds(profile, LOAD_PHASE_PNG_INFLATE, stats->inflate_seconds);
+    add_load_seconds(profile, LOAD_PHASE_PNG_UNFILTER, stats->unfilter_seconds);
+    add_load_bytes(profile, stats->source_size, geometry_bytes + stats->peak_size);
+  }
+  return png_image;
+}
+
+// Instances refer to the new mesh by its handle
+mesh_handle_t load_mesh(char* filename, char* png_filename)
+{
+  mesh_handle_t handle = registry_create(&meshes);
+  mesh_t* mesh = get_mesh_ptr(handle);
+  if (mesh == NULL) {
+    return NULL_HANDLE;
+  }
+  load_profile_t* profile = begin_load_profile(filename);
+  load_mesh_geometry(mesh, filename, quantize_meshes, NULL, profile);
+  upng_t* png_image = load_mesh_png(filename, png_filename, profile, get_mesh_bytes(mesh));
+  Uint64 start = SDL_GetPerformanceCounter();
+  mesh->texture = create_texture(png_image);
+  end_load_phase(profile, LOAD_PHASE_PUBLISH, start);
+  mesh->load_state = MESH_READY;
+  return handle;
+}
+
+// Opens a chunked file written by build_streamed_mesh. Only the bounds of the
+// chunks are read, their faces are read as they are drawn.
+mesh_handle_t load_streamed_mesh(char* filename)
+{
+  mesh_handle_t handle = registry_create(&meshes);
+  mesh_t* mesh = get_mesh_ptr(handle);
+  if (mesh == NULL) {
+    return NULL_HANDLE;
+  }
+  load_profile_t* profile = begin_load_profile(filename);
+  Uint64 start = SDL_GetPerformanceCounter();
+  mesh->stream = open_mesh_stream(filename);
+  end_load_phase(profile, LOAD_PHASE_PARSE, start);
+  if (mesh->stream == NULL) {
+    fprintf(stderr, "Error reading %s.\n", filename);
+  }
+  else {
+    mesh->bounds_min = mesh->stream->bounds_min;
+    mesh->bounds_max = mesh->stream->bounds_max;
+    mesh->bounds_center = mesh->stream->bounds_center;
+    mesh->bounds_radius = mesh->stream->bounds_radius;
+    if (profile != NULL) {
+      profile->num_chunks = mesh->stream->num_chunks;
+    }
+  }
+  mesh->load_state = MESH_READY;
+  return handle;
+}
+
+// Offline step for meshes too big for the machines rendering them, writes the
+// chunked file next to the OBJ or glTF file
+bool build_streamed_mesh(char* filename)
+{
+  mesh_t mesh = { 0 };
+  if (has_extension(filename, ".glb")) {
+    load_glb_file(&mesh, filename);
+  }
+  else {
+    load_obj_file(&mesh, filename);
+  }
+  compute_mesh_bounds(&mesh);
+
+  char stream_filename[MAX_CACHE_FILENAME_LENGTH];
+  get_mesh_stream_filename(stream_filename, sizeof(stream_filename), filename);
+  bool saved = save_mesh_stream(&mesh, stream_filename);
+  free_mesh(&mesh);
+  return saved;
+}
+
+static void run_mesh_load(void* data)
 {
-  // Load the OBJ file to our mesh
-  load_obj_file(obj_filename);
+  mesh_load_t* load = data;
+  load_mesh_geometry(&load->geometry, load->filename, load->quantize, &load->state, load->profile);
+  size_t geometry_bytes = get_mesh_bytes(&load->geometry);
+  SDL_AtomicSet(&load->state, MESH_UNTEXTURED);
+  load->png_image = load_mesh_png(
+    load->filename, load->png_filename[0] != '\0' ? load->png_filename : NULL, load->profile, geometry_bytes
+  );
+  SDL_AtomicSet(&load->state, MESH_READY);
+}
 
-  // Load the PNG file info
-  load_obj_png_data(png_filename);
+// Returns the handle of the mesh right away and loads it on a loader thread.
+// It has nothing to draw until publish_mesh_load takes over what was loaded.
+mesh_handle_t load_mesh_async(char* filename, char* png_filename)
+{
+  mesh_handle_t handle = registry_create(&meshes);
+  mesh_entry_t* entry = registry_get(&meshes, handle);
+  if (entry == NULL) {
+    return NULL_HANDLE;
+  }
+  mesh_load_t* load = calloc(1, sizeof(mesh_load_t));
+  snprintf(load->filename, sizeof(load->filename), "%s", filename);
+  snprintf(load->png_filename, sizeof(load->png_filename), "%s", png_filename != NULL ? png_filename : "");
+  load->quantize = quantize_meshes;
+  load->profile = begin_load_profile(filename);
+  SDL_AtomicSet(&load->state, MESH_LOADING);
 
-  // Initialize scale, translation and rotation with the parameters
-  meshes[mesh_count].scale = scale;
-  meshes[mesh_count].rotation = rotation;
-  meshes[mesh_count].translation = translation;
+  entry->load = load;
+  entry->mesh.load_state = MESH_LOADING;
+  submit_load_job(run_mesh_load, load);
+  return handle;
+}
 
-  // Add the nre mesh to the array of meshes
-  mesh_count++;
+// Box over the bounds of the mesh being loaded, drawn in its place meanwhile
+static void make_placeholder_mesh(mesh_t* mesh, const mesh_t* loading)
+{
+  make_box_mesh(mesh, loading->bounds_min, loading->bounds_max);
+  mesh->bounds_center = loading->bounds_center;
+  mesh->bounds_radius = loading->bounds_radius;
 }
 
-void load_obj_file(char* filename) {
-  mesh_t* mesh = &meshes[mesh_count];
-  FILE* fp;
-  fopen_s(&fp, filename, "r");
-  char line[1024];
+// Main thread side of the background loads, once per frame. Takes over the
+// stages the loader thread finished, true if the mesh changed. Only the state
+// is shared, the loader thread doesn't touch a stage after publishing it.
+bool publish_mesh_load(mesh_handle_t handle)
+{
+  mesh_entry_t* entry = registry_get(&meshes, handle);
+  if (entry == NULL || entry->load == NULL) {
+    return false;
+  }
+  mesh_load_t* load = entry->load;
+  mesh_t* mesh = &entry->mesh;
+  mesh_load_state_t state = SDL_AtomicGet(&load->state);
+  if (state == mesh->load_state) {
+    return false;
+  }
+  Uint64 start = SDL_GetPerformanceCounter();
+  load_profile_t* profile = load->profile;
 
-  tex2_t* tex_coords = NULL;
+  if (state == MESH_PLACEHOLDER) {
+    make_placeholder_mesh(mesh, &load->geometry);
+  }
+  if (state >= MESH_UNTEXTURED && mesh->load_state < MESH_UNTEXTURED) {
+    free_mesh(mesh);
+    *mesh = load->geometry;
+    load->geometry_taken = true;
+  }
+  if (state == MESH_READY) {
+    mesh->texture = create_texture(load->png_image);
+    free(load);
+    entry->load = NULL;
+  }
+  mesh->load_state = state;
+  end_load_phase(profile, LOAD_PHASE_PUBLISH, start);
+  return true;
+}
 
-  while (fgets(line, 1024, fp)) {
-    // Vertex position
-    if (strncmp(line, "v ", 2) == 0) {
-      vec3_t v;
-      sscanf_s(line, "v %f %f %f", &v.x, &v.y, &v.z);
-      array_push(mesh->vertices, v);
+bool are_meshes_loaded(void)
+{
+  for (int i = 0; i < meshes.count; i++) {
+    mesh_entry_t* entry = registry_item(&meshes, i);
+    if (entry->load != NULL) {
+      return false;
     }
+  }
+  return true;
+}
 
-    // Texture coordinate
-    if (strncmp(line, "vt ", 3) == 0) {
-      tex2_t tex_coord;
-      sscanf_s(line, "vt %f %f", &tex_coord.u, &tex_coord.v);
-      array_push(tex_coords, tex_coord);
+// Frees what the finished loads of unloaded meshes built
+static void free_abandoned_loads(void)
+{
+  for (int i = 0; i < array_length(abandoned_loads); i++) {
+    mesh_load_t* load = abandoned_loads[i];
+    if (load == NULL || SDL_AtomicGet(&load->state) != MESH_READY) {
+      continue;
+    }
+    if (!load->geometry_taken) {
+      free_mesh(&load->geometry);
     }
+    if (load->png_image != NULL) {
+      upng_free(load->png_image);
+    }
+    free(load);
+    abandoned_loads[i] = NULL;
+  }
+}
+
+// Blocks until the background loads are done and publishes them
+void finish_mesh_loads(void)
+{
+  wait_load_jobs();
+  for (int i = 0; i < meshes.count; i++) {
+    publish_mesh_load(registry_handle(&meshes, i));
+  }
+  free_abandoned_loads();
+}
 
-    // Face indices
-    if (strncmp(line, "f ", 2) == 0) {
-      int vertex_indices[3];
-      int texture_indices[3];
-      int normal_indices[3];
-      sscanf_s(
-        line,
-        "f %d/%d/%d %d/%d/%d %d/%d/%d",
-        &vertex_indices[0], &texture_indices[0], &normal_indices[0],
-        &vertex_indices[1], &texture_indices[1], &normal_indices[1],
-        &vertex_indices[2], &texture_indices[2], &normal_indices[2]
-      );
-      face_t f = {
-        .a = vertex_indices[0] - 1,
-        .b = vertex_indices[1] - 1,
-        .c = vertex_indices[2] - 1,
-        .a_uv = tex_coords[texture_indices[0] - 1],
-        .b_uv = tex_coords[texture_indices[1] - 1],
-        .c_uv = tex_coords[texture_indices[2] - 1],
-        .color = 0xFFFFFFFF
-      };
-      array_push(mesh->faces, f);
+// Frees the mesh and its texture, its handle stops resolving. A load still
+// running finishes on its own and is freed later. Its instances stay, drawing
+// nothing, and are refit and redrawn like after a publish.
+void unload_mesh(mesh_handle_t handle)
+{
+  mesh_entry_t* entry = registry_get(&meshes, handle);
+  if (entry == NULL) {
+    return;
+  }
+  mark_mesh_instances_dirty(handle);
+  invalidate_mesh_impostors(handle);
+  free_abandoned_loads();
+  if (entry->load != NULL) {
+    int slot = 0;
+    while (slot < array_length(abandoned_loads) && abandoned_loads[slot] != NULL) {
+      slot++;
+    }
+    if (slot < array_length(abandoned_loads)) {
+      abandoned_loads[slot] = entry->load;
+    }
+    else {
+      array_push(abandoned_loads, entry->load);
     }
   }
+  free_mesh(&entry->mesh);
+  registry_destroy(&meshes, handle);
+}
+
+void load_obj_file(mesh_t* mesh, char* filename) {
+  if (!parse_obj_file(filename, &mesh->vertices, &mesh->uvs, &mesh->faces)) {
+    fprintf(stderr, "Error reading %s.\n", filename);
+  }
+}
 
-  array_free(tex_coords);
-  fclose(fp);
+void load_glb_file(mesh_t* mesh, char* filename) {
+  if (!parse_glb_file(filename, &mesh->vertices, &mesh->uvs, &mesh->faces)) {
+    fprintf(stderr, "Error reading %s.\n", filename);
+  }
 }
 
-void load_obj_png_data(char* filename)
+upng_t* load_png_file(char* filename)
 {
   upng_t* png_image = upng_new_from_file(filename);
   if (png_image != NULL) {
     upng_decode(png_image);
-    if (upng_get_error(png_image) == UPNG_EOK) {
-      meshes[mesh_count].texture = png_image;
+    if (upng_get_error(png_image) != UPNG_EOK) {
+      upng_free(png_image);
+      png_image = NULL;
+    }
+  }
+  return png_image;
+}
+
+void compute_mesh_bounds(mesh_t* mesh)
+{
+  int num_vertices = array_length(mesh->vertices);
+  if (num_vertices == 0) {
+    mesh->bounds_min = vec3_new(0, 0, 0);
+    mesh->bounds_max = vec3_new(0, 0, 0);
+    mesh->bounds_center = vec3_new(0, 0, 0);
+    mesh->bounds_radius = 0;
+    return;
+  }
+
+  // Axis-aligned box enclosing all the vertices
+  vec3_t min = mesh->vertices[0];
+  vec3_t max = mesh->vertices[0];
+  for (int i = 1; i < num_vertices; i++) {
+    vec3_t v = mesh->vertices[i];
+    min.x = fminf(min.x, v.x);
+    min.y = fminf(min.y, v.y);
+    min.z = fminf(min.z, v.z);
+    max.x = fmaxf(max.x, v.x);
+    max.y = fmaxf(max.y, v.y);
+    max.z = fmaxf(max.z, v.z);
+  }
+
+  // Sphere centered in the box, with the radius of the farthest vertex
+  vec3_t center = vec3_mul(vec3_add(min, max), 0.5);
+  float radius_squared = 0;
+  for (int i = 0; i < num_vertices; i++) {
+    vec3_t d = vec3_sub(mesh->vertices[i], center);
+    radius_squared = fmaxf(radius_squared, vec3_dot(d, d));
+  }
+
+  mesh->bounds_min = min;
+  mesh->bounds_max = max;
+  mesh->bounds_center = center;
+  mesh->bounds_radius = sqrtf(radius_squared);
+}
+
+// Closed box with one flat shaded side per face of the box, standing in for
+// geometry that is not in memory
+void make_box_mesh(mesh_t* mesh, vec3_t min, vec3_t max)
+{
+  // Corners have the maximum x, y and z for the bits 1, 2 and 4 of their index
+  static const int sides[6][4] = {
+    { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+    { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 }
+  };
+  vec3_t center = vec3_mul(vec3_add(min, max), 0.5);
+  mesh->vertices = array_hold(NULL, 8, sizeof(vec3_t));
+  mesh->uvs = array_hold(NULL, 8, sizeof(tex2_t));
+  for (int i = 0; i < 8; i++) {
+    mesh->vertices[i] = vec3_new((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+    mesh->uvs[i] = (tex2_t) { 0, 0 };
+  }
+
+  // Wound so the side facing away from the box is the front one
+  mesh->faces = array_hold(NULL, 12, sizeof(face_t));
+  for (int s = 0; s < 6; s++) {
+    for (int t = 0; t < 2; t++) {
+      face_t face = { sides[s][0], sides[s][t + 1], sides[s][t + 2] };
+      vec3_t a = mesh->vertices[face.a];
+      vec3_t normal = vec3_cross(vec3_sub(mesh->vertices[face.b], a), vec3_sub(mesh->vertices[face.c], a));
+      if (vec3_dot(normal, vec3_sub(a, center)) < 0) {
+        int b = face.b;
+        face.b = face.c;
+        face.c = b;
+      }
+      mesh->faces[s * 2 + t] = face;
     }
   }
+  mesh->lods[0] = mesh->faces;
+  mesh->num_lods = 1;
+  mesh->bounds_min = min;
+  mesh->bounds_max = max;
+  mesh->bounds_center = center;
+  mesh->bounds_radius = vec3_length(vec3_sub(max, center));
 }
 
+// Meshes are packed in no particular order, walk them by position with get_mesh_handle
 int get_num_meshes()
 {
-  return mesh_count;
+  return meshes.count;
+}
+
+mesh_handle_t get_mesh_handle(int index)
+{
+  return registry_handle(&meshes, index);
 }
 
-mesh_t* get_mesh_ptr(int index)
+// NULL once the mesh is unloaded. Meshes move when others are unloaded, the
+// pointer is only good until then.
+mesh_t* get_mesh_ptr(mesh_handle_t handle)
 {
-  if (index < 0 || index >= mesh_count)
-    return NULL;
-  return &meshes[index];
+  mesh_entry_t* entry = registry_get(&meshes, handle);
+  return entry != NULL ? &entry->mesh : NULL;
 }
 
 void free_meshes()
 {
-  for (int i = 0; i < mesh_count; i++) {
-    upng_free(meshes[i].texture);
-    array_free(meshes[i].faces);
-    array_free(meshes[i].vertices);
+  // Loads still running write to their meshes
+  finish_mesh_loads();
+  for (int i = 0; i < meshes.count; i++) {
+    mesh_entry_t* entry = registry_item(&meshes, i);
+    free_mesh(&entry->mesh);
   }
+  registry_free(&meshes);
+  array_free(abandoned_loads);
+  abandoned_loads = NULL;
 }
@@ -1,32 +1,92 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "mapped_file.h"
+#include "mesh_bvh.h"
+#include "registry.h"
 #include "triangle.h"
 #include "vector.h"
 #include "upng.h"
 
+#define MAX_NUM_LODS 4
+// Color the flat shaded render methods light
+#define MESH_COLOR 0xFFFFFFFF
+
+// Position in 16 bit steps across the mesh bounding box, see mesh_quantize.c
+typedef struct {
+	uint16_t x;
+	uint16_t y;
+	uint16_t z;
+} packed_vec3_t;
+
+// Texture coordinates as 16 bit fractions of the texture size
+typedef struct {
+	uint16_t u;
+	uint16_t v;
+} packed_tex2_t;
+
+// Vertex cache and overdraw efficiency of the full detail faces, see mesh_optimize.c
+typedef struct {
+	float acmr_before;		// vertices transformed per face, as loaded
+	float acmr_after;		// and once reordered
+	float overdraw_before;	// pixels shaded per pixel covered
+	float overdraw_after;
+} mesh_order_stats_t;
+
+// How far along a mesh loaded in the background is, each stage drawable
+typedef enum {
+	MESH_LOADING,			// nothing to draw yet
+	MESH_PLACEHOLDER,		// drawn as its bounding box while the rest is built
+	MESH_UNTEXTURED,		// all the geometry, the texture is still decoding
+	MESH_READY
+} mesh_load_state_t;
+
+// Mesh in the registry of meshes, see mesh.c
+typedef handle_t mesh_handle_t;
+
+// Chunks of a mesh read from disk as they are drawn, see mesh_stream.c
+typedef struct mesh_stream mesh_stream_t;
+
 typedef struct {
 	vec3_t* vertices;		// dynamic array of vertices
+	tex2_t* uvs;			// dynamic array of texture coordinates, one per vertex
+	packed_vec3_t* packed_vertices;	// replace vertices in a quantized mesh
+	packed_tex2_t* packed_uvs;		// replace uvs in a quantized mesh, if they fit
 	face_t* faces;			// dynamic array of faces
-	upng_t* texture;
-	vec3_t scale;
-	vec3_t rotation;		// rotation with x, y, z values
-	vec3_t translation;
+	texture_handle_t texture;	// NULL_HANDLE for an untextured mesh
+	vec3_t bounds_min;		// local space axis-aligned bounding box
+	vec3_t bounds_max;
+	vec3_t bounds_center;	// local space bounding sphere
+	float bounds_radius;
+	face_t* lods[MAX_NUM_LODS];	// lods[0] is faces, then simplified versions sharing the vertices
+	int num_lods;
+	mesh_order_stats_t order_stats;	// how much reordering the faces at load helped
+	mesh_bvh_t bvh;			// triangle hierarchy over the full detail faces for ray queries
+	mapped_file_t cache_file;	// binary cache the arrays above point into, if loaded from one
+	mesh_load_state_t load_state;	// of a mesh loaded in the background, ready otherwise
+	mesh_stream_t* stream;	// chunks drawn instead of the arrays above, for a mesh too big to load whole
 } mesh_t;
 
-extern mesh_t mesh;
-
-void load_mesh(
-	char* obj_filename,
-	char* png_filename,
-	vec3_t scale,
-	vec3_t rotation,
-	vec3_t translation
-);
-void load_obj_file(char* filename);
-void load_obj_png_data(char* png_filename);
+void set_mesh_quantization(bool enabled);
+void set_mesh_stats(bool enabled);
+mesh_handle_t load_mesh(char* filename, char* png_filename);
+mesh_handle_t load_mesh_async(char* filename, char* png_filename);
+mesh_handle_t load_streamed_mesh(char* filename);
+bool build_streamed_mesh(char* filename);
+bool publish_mesh_load(mesh_handle_t handle);
+bool are_meshes_loaded(void);
+void finish_mesh_loads(void);
+void unload_mesh(mesh_handle_t handle);
+void load_obj_file(mesh_t* mesh, char* filename);
+void load_glb_file(mesh_t* mesh, char* filename);
+upng_t* load_png_file(char* filename);
+void compute_mesh_bounds(mesh_t* mesh);
+void make_box_mesh(mesh_t* mesh, vec3_t min, vec3_t max);
 int get_num_meshes();
-mesh_t* get_mesh_ptr(int index);
+mesh_handle_t get_mesh_handle(int index);
+mesh_t* get_mesh_ptr(mesh_handle_t handle);
 void free_meshes();
 
 
@@ -0,0 +1,342 @@
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aabb.h"
+#include "mesh_bvh.h"
+
+#define MESH_BVH_STACK_SIZE 64
+
+// Plain comparisons compile to single min and max instructions, unlike fminf and fmaxf
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef struct {
+	aabb_t bounds;
+	vec3_t center;
+} build_triangle_t;
+
+typedef struct {
+	build_triangle_t* build_triangles;
+	int* order;				// triangle indices, partitioned while building
+	mesh_bvh_node_t* nodes;
+	int num_nodes;
+} build_context_t;
+
+static float vec3_axis(vec3_t v, int axis) {
+	return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static void set_node_bounds(mesh_bvh_node_t* node, aabb_t bounds) {
+	node->min[0] = bounds.min.x; node->min[1] = bounds.min.y; node->min[2] = bounds.min.z;
+	node->max[0] = bounds.max.x; node->max[1] = bounds.max.y; node->max[2] = bounds.max.z;
+}
+
+// Binned surface area heuristic, a leaf is kept when no split is cheaper than
+// testing all of its triangles
+static void build_node(build_context_t* context, int node_index, int first, int count, int depth) {
+	aabb_t bounds = aabb_empty();
+	aabb_t centers = aabb_empty();
+	for (int i = first; i < first + count; i++) {
+		build_triangle_t* triangle = &context->build_triangles[context->order[i]];
+		bounds = aabb_union(bounds, triangle->bounds);
+		centers = aabb_expand(centers, triangle->center);
+	}
+	mesh_bvh_node_t* node = &context->nodes[node_index];
+	set_node_bounds(node, bounds);
+	node->offset = first;
+	node->count = count;
+
+	if (count <= MESH_BVH_MAX_LEAF_SIZE || depth >= MESH_BVH_STACK_SIZE - 2) {
+		return;
+	}
+
+	int best_axis = -1;
+	int best_plane = 0;
+	float best_cost = aabb_surface_area(bounds) * count;
+	for (int axis = 0; axis < 3; axis++) {
+		float axis_min = vec3_axis(centers.min, axis);
+		float axis_extent = vec3_axis(centers.max, axis) - axis_min;
+		if (axis_extent <= 0) continue;
+
+		int bin_counts[MESH_BVH_NUM_BINS] = { 0 };
+		aabb_t bin_bounds[MESH_BVH_NUM_BINS];
+		for (int b = 0; b < MESH_BVH_NUM_BINS; b++) {
+			bin_bounds[b] = aabb_empty();
+		}
+		float bin_scale = MESH_BVH_NUM_BINS / axis_extent * 0.9999f;
+		for (int i = first; i < first + count; i++) {
+			build_triangle_t* triangle = &context->build_triangles[context->order[i]];
+			int b = (int)((vec3_axis(triangle->center, axis) - axis_min) * bin_scale);
+			bin_counts[b]++;
+			bin_bounds[b] = aabb_union(bin_bounds[b], triangle->bounds);
+		}
+
+		float right_costs[MESH_BVH_NUM_BINS];
+		aabb_t right = aabb_empty();
+		int right_count = 0;
+		for (int b = MESH_BVH_NUM_BINS - 1; b > 0; b--) {
+			right = aabb_union(right, bin_bounds[b]);
+			right_count += bin_counts[b];
+			right_costs[b] = aabb_surface_area(right) * right_count;
+		}
+		aabb_t left = aabb_empty();
+		int left_count = 0;
+		for (int b = 1; b < MESH_BVH_NUM_BINS; b++) {
+			left = aabb_union(left, bin_bounds[b - 1]);
+			left_count += bin_counts[b - 1];
+			if (left_count == 0 || left_count == count) continue;
+			float cost = aabb_surface_area(left) * left_count + right_costs[b];
+			if (cost < best_cost) {
+				best_axis = axis;
+				best_plane = b;
+				best_cost = cost;
+			}
+		}
+	}
+	if (best_axis < 0) {
+		return;
+	}
+
+	float axis_min = vec3_axis(centers.min, best_axis);
+	float bin_scale = MESH_BVH_NUM_BINS / (vec3_axis(centers.max, best_axis) - axis_min) * 0.9999f;
+	int i = first;
+	int j = first + count - 1;
+	while (i <= j) {
+		build_triangle_t* triangle = &context->build_triangles[context->order[i]];
+		if ((int)((vec3_axis(triangle->center, best_axis) - axis_min) * bin_scale) < best_plane) {
+			i++;
+		}
+		else {
+			int swap = context->order[i];
+			context->order[i] = context->order[j];
+			context->order[j--] = swap;
+		}
+	}
+
+	// The first child goes right after the node, the second one after the whole first subtree
+	node->count = 0;
+	int left_index = context->num_nodes++;
+	build_node(context, left_index, first, i - first, depth + 1);
+	int right_index = context->num_nodes++;
+	context->nodes[node_index].offset = right_index;
+	build_node(context, right_index, i, first + count - i, depth + 1);
+}
+
+void mesh_bvh_build(mesh_bvh_t* bvh, const vec3_t* vertices, const face_t* faces, int num_faces) {
+	memset(bvh, 0, sizeof(mesh_bvh_t));
+	if (num_faces == 0) {
+		return;
+	}
+
+	build_context_t context;
+	context.build_triangles = malloc(sizeof(build_triangle_t) * num_faces);
+	context.order = malloc(sizeof(int) * num_faces);
+	context.nodes = malloc(sizeof(mesh_bvh_node_t) * (2 * num_faces - 1));
+	context.num_nodes = 1;
+	for (int i = 0; i < num_faces; i++) {
+		aabb_t bounds = aabb_empty();
+		bounds = aabb_expand(bounds, vertices[faces[i].a]);
+		bounds = aabb_expand(bounds, vertices[faces[i].b]);
+		bounds = aabb_expand(bounds, vertices[faces[i].c]);
+		context.build_triangles[i].bounds = bounds;
+		context.build_triangles[i].center = aabb_center(bounds);
+		context.order[i] = i;
+	}
+
+	build_node(&context, 0, 0, num_faces, 0);
+
+	bvh->nodes = realloc(context.nodes, sizeof(mesh_bvh_node_t) * context.num_nodes);
+	bvh->num_nodes = context.num_nodes;
+	bvh->triangles = malloc(sizeof(mesh_bvh_triangle_t) * num_faces);
+	bvh->num_triangles = num_faces;
+	for (int i = 0; i < num_faces; i++) {
+		const face_t* face = &faces[context.order[i]];
+		mesh_bvh_triangle_t* triangle = &bvh->triangles[i];
+		triangle->v0 = vertices[face->a];
+		triangle->edge1 = vec3_sub(vertices[face->b], vertices[face->a]);
+		triangle->edge2 = vec3_sub(vertices[face->c], vertices[face->a]);
+		triangle->face = context.order[i];
+	}
+
+	free(context.order);
+	free(context.build_triangles);
+}
+
+// Slab test, returns the distance where the ray enters the box or FLT_MAX if it misses
+static inline float intersect_node(const mesh_bvh_node_t* node, vec3_t origin, vec3_t inverse_direction, float max_distance) {
+	float tx0 = (node->min[0] - origin.x) * inverse_direction.x;
+	float tx1 = (node->max[0] - origin.x) * inverse_direction.x;
+	float ty0 = (node->min[1] - origin.y) * inverse_direction.y;
+	float ty1 = (node->max[1] - origin.y) * inverse_direction.y;
+	float tz0 = (node->min[2] - origin.z) * inverse_direction.z;
+	float tz1 = (node->max[2] - origin.z) * inverse_direction.z;
+	float t_near = MAX(MAX(MIN(tx0, tx1), MIN(ty0, ty1)), MIN(tz0, tz1));
+	float t_far = MIN(MIN(MAX(tx0, tx1), MAX(ty0, ty1)), MAX(tz0, tz1));
+	if (t_far < t_near || t_far < 0 || t_near > max_distance) {
+		return FLT_MAX;
+	}
+	return t_near;
+}
+
+// Moller-Trumbore, both sides of the triangle count as a hit
+static inline bool intersect_triangle(
+	const mesh_bvh_triangle_t* triangle, vec3_t origin, vec3_t direction,
+	float max_distance, float* distance, float* u, float* v
+) {
+	const vec3_t* e1 = &triangle->edge1;
+	const vec3_t* e2 = &triangle->edge2;
+	vec3_t p = {
+		direction.y * e2->z - direction.z * e2->y,
+		direction.z * e2->x - direction.x * e2->z,
+		direction.x * e2->y - direction.y * e2->x
+	};
+	float determinant = e1->x * p.x + e1->y * p.y + e1->z * p.z;
+	if (fabsf(determinant) < 1e-12f) {
+		return false;
+	}
+	float inverse_determinant = 1.0f / determinant;
+	vec3_t s = { origin.x - triangle->v0.x, origin.y - triangle->v0.y, origin.z - triangle->v0.z };
+	float hit_u = (s.x * p.x + s.y * p.y + s.z * p.z) * inverse_determinant;
+	if (hit_u < 0 || hit_u > 1) {
+		return false;
+	}
+	vec3_t q = {
+		s.y * e1->z - s.z * e1->y,
+		s.z * e1->x - s.x * e1->z,
+		s.x * e1->y - s.y * e1->x
+	};
+	float hit_v = (direction.x * q.x + direction.y * q.y + direction.z * q.z) * inverse_determinant;
+	if (hit_v < 0 || hit_u + hit_v > 1) {
+		return false;
+	}
+	float t = (e2->x * q.x + e2->y * q.y + e2->z * q.z) * inverse_determinant;
+	if (t < 0 || t > max_distance) {
+		return false;
+	}
+	*distance = t;
+	*u = hit_u;
+	*v = hit_v;
+	return true;
+}
+
+static vec3_t inverse_of(vec3_t direction) {
+	// Zero components give infinities, which the slab test handles
+	return vec3_new(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+}
+
+// Closest hit of a ray within max_distance, in units of the direction length
+bool mesh_bvh_intersect(
+	const mesh_bvh_t* bvh, const face_t* faces, const tex2_t* uvs,
+	vec3_t origin, vec3_t direction, float max_distance, ray_hit_t* hit
+) {
+	hit->face = -1;
+	hit->distance = max_distance;
+	if (bvh->num_nodes == 0) {
+		return false;
+	}
+
+	vec3_t inverse_direction = inverse_of(direction);
+	int hit_triangle = -1;
+
+	// Nodes waiting to be visited keep the distance where the ray enters them,
+	// so they can be skipped once a closer hit has been found
+	int stack[MESH_BVH_STACK_SIZE];
+	float stack_distances[MESH_BVH_STACK_SIZE];
+	int stack_size = 0;
+	float root_distance = intersect_node(&bvh->nodes[0], origin, inverse_direction, hit->distance);
+	if (root_distance != FLT_MAX) {
+		stack[stack_size] = 0;
+		stack_distances[stack_size++] = root_distance;
+	}
+
+	while (stack_size > 0) {
+		stack_size--;
+		if (stack_distances[stack_size] > hit->distance) {
+			continue;
+		}
+		const mesh_bvh_node_t* node = &bvh->nodes[stack[stack_size]];
+		if (node->count > 0) {
+			for (int i = node->offset; i < node->offset + node->count; i++) {
+				float t, u, v;
+				if (intersect_triangle(&bvh->triangles[i], origin, direction, hit->distance, &t, &u, &v)) {
+					hit->distance = t;
+					hit->u = u;
+					hit->v = v;
+					hit_triangle = i;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearest child first, so later boxes get culled by a closer hit
+		int first = (int)(node - bvh->nodes) + 1;
+		int second = node->offset;
+		float first_distance = intersect_node(&bvh->nodes[first], origin, inverse_direction, hit->distance);
+		float second_distance = intersect_node(&bvh->nodes[second], origin, inverse_direction, hit->distance);
+		if (first_distance > second_distance) {
+			int swap = first;
+			first = second;
+			second = swap;
+			float swap_distance = first_distance;
+			first_distance = second_distance;
+			second_distance = swap_distance;
+		}
+		if (second_distance != FLT_MAX) {
+			stack[stack_size] = second;
+			stack_distances[stack_size++] = second_distance;
+		}
+		if (first_distance != FLT_MAX) {
+			stack[stack_size] = first;
+			stack_distances[stack_size++] = first_distance;
+		}
+	}
+
+	if (hit_triangle < 0) {
+		return false;
+	}
+	const face_t* face = &faces[bvh->triangles[hit_triangle].face];
+	float w = 1 - hit->u - hit->v;
+	hit->face = bvh->triangles[hit_triangle].face;
+	hit->texcoords.u = w * uvs[face->a].u + hit->u * uvs[face->b].u + hit->v * uvs[face->c].u;
+	hit->texcoords.v = w * uvs[face->a].v + hit->u * uvs[face->b].v + hit->v * uvs[face->c].v;
+	return true;
+}
+
+// Line of sight, true as soon as any triangle crosses the segment
+bool mesh_bvh_occluded(const mesh_bvh_t* bvh, vec3_t from, vec3_t to) {
+	if (bvh->num_nodes == 0) {
+		return false;
+	}
+
+	vec3_t direction = { to.x - from.x, to.y - from.y, to.z - from.z };
+	vec3_t inverse_direction = inverse_of(direction);
+	int stack[MESH_BVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0) {
+		int node_index = stack[--stack_size];
+		const mesh_bvh_node_t* node = &bvh->nodes[node_index];
+		if (intersect_node(node, from, inverse_direction, 1.0f) == FLT_MAX) {
+			continue;
+		}
+		if (node->count > 0) {
+			for (int i = node->offset; i < node->offset + node->count; i++) {
+				float t, u, v;
+				if (intersect_triangle(&bvh->triangles[i], from, direction, 1.0f, &t, &u, &v)) {
+					return true;
+				}
+			}
+			continue;
+		}
+		stack[stack_size++] = node->offset;
+		stack[stack_size++] = node_index + 1;
+	}
+	return false;
+}
+
+void mesh_bvh_free(mesh_bvh_t* bvh) {
+	free(bvh->nodes);
+	free(bvh->triangles);
+	memset(bvh, 0, sizeof(mesh_bvh_t));
+}
@@ -0,0 +1,52 @@
+#ifndef MESH_BVH_H
+#define MESH_BVH_H
+
+#include <stdbool.h>
+#include "texture.h"
+#include "triangle.h"
+#include "vector.h"
+
+#define MESH_BVH_MAX_LEAF_SIZE 4
+#define MESH_BVH_NUM_BINS 16
+
+// 32 bytes, two nodes per cache line. Inner nodes are stored in depth first
+// order, so the first child always follows its parent
+typedef struct {
+	float min[3];
+	int offset;				// first triangle of a leaf, second child of an inner node
+	float max[3];
+	int count;				// triangles in a leaf, 0 for inner nodes
+} mesh_bvh_node_t;
+
+// Triangles are copied in leaf order with what the intersection test needs
+typedef struct {
+	vec3_t v0;
+	vec3_t edge1;
+	vec3_t edge2;
+	int face;
+} mesh_bvh_triangle_t;
+
+typedef struct {
+	mesh_bvh_node_t* nodes;
+	int num_nodes;
+	mesh_bvh_triangle_t* triangles;
+	int num_triangles;
+} mesh_bvh_t;
+
+typedef struct {
+	int face;				// index in the faces of the mesh, -1 if nothing was hit
+	float distance;			// along the ray, in units of the direction length
+	float u;				// barycentric weights of the second and third vertices
+	float v;
+	tex2_t texcoords;		// interpolated texture coordinates at the hit
+} ray_hit_t;
+
+void mesh_bvh_build(mesh_bvh_t* bvh, const vec3_t* vertices, const face_t* faces, int num_faces);
+bool mesh_bvh_intersect(
+	const mesh_bvh_t* bvh, const face_t* faces, const tex2_t* uvs,
+	vec3_t origin, vec3_t direction, float max_distance, ray_hit_t* hit
+);
+bool mesh_bvh_occluded(const mesh_bvh_t* bvh, vec3_t from, vec3_t to);
+void mesh_bvh_free(mesh_bvh_t* bvh);
+
+#endif // !MESH_BVH_H
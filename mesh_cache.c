@@ -0,0 +1,222 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "array.h"
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "mesh_quantize.h"
+
+#ifdef _WIN32
+#define stat _stat64
+#endif
+
+// Sections start 16 byte aligned, each one after the capacity and length that
+// array.c keeps in front of a dynamic array, so the arrays of the mesh point
+// straight into the mapping
+#define MESH_CACHE_ALIGNMENT 16
+#define MESH_CACHE_ARRAY_HEADER_SIZE (sizeof(int) * 2)
+// Longest filename of the cache as it is written, before it replaces the old one
+#define MESH_CACHE_MAX_FILENAME_LENGTH 264
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;			// which vertex arrays are packed
+	uint64_t source_size;	// the OBJ file the cache was made from
+	int64_t source_mtime;
+	float bounds_min[3];
+	float bounds_max[3];
+	float bounds_center[3];
+	float bounds_radius;
+	int32_t num_vertices;
+	int32_t num_lods;
+	int32_t num_lod_faces[MAX_NUM_LODS];
+	int32_t num_bvh_nodes;
+	int32_t num_bvh_triangles;
+	mesh_order_stats_t order_stats;
+} mesh_cache_header_t;
+
+static size_t align_size(size_t size) {
+	return (size + MESH_CACHE_ALIGNMENT - 1) & ~(size_t)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static size_t section_size(int count, size_t item_size) {
+	return MESH_CACHE_ALIGNMENT + align_size((size_t)count * item_size);
+}
+
+static bool get_source_info(const char* filename, uint64_t* size, int64_t* mtime) {
+	struct stat info;
+	if (stat(filename, &info) != 0) {
+		return false;
+	}
+	*size = (uint64_t)info.st_size;
+	*mtime = (int64_t)info.st_mtime;
+	return true;
+}
+
+// Dynamic array in the mapping for the section at cursor, which moves to the next one
+static void* map_section(const char** cursor, int count, size_t item_size) {
+	int* array = (int*)(*cursor + MESH_CACHE_ALIGNMENT);
+	*cursor += section_size(count, item_size);
+	return array;
+}
+
+static bool write_section(FILE* fp, const void* data, int count, size_t item_size) {
+	static const char padding[MESH_CACHE_ALIGNMENT] = { 0 };
+	int array_header[2] = { count, count };
+	size_t data_size = (size_t)count * item_size;
+	size_t padding_size = align_size(data_size) - data_size;
+	return
+		fwrite(padding, 1, MESH_CACHE_ALIGNMENT - MESH_CACHE_ARRAY_HEADER_SIZE, fp) == MESH_CACHE_ALIGNMENT - MESH_CACHE_ARRAY_HEADER_SIZE &&
+		fwrite(array_header, sizeof(array_header), 1, fp) == 1 &&
+		fwrite(data, 1, data_size, fp) == data_size &&
+		fwrite(padding, 1, padding_size, fp) == padding_size;
+}
+
+// Name of the cache for an OBJ file, its extension replaced by the cache one
+void get_mesh_cache_filename(char* cache_filename, int size, const char* obj_filename) {
+	int length = (int)strlen(obj_filename);
+	if (length >= 4 && strcmp(obj_filename + length - 4, ".obj") == 0) {
+		length -= 4;
+	}
+	snprintf(cache_filename, size, "%.*s%s", length, obj_filename, MESH_CACHE_EXTENSION);
+}
+
+// Points the mesh into a mapping of the cache, which it keeps until freed.
+// Fails for a missing or damaged cache, one made from another version of the OBJ file,
+// or one with float vertices when quantized ones are asked for, and the other way around.
+bool load_mesh_cache(mesh_t* mesh, const char* cache_filename, const char* obj_filename, bool quantized) {
+	uint64_t source_size;
+	int64_t source_mtime;
+	if (!get_source_info(obj_filename, &source_size, &source_mtime)) {
+		return false;
+	}
+	mapped_file_t file;
+	if (!map_file(&file, cache_filename)) {
+		return false;
+	}
+
+	const mesh_cache_header_t* header = (const mesh_cache_header_t*)file.data;
+	bool valid =
+		file.size >= sizeof(mesh_cache_header_t) &&
+		header->magic == MESH_CACHE_MAGIC &&
+		header->version == MESH_CACHE_VERSION &&
+		((header->flags & MESH_CACHE_PACKED_VERTICES) != 0) == quantized &&
+		header->source_size == source_size &&
+		header->source_mtime == source_mtime &&
+		header->num_lods >= 1 && header->num_lods <= MAX_NUM_LODS &&
+		header->num_vertices >= 0 && header->num_bvh_nodes >= 0 && header->num_bvh_triangles >= 0;
+
+	// The counts have to account for the whole file
+	size_t vertex_size = sizeof(vec3_t);
+	size_t uv_size = sizeof(tex2_t);
+	if (valid) {
+		vertex_size = (header->flags & MESH_CACHE_PACKED_VERTICES) ? sizeof(packed_vec3_t) : sizeof(vec3_t);
+		uv_size = (header->flags & MESH_CACHE_PACKED_UVS) ? sizeof(packed_tex2_t) : sizeof(tex2_t);
+		size_t expected_size = align_size(sizeof(mesh_cache_header_t)) +
+			section_size(header->num_vertices, vertex_size) + section_size(header->num_vertices, uv_size);
+		for (int level = 0; level < header->num_lods; level++) {
+			valid = valid && header->num_lod_faces[level] >= 0;
+			expected_size += section_size(header->num_lod_faces[level], sizeof(face_t));
+		}
+		expected_size += section_size(header->num_bvh_nodes, sizeof(mesh_bvh_node_t));
+		expected_size += section_size(header->num_bvh_triangles, sizeof(mesh_bvh_triangle_t));
+		valid = valid && file.size == expected_size;
+	}
+	if (!valid) {
+		unmap_file(&file);
+		return false;
+	}
+
+	const char* cursor = file.data + align_size(sizeof(mesh_cache_header_t));
+	void* vertices = map_section(&cursor, header->num_vertices, vertex_size);
+	void* uvs = map_section(&cursor, header->num_vertices, uv_size);
+	if (header->flags & MESH_CACHE_PACKED_VERTICES) {
+		mesh->packed_vertices = vertices;
+	}
+	else {
+		mesh->vertices = vertices;
+	}
+	if (header->flags & MESH_CACHE_PACKED_UVS) {
+		mesh->packed_uvs = uvs;
+	}
+	else {
+		mesh->uvs = uvs;
+	}
+	mesh->num_lods = header->num_lods;
+	for (int level = 0; level < header->num_lods; level++) {
+		mesh->lods[level] = map_section(&cursor, header->num_lod_faces[level], sizeof(face_t));
+	}
+	mesh->faces = mesh->lods[0];
+	mesh->bvh.nodes = map_section(&cursor, header->num_bvh_nodes, sizeof(mesh_bvh_node_t));
+	mesh->bvh.num_nodes = header->num_bvh_nodes;
+	mesh->bvh.triangles = map_section(&cursor, header->num_bvh_triangles, sizeof(mesh_bvh_triangle_t));
+	mesh->bvh.num_triangles = header->num_bvh_triangles;
+
+	mesh->bounds_min = vec3_new(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+	mesh->bounds_max = vec3_new(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+	mesh->bounds_center = vec3_new(header->bounds_center[0], header->bounds_center[1], header->bounds_center[2]);
+	mesh->bounds_radius = header->bounds_radius;
+	mesh->order_stats = header->order_stats;
+	mesh->cache_file = file;
+	return true;
+}
+
+// Writes everything load_mesh computes from the OBJ file, in the layout loading expects
+bool save_mesh_cache(const mesh_t* mesh, const char* cache_filename, const char* obj_filename) {
+	mesh_cache_header_t header = {
+		.magic = MESH_CACHE_MAGIC,
+		.version = MESH_CACHE_VERSION,
+		.flags =
+			(mesh->packed_vertices != NULL ? MESH_CACHE_PACKED_VERTICES : 0) |
+			(mesh->packed_uvs != NULL ? MESH_CACHE_PACKED_UVS : 0),
+		.bounds_min = { mesh->bounds_min.x, mesh->bounds_min.y, mesh->bounds_min.z },
+		.bounds_max = { mesh->bounds_max.x, mesh->bounds_max.y, mesh->bounds_max.z },
+		.bounds_center = { mesh->bounds_center.x, mesh->bounds_center.y, mesh->bounds_center.z },
+		.bounds_radius = mesh->bounds_radius,
+		.num_vertices = get_mesh_num_vertices(mesh),
+		.num_lods = mesh->num_lods,
+		.num_bvh_nodes = mesh->bvh.num_nodes,
+		.num_bvh_triangles = mesh->bvh.num_triangles,
+		.order_stats = mesh->order_stats
+	};
+	if (!get_source_info(obj_filename, &header.source_size, &header.source_mtime)) {
+		return false;
+	}
+	for (int level = 0; level < mesh->num_lods; level++) {
+		header.num_lod_faces[level] = array_length(mesh->lods[level]);
+	}
+
+	// Written next to the cache and moved over it, other processes may have the old one mapped
+	char temp_filename[MESH_CACHE_MAX_FILENAME_LENGTH];
+	snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", cache_filename);
+	FILE* fp = fopen(temp_filename, "wb");
+	if (fp == NULL) {
+		return false;
+	}
+	static const char padding[MESH_CACHE_ALIGNMENT] = { 0 };
+	size_t padding_size = align_size(sizeof(header)) - sizeof(header);
+	bool written =
+		fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		fwrite(padding, 1, padding_size, fp) == padding_size &&
+		(mesh->packed_vertices != NULL ?
+			write_section(fp, mesh->packed_vertices, header.num_vertices, sizeof(packed_vec3_t)) :
+			write_section(fp, mesh->vertices, header.num_vertices, sizeof(vec3_t))) &&
+		(mesh->packed_uvs != NULL ?
+			write_section(fp, mesh->packed_uvs, header.num_vertices, sizeof(packed_tex2_t)) :
+			write_section(fp, mesh->uvs, header.num_vertices, sizeof(tex2_t)));
+	for (int level = 0; level < mesh->num_lods; level++) {
+		written = written && write_section(fp, mesh->lods[level], header.num_lod_faces[level], sizeof(face_t));
+	}
+	written = written &&
+		write_section(fp, mesh->bvh.nodes, header.num_bvh_nodes, sizeof(mesh_bvh_node_t)) &&
+		write_section(fp, mesh->bvh.triangles, header.num_bvh_triangles, sizeof(mesh_bvh_triangle_t));
+
+	// A partial cache would only fail the size check on the next load, but don't leave one around
+	if (fclose(fp) != 0 || !written || !replace_file(temp_filename, cache_filename)) {
+		remove(temp_filename);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,20 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <stdbool.h>
+#include "mesh.h"
+
+// Binary copy of a loaded mesh, written next to its OBJ file with this extension
+#define MESH_CACHE_EXTENSION ".mesh"
+#define MESH_CACHE_MAGIC 0x4853454D	// "MESH"
+// Bump whenever the header or any of the stored structs change
+#define MESH_CACHE_VERSION 4
+// Flags for the vertex arrays stored in 16 bits, see mesh_quantize.c
+#define MESH_CACHE_PACKED_VERTICES 1
+#define MESH_CACHE_PACKED_UVS 2
+
+void get_mesh_cache_filename(char* cache_filename, int size, const char* obj_filename);
+bool load_mesh_cache(mesh_t* mesh, const char* cache_filename, const char* obj_filename, bool quantized);
+bool save_mesh_cache(const mesh_t* mesh, const char* cache_filename, const char* obj_filename);
+
+#endif // !MESH_CACHE_H
@@ -0,0 +1,434 @@
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "mesh_optimize.h"
+
+typedef struct {
+	int first;				// faces of a cluster are contiguous, from first up to the next cluster
+	int count;
+	float sort_key;			// how much the cluster faces away from the center of the mesh
+} face_cluster_t;
+
+void vertex_cache_clear(vertex_cache_t* cache) {
+	memset(cache->indices, -1, sizeof(cache->indices));
+	cache->next = 0;
+}
+
+// Entry of a vertex, true if it was there already. On a miss the vertex takes
+// the place of the oldest one and has to be written to vertices[slot].
+bool vertex_cache_access(vertex_cache_t* cache, int index, int* slot) {
+	for (int i = 0; i < VERTEX_CACHE_SIZE; i++) {
+		if (cache->indices[i] == index) {
+			*slot = i;
+			return true;
+		}
+	}
+	*slot = cache->next;
+	cache->indices[cache->next] = index;
+	cache->next = (cache->next + 1) % VERTEX_CACHE_SIZE;
+	return false;
+}
+
+static int count_cache_misses(vertex_cache_t* cache, const face_t* face) {
+	int slot;
+	return
+		!vertex_cache_access(cache, face->a, &slot) +
+		!vertex_cache_access(cache, face->b, &slot) +
+		!vertex_cache_access(cache, face->c, &slot);
+}
+
+// Average cache miss ratio, vertices transformed per face. 3 without any
+// reuse, around 0.5 at best for regular meshes.
+float compute_acmr(const face_t* faces, int num_faces) {
+	if (num_faces == 0) {
+		return 0;
+	}
+	vertex_cache_t cache;
+	vertex_cache_clear(&cache);
+	int misses = 0;
+	for (int f = 0; f < num_faces; f++) {
+		misses += count_cache_misses(&cache, &faces[f]);
+	}
+	return (float)misses / num_faces;
+}
+
+// Depth tests one face in a view, x and y in pixels and z growing away from it
+static void rasterize_overdraw(float* depth, const float x[3], const float y[3], const float z[3], long* shaded, long* covered) {
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0) {
+		return;
+	}
+
+	// Weights of the corners and depth, and how the depth changes one pixel right
+	float dw0 = -(y[2] - y[1]) / area;
+	float dw1 = -(y[0] - y[2]) / area;
+	float dd = dw0 * z[0] + dw1 * z[1] - (dw0 + dw1) * z[2];
+
+	int y0 = (int)fmaxf(0, ceilf(fminf(y[0], fminf(y[1], y[2]))));
+	int y1 = (int)fminf(OVERDRAW_VIEW_SIZE - 1, floorf(fmaxf(y[0], fmaxf(y[1], y[2]))));
+	for (int py = y0; py <= y1; py++) {
+		// Along a row the weights are linear in x, so each one bounds the span
+		// instead of testing the whole bounding box, which thin faces make big
+		float start = 0;
+		float end = OVERDRAW_VIEW_SIZE - 1;
+		for (int e = 0; e < 3; e++) {
+			int p = (e + 1) % 3;
+			int q = (e + 2) % 3;
+			float slope = -(y[q] - y[p]) / area;
+			float offset = ((x[q] - x[p]) * (py - y[p]) + (y[q] - y[p]) * x[p]) / area;
+			if (slope > 0) {
+				start = fmaxf(start, -offset / slope);
+			}
+			else if (slope < 0) {
+				end = fminf(end, -offset / slope);
+			}
+			else if (offset < 0) {
+				end = -1;
+			}
+		}
+		int x0 = (int)ceilf(start);
+		int x1 = (int)floorf(end);
+		if (x0 > x1) {
+			continue;
+		}
+
+		float w0 = ((x[2] - x[1]) * (py - y[1]) - (y[2] - y[1]) * (x0 - x[1])) / area;
+		float w1 = ((x[0] - x[2]) * (py - y[2]) - (y[0] - y[2]) * (x0 - x[2])) / area;
+		float d = w0 * z[0] + w1 * z[1] + (1 - w0 - w1) * z[2];
+		float* pixel = &depth[py * OVERDRAW_VIEW_SIZE + x0];
+		for (int px = x0; px <= x1; px++, pixel++, d += dd) {
+			if (d < *pixel) {
+				*covered += *pixel == FLT_MAX;
+				*pixel = d;
+				(*shaded)++;
+			}
+		}
+	}
+}
+
+// Depth tested pixels the faces shade, over the pixels they cover, from the
+// six directions along the axes. 1 means every pixel is shaded only once.
+float compute_overdraw(const vec3_t* vertices, const face_t* faces, int num_faces) {
+	vec3_t min = vec3_new(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3_t max = vec3_new(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	double projected_area = 0;
+	for (int f = 0; f < num_faces; f++) {
+		vec3_t p[3] = { vertices[faces[f].a], vertices[faces[f].b], vertices[faces[f].c] };
+		for (int j = 0; j < 3; j++) {
+			min = vec3_new(fminf(min.x, p[j].x), fminf(min.y, p[j].y), fminf(min.z, p[j].z));
+			max = vec3_new(fmaxf(max.x, p[j].x), fmaxf(max.y, p[j].y), fmaxf(max.z, p[j].z));
+		}
+		vec3_t normal = vec3_cross(vec3_sub(p[1], p[0]), vec3_sub(p[2], p[0]));
+		projected_area += (fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z)) * 0.5;
+	}
+	float extent = fmaxf(max.x - min.x, fmaxf(max.y - min.y, max.z - min.z));
+	if (num_faces == 0 || extent <= 0) {
+		return 1;
+	}
+
+	// Large faces over each other would take long to rasterize at full size,
+	// the views get smaller until the faces cover at most a budget of pixels
+	float view_size = OVERDRAW_VIEW_SIZE - 1;
+	projected_area /= (double)extent * extent;
+	if (projected_area * view_size * view_size > OVERDRAW_MAX_PIXELS) {
+		view_size = fmaxf(sqrtf(OVERDRAW_MAX_PIXELS / projected_area), 1);
+	}
+	float scale = view_size / extent;
+
+	// All six views are drawn at once so the vertices are only read once
+	int view_pixels = OVERDRAW_VIEW_SIZE * OVERDRAW_VIEW_SIZE;
+	float* depth = malloc(sizeof(float) * view_pixels * 6);
+	for (int i = 0; i < view_pixels * 6; i++) {
+		depth[i] = FLT_MAX;
+	}
+	long shaded = 0;
+	long covered = 0;
+	for (int f = 0; f < num_faces; f++) {
+		float c[3][3];
+		vec3_t p[3] = { vertices[faces[f].a], vertices[faces[f].b], vertices[faces[f].c] };
+		for (int j = 0; j < 3; j++) {
+			c[j][0] = p[j].x - min.x;
+			c[j][1] = p[j].y - min.y;
+			c[j][2] = p[j].z - min.z;
+		}
+		vec3_t normal = vec3_cross(vec3_sub(p[1], p[0]), vec3_sub(p[2], p[0]));
+		float n[3] = { normal.x, normal.y, normal.z };
+
+		for (int view = 0; view < 6; view++) {
+			int axis = view / 2;
+			float direction = (view % 2) ? -1 : 1;
+
+			// Faces looking away from the view are culled like the renderer does
+			if (n[axis] * direction > 0) {
+				continue;
+			}
+			float x[3], y[3], z[3];
+			for (int j = 0; j < 3; j++) {
+				x[j] = c[j][(axis + 1) % 3] * scale;
+				y[j] = c[j][(axis + 2) % 3] * scale;
+				z[j] = c[j][axis] * direction;
+			}
+			rasterize_overdraw(depth + view * view_pixels, x, y, z, &shaded, &covered);
+		}
+	}
+	free(depth);
+	return covered > 0 ? (float)shaded / covered : 1;
+}
+
+// Tipsify (Sander et al. 2007): fans out around one vertex at a time, moving
+// on to the neighbor that stays longest in the cache. Writes the reordered
+// faces to result and returns the faces where the cache had to start over,
+// as a dynamic array.
+static int* tipsify(const face_t* faces, int num_faces, int num_vertices, face_t* result) {
+	int* offsets = calloc(num_vertices + 1, sizeof(int));
+	for (int f = 0; f < num_faces; f++) {
+		offsets[faces[f].a + 1]++;
+		offsets[faces[f].b + 1]++;
+		offsets[faces[f].c + 1]++;
+	}
+	int max_valence = 0;
+	for (int v = 0; v < num_vertices; v++) {
+		max_valence = offsets[v + 1] > max_valence ? offsets[v + 1] : max_valence;
+		offsets[v + 1] += offsets[v];
+	}
+	int* vertex_faces = malloc(sizeof(int) * 3 * (num_faces > 0 ? num_faces : 1));
+	int* live = malloc(sizeof(int) * (num_vertices > 0 ? num_vertices : 1));
+	for (int v = 0; v < num_vertices; v++) {
+		live[v] = offsets[v];
+	}
+	for (int f = 0; f < num_faces; f++) {
+		vertex_faces[live[faces[f].a]++] = f;
+		vertex_faces[live[faces[f].b]++] = f;
+		vertex_faces[live[faces[f].c]++] = f;
+	}
+	for (int v = 0; v < num_vertices; v++) {
+		live[v] = offsets[v + 1] - offsets[v];
+	}
+
+	int* cache_time = calloc(num_vertices > 0 ? num_vertices : 1, sizeof(int));
+	bool* emitted = calloc(num_faces > 0 ? num_faces : 1, sizeof(bool));
+	int* dead_end = malloc(sizeof(int) * 3 * (num_faces > 0 ? num_faces : 1));
+	int* candidates = malloc(sizeof(int) * 3 * (max_valence > 0 ? max_valence : 1));
+	int* restarts = NULL;
+	int num_dead_end = 0;
+	int num_emitted = 0;
+	int time = VERTEX_CACHE_SIZE + 1;
+	int cursor = 0;
+
+	while (cursor < num_vertices && live[cursor] == 0) cursor++;
+	int fanning = cursor < num_vertices ? cursor : -1;
+	if (fanning >= 0) {
+		array_push(restarts, 0);
+	}
+
+	while (fanning >= 0) {
+		// Every face left around the vertex is emitted
+		int num_candidates = 0;
+		for (int i = offsets[fanning]; i < offsets[fanning + 1]; i++) {
+			int f = vertex_faces[i];
+			if (emitted[f]) continue;
+			int corners[3] = { faces[f].a, faces[f].b, faces[f].c };
+			for (int j = 0; j < 3; j++) {
+				int v = corners[j];
+				dead_end[num_dead_end++] = v;
+				candidates[num_candidates++] = v;
+				live[v]--;
+				if (time - cache_time[v] > VERTEX_CACHE_SIZE) {
+					cache_time[v] = time++;
+				}
+			}
+			emitted[f] = true;
+			result[num_emitted++] = faces[f];
+		}
+
+		// The next vertex is the one that will still be cached when its faces are
+		// emitted, preferring the oldest so it gets used before it leaves
+		int best = -1;
+		int best_priority = -1;
+		for (int i = 0; i < num_candidates; i++) {
+			int v = candidates[i];
+			if (live[v] == 0) continue;
+			int priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= VERTEX_CACHE_SIZE) {
+				priority = time - cache_time[v];
+			}
+			if (priority > best_priority) {
+				best = v;
+				best_priority = priority;
+			}
+		}
+
+		// Dead end, go back to a recent vertex with faces left, or to any
+		if (best < 0) {
+			while (num_dead_end > 0 && best < 0) {
+				int v = dead_end[--num_dead_end];
+				if (live[v] > 0) best = v;
+			}
+			while (best < 0 && cursor < num_vertices) {
+				if (live[cursor] > 0) best = cursor;
+				else cursor++;
+			}
+			if (best >= 0) {
+				array_push(restarts, num_emitted);
+			}
+		}
+		fanning = best;
+	}
+
+	free(candidates);
+	free(dead_end);
+	free(emitted);
+	free(cache_time);
+	free(live);
+	free(vertex_faces);
+	free(offsets);
+	return restarts;
+}
+
+static int compare_clusters(const void* a, const void* b) {
+	const face_cluster_t* ca = a;
+	const face_cluster_t* cb = b;
+	return (ca->sort_key < cb->sort_key) - (ca->sort_key > cb->sort_key);
+}
+
+// Cuts the runs between cache restarts into smaller clusters where that
+// costs little cache efficiency, then draws the clusters that face outwards
+// first so they hide the rest of the mesh (Sander et al. 2007)
+static void sort_clusters_for_overdraw(const vec3_t* vertices, face_t* faces, int num_faces, int* restarts) {
+	face_cluster_t* clusters = NULL;
+	vertex_cache_t cache;
+	for (int r = 0; r < array_length(restarts); r++) {
+		int first = restarts[r];
+		int end = (r + 1 < array_length(restarts)) ? restarts[r + 1] : num_faces;
+		float threshold = compute_acmr(faces + first, end - first) * OVERDRAW_ACMR_THRESHOLD;
+
+		vertex_cache_clear(&cache);
+		int misses = 0;
+		int piece = first;
+		for (int f = first; f < end; f++) {
+			misses += count_cache_misses(&cache, &faces[f]);
+			if ((float)misses / (f + 1 - piece) <= threshold || f + 1 == end) {
+				face_cluster_t cluster = { piece, f + 1 - piece, 0 };
+				array_push(clusters, cluster);
+				vertex_cache_clear(&cache);
+				misses = 0;
+				piece = f + 1;
+			}
+		}
+	}
+
+	// Area weighted centers and normals of the clusters and of the whole mesh
+	vec3_t mesh_center = vec3_new(0, 0, 0);
+	float mesh_area = 0;
+	vec3_t* centers = malloc(sizeof(vec3_t) * (array_length(clusters) + 1));
+	vec3_t* normals = malloc(sizeof(vec3_t) * (array_length(clusters) + 1));
+	for (int c = 0; c < array_length(clusters); c++) {
+		vec3_t center = vec3_new(0, 0, 0);
+		vec3_t normal = vec3_new(0, 0, 0);
+		float area = 0;
+		for (int f = clusters[c].first; f < clusters[c].first + clusters[c].count; f++) {
+			vec3_t p0 = vertices[faces[f].a];
+			vec3_t p1 = vertices[faces[f].b];
+			vec3_t p2 = vertices[faces[f].c];
+			vec3_t cross = vec3_cross(vec3_sub(p1, p0), vec3_sub(p2, p0));
+			float face_area = vec3_length(cross) * 0.5;
+			vec3_t face_center = vec3_div(vec3_add(vec3_add(p0, p1), p2), 3);
+			center = vec3_add(center, vec3_mul(face_center, face_area));
+			normal = vec3_add(normal, cross);
+			area += face_area;
+		}
+		mesh_center = vec3_add(mesh_center, center);
+		mesh_area += area;
+		centers[c] = (area > 0) ? vec3_div(center, area) : vertices[faces[clusters[c].first].a];
+		normals[c] = normal;
+	}
+	if (mesh_area > 0) {
+		mesh_center = vec3_div(mesh_center, mesh_area);
+	}
+	for (int c = 0; c < array_length(clusters); c++) {
+		float length = vec3_length(normals[c]);
+		clusters[c].sort_key = (length > 0) ? vec3_dot(vec3_sub(centers[c], mesh_center), normals[c]) / length : 0;
+	}
+	qsort(clusters, array_length(clusters), sizeof(face_cluster_t), compare_clusters);
+
+	face_t* sorted = malloc(sizeof(face_t) * (num_faces > 0 ? num_faces : 1));
+	face_t* face = sorted;
+	for (int c = 0; c < array_length(clusters); c++) {
+		memcpy(face, faces + clusters[c].first, sizeof(face_t) * clusters[c].count);
+		face += clusters[c].count;
+	}
+	memcpy(faces, sorted, sizeof(face_t) * num_faces);
+
+	free(sorted);
+	free(normals);
+	free(centers);
+	array_free(clusters);
+}
+
+// Renumbers the vertices in the order the faces first use them, so the
+// vertex fetches of consecutive faces stay close in memory
+static void remap_vertex_fetch(mesh_t* mesh) {
+	int num_vertices = array_length(mesh->vertices);
+	if (num_vertices == 0) {
+		return;
+	}
+	int* remap = malloc(sizeof(int) * num_vertices);
+	memset(remap, -1, sizeof(int) * num_vertices);
+	int next = 0;
+	for (int level = 0; level < mesh->num_lods; level++) {
+		face_t* faces = mesh->lods[level];
+		for (int f = 0; f < array_length(faces); f++) {
+			int* corners[3] = { &faces[f].a, &faces[f].b, &faces[f].c };
+			for (int j = 0; j < 3; j++) {
+				if (remap[*corners[j]] < 0) {
+					remap[*corners[j]] = next++;
+				}
+				*corners[j] = remap[*corners[j]];
+			}
+		}
+	}
+
+	// Vertices no face uses go last
+	vec3_t* vertices = array_hold(NULL, num_vertices, sizeof(vec3_t));
+	tex2_t* uvs = array_hold(NULL, num_vertices, sizeof(tex2_t));
+	for (int v = 0; v < num_vertices; v++) {
+		if (remap[v] < 0) {
+			remap[v] = next++;
+		}
+		vertices[remap[v]] = mesh->vertices[v];
+		uvs[remap[v]] = mesh->uvs[v];
+	}
+	array_free(mesh->vertices);
+	array_free(mesh->uvs);
+	mesh->vertices = vertices;
+	mesh->uvs = uvs;
+	free(remap);
+}
+
+// Reorders the faces of every level of detail for the vertex cache, the full
+// detail ones also for less overdraw, then the vertices for the faces. The
+// triangles stay the same, as do the statistics in mesh->order_stats.
+void optimize_mesh_order(mesh_t* mesh) {
+	int num_vertices = array_length(mesh->vertices);
+	mesh->order_stats.acmr_before = compute_acmr(mesh->faces, array_length(mesh->faces));
+	mesh->order_stats.overdraw_before = compute_overdraw(mesh->vertices, mesh->faces, array_length(mesh->faces));
+
+	for (int level = 0; level < mesh->num_lods; level++) {
+		face_t* faces = mesh->lods[level];
+		int num_faces = array_length(faces);
+		face_t* reordered = malloc(sizeof(face_t) * (num_faces > 0 ? num_faces : 1));
+		int* restarts = tipsify(faces, num_faces, num_vertices, reordered);
+		memcpy(faces, reordered, sizeof(face_t) * num_faces);
+		if (level == 0) {
+			sort_clusters_for_overdraw(mesh->vertices, faces, num_faces, restarts);
+		}
+		array_free(restarts);
+		free(reordered);
+	}
+	remap_vertex_fetch(mesh);
+
+	mesh->order_stats.acmr_after = compute_acmr(mesh->faces, array_length(mesh->faces));
+	mesh->order_stats.overdraw_after = compute_overdraw(mesh->vertices, mesh->faces, array_length(mesh->faces));
+}
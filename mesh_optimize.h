@@ -0,0 +1,32 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include <stdbool.h>
+#include "mesh.h"
+#include "vector.h"
+
+// Entries of the transformed vertex cache, both the one faces are ordered
+// for and the one the renderer keeps while it goes through them
+#define VERTEX_CACHE_SIZE 16
+// Clusters are cut wherever a piece has at most this times the cache misses
+// per face of the whole cluster, smaller pieces sort better for overdraw
+#define OVERDRAW_ACMR_THRESHOLD 1.05
+// Resolution of the six axis views the overdraw is measured in
+#define OVERDRAW_VIEW_SIZE 256
+// Pixels the faces may cover in those views, past it the views get smaller
+#define OVERDRAW_MAX_PIXELS (1 << 26)
+
+// First in, first out cache of transformed vertices by mesh vertex index
+typedef struct {
+	int indices[VERTEX_CACHE_SIZE];
+	vec4_t vertices[VERTEX_CACHE_SIZE];
+	int next;				// entry replaced by the next miss
+} vertex_cache_t;
+
+void vertex_cache_clear(vertex_cache_t* cache);
+bool vertex_cache_access(vertex_cache_t* cache, int index, int* slot);
+float compute_acmr(const face_t* faces, int num_faces);
+float compute_overdraw(const vec3_t* vertices, const face_t* faces, int num_faces);
+void optimize_mesh_order(mesh_t* mesh);
+
+#endif // !MESH_OPTIMIZE_H
@@ -0,0 +1,104 @@
+#include <math.h>
+#include "array.h"
+#include "mesh_quantize.h"
+
+static uint16_t quantize(float value) {
+	return (uint16_t)fminf(fmaxf(roundf(value * QUANTIZE_MAX), 0), QUANTIZE_MAX);
+}
+
+// Size of one quantization step along each axis of the bounding box
+static vec3_t get_quantize_step(const mesh_t* mesh) {
+	return vec3_div(vec3_sub(mesh->bounds_max, mesh->bounds_min), QUANTIZE_MAX);
+}
+
+// Replaces the float vertices by 16 bit ones over the bounding box, which has
+// to be computed first, and the texture coordinates by 16 bit fractions when
+// they are all within the texture. Halves the memory the vertices take.
+void quantize_mesh(mesh_t* mesh) {
+	int num_vertices = array_length(mesh->vertices);
+	vec3_t extent = vec3_sub(mesh->bounds_max, mesh->bounds_min);
+
+	mesh->packed_vertices = array_hold(NULL, num_vertices, sizeof(packed_vec3_t));
+	for (int i = 0; i < num_vertices; i++) {
+		vec3_t p = vec3_sub(mesh->vertices[i], mesh->bounds_min);
+		mesh->packed_vertices[i].x = extent.x > 0 ? quantize(p.x / extent.x) : 0;
+		mesh->packed_vertices[i].y = extent.y > 0 ? quantize(p.y / extent.y) : 0;
+		mesh->packed_vertices[i].z = extent.z > 0 ? quantize(p.z / extent.z) : 0;
+	}
+	array_free(mesh->vertices);
+	mesh->vertices = NULL;
+
+	// Tiling textures repeat past 1, those coordinates stay floats
+	for (int i = 0; i < num_vertices; i++) {
+		tex2_t uv = mesh->uvs[i];
+		if (uv.u < 0 || uv.u > 1 || uv.v < 0 || uv.v > 1) {
+			return;
+		}
+	}
+	mesh->packed_uvs = array_hold(NULL, num_vertices, sizeof(packed_tex2_t));
+	for (int i = 0; i < num_vertices; i++) {
+		mesh->packed_uvs[i].u = quantize(mesh->uvs[i].u);
+		mesh->packed_uvs[i].v = quantize(mesh->uvs[i].v);
+	}
+	array_free(mesh->uvs);
+	mesh->uvs = NULL;
+}
+
+bool is_mesh_quantized(const mesh_t* mesh) {
+	return mesh->packed_vertices != NULL;
+}
+
+int get_mesh_num_vertices(const mesh_t* mesh) {
+	return is_mesh_quantized(mesh) ? array_length(mesh->packed_vertices) : array_length(mesh->vertices);
+}
+
+// Memory the positions and texture coordinates take, as stored
+size_t get_mesh_vertex_bytes(const mesh_t* mesh) {
+	size_t num_vertices = get_mesh_num_vertices(mesh);
+	return num_vertices * (
+		(is_mesh_quantized(mesh) ? sizeof(packed_vec3_t) : sizeof(vec3_t)) +
+		(mesh->packed_uvs != NULL ? sizeof(packed_tex2_t) : sizeof(tex2_t))
+	);
+}
+
+// Turns the stored vertices into mesh space ones. Transforms that start from
+// get_mesh_stored_vertex apply it first, so dequantizing costs nothing more.
+mat4_t get_mesh_dequantize_matrix(const mesh_t* mesh) {
+	if (!is_mesh_quantized(mesh)) {
+		return mat4_identity();
+	}
+	vec3_t step = get_quantize_step(mesh);
+	mat4_t scale_matrix = mat4_make_scale(step.x, step.y, step.z);
+	mat4_t translation_matrix = mat4_make_translation(mesh->bounds_min.x, mesh->bounds_min.y, mesh->bounds_min.z);
+	return mat4_mul_mat4(translation_matrix, scale_matrix);
+}
+
+// Vertex as it is stored, in quantization steps for a quantized mesh
+vec4_t get_mesh_stored_vertex(const mesh_t* mesh, int index) {
+	if (is_mesh_quantized(mesh)) {
+		packed_vec3_t p = mesh->packed_vertices[index];
+		return vec4_from_vec3(vec3_new(p.x, p.y, p.z));
+	}
+	return vec4_from_vec3(mesh->vertices[index]);
+}
+
+vec3_t get_mesh_vertex(const mesh_t* mesh, int index) {
+	if (is_mesh_quantized(mesh)) {
+		packed_vec3_t p = mesh->packed_vertices[index];
+		vec3_t step = get_quantize_step(mesh);
+		return vec3_new(
+			mesh->bounds_min.x + p.x * step.x,
+			mesh->bounds_min.y + p.y * step.y,
+			mesh->bounds_min.z + p.z * step.z
+		);
+	}
+	return mesh->vertices[index];
+}
+
+tex2_t get_mesh_uv(const mesh_t* mesh, int index) {
+	if (mesh->packed_uvs != NULL) {
+		packed_tex2_t uv = mesh->packed_uvs[index];
+		return (tex2_t) { (float)uv.u / QUANTIZE_MAX, (float)uv.v / QUANTIZE_MAX };
+	}
+	return mesh->uvs[index];
+}
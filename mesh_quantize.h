@@ -0,0 +1,22 @@
+#ifndef MESH_QUANTIZE_H
+#define MESH_QUANTIZE_H
+
+#include <stdbool.h>
+#include "matrix.h"
+#include "mesh.h"
+#include "texture.h"
+#include "vector.h"
+
+// Largest 16 bit value, the quantized bounds of the box and texture
+#define QUANTIZE_MAX 65535
+
+void quantize_mesh(mesh_t* mesh);
+bool is_mesh_quantized(const mesh_t* mesh);
+int get_mesh_num_vertices(const mesh_t* mesh);
+size_t get_mesh_vertex_bytes(const mesh_t* mesh);
+mat4_t get_mesh_dequantize_matrix(const mesh_t* mesh);
+vec4_t get_mesh_stored_vertex(const mesh_t* mesh, int index);
+vec3_t get_mesh_vertex(const mesh_t* mesh, int index);
+tex2_t get_mesh_uv(const mesh_t* mesh, int index);
+
+#endif // !MESH_QUANTIZE_H
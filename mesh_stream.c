@@ -0,0 +1,492 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "array.h"
+#include "load_pool.h"
+#include "mesh_optimize.h"
+#include "mesh_stream.h"
+
+#ifdef _WIN32
+#define stat _stat64
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	float bounds_min[3];
+	float bounds_max[3];
+	float bounds_center[3];
+	float bounds_radius;
+	int32_t num_chunks;
+} mesh_stream_header_t;
+
+// Follows the header once per chunk, the chunk data comes after all of them
+typedef struct {
+	float bounds_min[3];
+	float bounds_max[3];
+	uint64_t offset;
+	int32_t num_vertices;
+	int32_t num_faces;
+} mesh_stream_chunk_header_t;
+
+// A chunk asked for and not in memory, in the order the reads are started
+typedef struct {
+	mesh_chunk_t* chunk;
+	float priority;
+} chunk_request_t;
+
+// Residency is shared by all the open streams, the budget is for the process
+static mesh_stream_t* streams[MAX_NUM_MESH_STREAMS];
+static int num_streams = 0;
+static chunk_request_t* requests = NULL;	// room for a request per chunk of every stream
+static int num_stream_chunks = 0;
+static size_t budget = MESH_STREAM_DEFAULT_BUDGET;
+static size_t resident_bytes = 0;			// chunks in memory and being read
+static size_t peak_resident_bytes = 0;
+static int frame = 0;
+
+static float vec3_axis(vec3_t v, int axis) {
+	return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static size_t get_chunk_bytes(const mesh_chunk_t* chunk) {
+	return (size_t)chunk->num_vertices * (sizeof(vec3_t) + sizeof(tex2_t)) + (size_t)chunk->num_faces * sizeof(face_t);
+}
+
+// Name of the chunked file for an OBJ file, its extension replaced by the stream one
+void get_mesh_stream_filename(char* stream_filename, int size, const char* obj_filename) {
+	int length = (int)strlen(obj_filename);
+	if (length >= 4 && strcmp(obj_filename + length - 4, ".obj") == 0) {
+		length -= 4;
+	}
+	snprintf(stream_filename, size, "%.*s%s", length, obj_filename, MESH_STREAM_EXTENSION);
+}
+
+// Quickselect, the faces in order before middle end up with centers no further
+// along the axis than the ones from middle on
+static void select_median(const vec3_t* centers, int* order, int count, int middle, int axis) {
+	int first = 0;
+	int last = count - 1;
+	while (first < last) {
+		float pivot = vec3_axis(centers[order[(first + last) / 2]], axis);
+		int i = first;
+		int j = last;
+		while (i <= j) {
+			while (vec3_axis(centers[order[i]], axis) < pivot) i++;
+			while (vec3_axis(centers[order[j]], axis) > pivot) j--;
+			if (i <= j) {
+				int swap = order[i];
+				order[i++] = order[j];
+				order[j--] = swap;
+			}
+		}
+		if (middle <= j) {
+			last = j;
+		}
+		else if (middle >= i) {
+			first = i;
+		}
+		else {
+			return;
+		}
+	}
+}
+
+// Halves the faces along the longest side of their centers until they fit in
+// a chunk, so each chunk covers a compact region. Appends the first face of
+// every chunk, in the order they are written.
+static void split_chunks(const vec3_t* centers, int* order, int first, int count, int** chunk_starts) {
+	if (count <= MESH_STREAM_CHUNK_FACES) {
+		array_push(*chunk_starts, first);
+		return;
+	}
+	vec3_t min = centers[order[first]];
+	vec3_t max = min;
+	for (int i = first + 1; i < first + count; i++) {
+		vec3_t c = centers[order[i]];
+		min = vec3_new(fminf(min.x, c.x), fminf(min.y, c.y), fminf(min.z, c.z));
+		max = vec3_new(fmaxf(max.x, c.x), fmaxf(max.y, c.y), fmaxf(max.z, c.z));
+	}
+	vec3_t extent = vec3_sub(max, min);
+	int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+	int half = count / 2;
+	select_median(centers, order + first, count, half, axis);
+	split_chunks(centers, order, first, half, chunk_starts);
+	split_chunks(centers, order, first + half, count - half, chunk_starts);
+}
+
+// Copies the faces into a mesh of their own, with the vertices they use
+// renumbered from zero and reordered for the vertex cache
+static void build_chunk_mesh(mesh_t* chunk, const mesh_t* mesh, const int* order, int num_faces, int* local_indices) {
+	memset(chunk, 0, sizeof(mesh_t));
+	for (int f = 0; f < num_faces; f++) {
+		face_t face = mesh->faces[order[f]];
+		int* corners[3] = { &face.a, &face.b, &face.c };
+		for (int j = 0; j < 3; j++) {
+			int index = *corners[j];
+			if (local_indices[index] < 0) {
+				local_indices[index] = array_length(chunk->vertices);
+				array_push(chunk->vertices, mesh->vertices[index]);
+				array_push(chunk->uvs, mesh->uvs[index]);
+			}
+			*corners[j] = local_indices[index];
+		}
+		array_push(chunk->faces, face);
+	}
+	chunk->lods[0] = chunk->faces;
+	chunk->num_lods = 1;
+	compute_mesh_bounds(chunk);
+	optimize_mesh_order(chunk);
+
+	// Ready for the next chunk
+	for (int f = 0; f < num_faces; f++) {
+		face_t face = mesh->faces[order[f]];
+		local_indices[face.a] = local_indices[face.b] = local_indices[face.c] = -1;
+	}
+}
+
+static void free_chunk_mesh(mesh_t* chunk) {
+	array_free(chunk->vertices);
+	array_free(chunk->uvs);
+	array_free(chunk->faces);
+	memset(chunk, 0, sizeof(mesh_t));
+}
+
+static void set_floats(float* values, vec3_t v) {
+	values[0] = v.x;
+	values[1] = v.y;
+	values[2] = v.z;
+}
+
+// Splits a whole mesh into chunks, written one after the other so the ones
+// next to each other in space are next to each other in the file. Needs the
+// mesh in memory once, the renderer then only keeps the chunks it draws.
+bool save_mesh_stream(mesh_t* mesh, const char* stream_filename) {
+	int num_vertices = array_length(mesh->vertices);
+	int num_faces = array_length(mesh->faces);
+	if (num_faces == 0 || array_length(mesh->uvs) != num_vertices) {
+		return false;
+	}
+
+	vec3_t* centers = malloc(sizeof(vec3_t) * num_faces);
+	int* order = malloc(sizeof(int) * num_faces);
+	for (int f = 0; f < num_faces; f++) {
+		face_t face = mesh->faces[f];
+		centers[f] = vec3_mul(vec3_add(vec3_add(mesh->vertices[face.a], mesh->vertices[face.b]), mesh->vertices[face.c]), 1.0f / 3);
+		order[f] = f;
+	}
+	int* chunk_starts = NULL;
+	split_chunks(centers, order, 0, num_faces, &chunk_starts);
+	int num_chunks = array_length(chunk_starts);
+	free(centers);
+
+	mesh_stream_header_t header = {
+		.magic = MESH_STREAM_MAGIC,
+		.version = MESH_STREAM_VERSION,
+		.bounds_radius = mesh->bounds_radius,
+		.num_chunks = num_chunks
+	};
+	set_floats(header.bounds_min, mesh->bounds_min);
+	set_floats(header.bounds_max, mesh->bounds_max);
+	set_floats(header.bounds_center, mesh->bounds_center);
+	mesh_stream_chunk_header_t* chunk_headers = calloc(num_chunks, sizeof(mesh_stream_chunk_header_t));
+
+	FILE* fp = fopen(stream_filename, "wb");
+	bool written = fp != NULL;
+
+	// The chunk headers are written last, once the offsets are known
+	uint64_t offset = sizeof(header) + sizeof(mesh_stream_chunk_header_t) * (uint64_t)num_chunks;
+	written = written && fseek64(fp, (long long)offset, SEEK_SET) == 0;
+
+	int* local_indices = malloc(sizeof(int) * (num_vertices > 0 ? num_vertices : 1));
+	for (int i = 0; i < num_vertices; i++) {
+		local_indices[i] = -1;
+	}
+	for (int c = 0; c < num_chunks && written; c++) {
+		int first = chunk_starts[c];
+		int count = (c + 1 < num_chunks ? chunk_starts[c + 1] : num_faces) - first;
+		mesh_t chunk;
+		build_chunk_mesh(&chunk, mesh, order + first, count, local_indices);
+
+		mesh_stream_chunk_header_t* chunk_header = &chunk_headers[c];
+		set_floats(chunk_header->bounds_min, chunk.bounds_min);
+		set_floats(chunk_header->bounds_max, chunk.bounds_max);
+		chunk_header->offset = offset;
+		chunk_header->num_vertices = array_length(chunk.vertices);
+		chunk_header->num_faces = array_length(chunk.faces);
+		written =
+			fwrite(chunk.vertices, sizeof(vec3_t), chunk_header->num_vertices, fp) == (size_t)chunk_header->num_vertices &&
+			fwrite(chunk.uvs, sizeof(tex2_t), chunk_header->num_vertices, fp) == (size_t)chunk_header->num_vertices &&
+			fwrite(chunk.faces, sizeof(face_t), chunk_header->num_faces, fp) == (size_t)chunk_header->num_faces;
+		offset += (uint64_t)chunk_header->num_vertices * (sizeof(vec3_t) + sizeof(tex2_t)) + (uint64_t)chunk_header->num_faces * sizeof(face_t);
+		free_chunk_mesh(&chunk);
+	}
+	free(local_indices);
+	free(order);
+	array_free(chunk_starts);
+
+	written = written &&
+		fseek64(fp, 0, SEEK_SET) == 0 &&
+		fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		fwrite(chunk_headers, sizeof(mesh_stream_chunk_header_t), num_chunks, fp) == (size_t)num_chunks;
+	free(chunk_headers);
+
+	// Don't leave a partial file around, it would only fail to open later
+	if (fp == NULL || fclose(fp) != 0 || !written) {
+		remove(stream_filename);
+		return false;
+	}
+	printf("Saved %s: %d chunks of up to %d faces\n", stream_filename, num_chunks, MESH_STREAM_CHUNK_FACES);
+	return true;
+}
+
+// Reads the bounds of every chunk, none of the faces. Fails for a missing or
+// damaged file, or one with chunks past its end.
+mesh_stream_t* open_mesh_stream(const char* filename) {
+	struct stat info;
+	if (num_streams == MAX_NUM_MESH_STREAMS || stat(filename, &info) != 0) {
+		return NULL;
+	}
+	uint64_t file_size = (uint64_t)info.st_size;
+	FILE* fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		return NULL;
+	}
+	mesh_stream_header_t header;
+	bool valid =
+		fread(&header, sizeof(header), 1, fp) == 1 &&
+		header.magic == MESH_STREAM_MAGIC &&
+		header.version == MESH_STREAM_VERSION &&
+		header.num_chunks > 0 &&
+		sizeof(header) + sizeof(mesh_stream_chunk_header_t) * (uint64_t)header.num_chunks <= file_size;
+
+	mesh_stream_chunk_header_t* chunk_headers = NULL;
+	if (valid) {
+		chunk_headers = malloc(sizeof(mesh_stream_chunk_header_t) * header.num_chunks);
+		valid = fread(chunk_headers, sizeof(mesh_stream_chunk_header_t), header.num_chunks, fp) == (size_t)header.num_chunks;
+	}
+	fclose(fp);
+	for (int c = 0; valid && c < header.num_chunks; c++) {
+		mesh_stream_chunk_header_t* chunk_header = &chunk_headers[c];
+		uint64_t size = (uint64_t)chunk_header->num_vertices * (sizeof(vec3_t) + sizeof(tex2_t)) + (uint64_t)chunk_header->num_faces * sizeof(face_t);
+		valid = chunk_header->num_vertices > 0 && chunk_header->num_faces > 0 &&
+			chunk_header->offset <= file_size && size <= file_size - chunk_header->offset;
+	}
+	if (!valid) {
+		free(chunk_headers);
+		return NULL;
+	}
+
+	mesh_stream_t* stream = calloc(1, sizeof(mesh_stream_t));
+	snprintf(stream->filename, sizeof(stream->filename), "%s", filename);
+	stream->bounds_min = vec3_new(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]);
+	stream->bounds_max = vec3_new(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]);
+	stream->bounds_center = vec3_new(header.bounds_center[0], header.bounds_center[1], header.bounds_center[2]);
+	stream->bounds_radius = header.bounds_radius;
+	stream->num_chunks = header.num_chunks;
+	stream->chunks = calloc(header.num_chunks, sizeof(mesh_chunk_t));
+	for (int c = 0; c < header.num_chunks; c++) {
+		mesh_stream_chunk_header_t* chunk_header = &chunk_headers[c];
+		mesh_chunk_t* chunk = &stream->chunks[c];
+		chunk->stream = stream;
+		chunk->bounds_min = vec3_new(chunk_header->bounds_min[0], chunk_header->bounds_min[1], chunk_header->bounds_min[2]);
+		chunk->bounds_max = vec3_new(chunk_header->bounds_max[0], chunk_header->bounds_max[1], chunk_header->bounds_max[2]);
+		chunk->offset = chunk_header->offset;
+		chunk->num_vertices = chunk_header->num_vertices;
+		chunk->num_faces = chunk_header->num_faces;
+		chunk->requested_frame = -1;
+		SDL_AtomicSet(&chunk->state, CHUNK_EVICTED);
+		make_box_mesh(&chunk->placeholder, chunk->bounds_min, chunk->bounds_max);
+	}
+	free(chunk_headers);
+	streams[num_streams++] = stream;
+	num_stream_chunks += stream->num_chunks;
+	requests = realloc(requests, sizeof(chunk_request_t) * num_stream_chunks);
+	return stream;
+}
+
+// Runs on a loader thread, each read with a file of its own
+static void read_mesh_chunk(void* data) {
+	mesh_chunk_t* chunk = data;
+	mesh_t* mesh = &chunk->mesh;
+	mesh->vertices = array_hold(NULL, chunk->num_vertices, sizeof(vec3_t));
+	mesh->uvs = array_hold(NULL, chunk->num_vertices, sizeof(tex2_t));
+	mesh->faces = array_hold(NULL, chunk->num_faces, sizeof(face_t));
+
+	FILE* fp = fopen(chunk->stream->filename, "rb");
+	bool read =
+		fp != NULL &&
+		fseek64(fp, (long long)chunk->offset, SEEK_SET) == 0 &&
+		fread(mesh->vertices, sizeof(vec3_t), chunk->num_vertices, fp) == (size_t)chunk->num_vertices &&
+		fread(mesh->uvs, sizeof(tex2_t), chunk->num_vertices, fp) == (size_t)chunk->num_vertices &&
+		fread(mesh->faces, sizeof(face_t), chunk->num_faces, fp) == (size_t)chunk->num_faces;
+	if (fp != NULL) {
+		fclose(fp);
+	}
+	if (!read) {
+		free_chunk_mesh(mesh);
+		SDL_AtomicSet(&chunk->state, CHUNK_READ_FAILED);
+		return;
+	}
+	mesh->lods[0] = mesh->faces;
+	mesh->num_lods = 1;
+	mesh->bounds_min = chunk->bounds_min;
+	mesh->bounds_max = chunk->bounds_max;
+	mesh->load_state = MESH_READY;
+	SDL_AtomicSet(&chunk->state, CHUNK_READ);
+}
+
+static void evict_mesh_chunk(mesh_chunk_t* chunk) {
+	free_chunk_mesh(&chunk->mesh);
+	SDL_AtomicSet(&chunk->state, CHUNK_EVICTED);
+	resident_bytes -= get_chunk_bytes(chunk);
+	chunk->stream->num_evictions++;
+}
+
+// Resident chunk least needed by a request with the priority, not asked for
+// the longest, then the furthest among those asked for in the same update.
+// Chunks needed as much as the request or more are kept.
+static mesh_chunk_t* find_eviction_victim(float priority) {
+	mesh_chunk_t* victim = NULL;
+	for (int s = 0; s < num_streams; s++) {
+		for (int c = 0; c < streams[s]->num_chunks; c++) {
+			mesh_chunk_t* chunk = &streams[s]->chunks[c];
+			if (SDL_AtomicGet(&chunk->state) != CHUNK_RESIDENT) {
+				continue;
+			}
+			if (chunk->requested_frame == frame && chunk->priority <= priority) {
+				continue;
+			}
+			if (victim == NULL || chunk->requested_frame < victim->requested_frame ||
+				(chunk->requested_frame == victim->requested_frame && chunk->priority > victim->priority)) {
+				victim = chunk;
+			}
+		}
+	}
+	return victim;
+}
+
+static int compare_requests(const void* a, const void* b) {
+	const chunk_request_t* ra = a;
+	const chunk_request_t* rb = b;
+	return (ra->priority > rb->priority) - (ra->priority < rb->priority);
+}
+
+void close_mesh_stream(mesh_stream_t* stream) {
+	// Reads still running write to their chunks. Only the finished ones are
+	// taken back, closing may happen mid-frame and must not start any.
+	wait_load_jobs();
+	for (int c = 0; c < stream->num_chunks; c++) {
+		mesh_chunk_t* chunk = &stream->chunks[c];
+		mesh_chunk_state_t state = SDL_AtomicGet(&chunk->state);
+		if (state == CHUNK_READ || state == CHUNK_RESIDENT) {
+			free_chunk_mesh(&chunk->mesh);
+		}
+		if (state == CHUNK_READ || state == CHUNK_READ_FAILED || state == CHUNK_RESIDENT) {
+			resident_bytes -= get_chunk_bytes(chunk);
+		}
+		free_chunk_mesh(&chunk->placeholder);
+	}
+	free(stream->chunks);
+
+	for (int s = 0; s < num_streams; s++) {
+		if (streams[s] == stream) {
+			streams[s] = streams[--num_streams];
+			break;
+		}
+	}
+	num_stream_chunks -= stream->num_chunks;
+	if (num_streams == 0) {
+		free(requests);
+		requests = NULL;
+	}
+	free(stream);
+}
+
+void print_mesh_stream_stats(const mesh_stream_t* stream) {
+	printf("%s: %d chunk reads, %d evictions, peak %zu KB of %zu KB in memory\n",
+		stream->filename, stream->num_reads, stream->num_evictions, peak_resident_bytes / 1024, budget / 1024);
+}
+
+// Most memory the chunks of all the streams together may take
+void set_mesh_stream_budget(size_t bytes) {
+	budget = bytes;
+}
+
+// Asks for a chunk to be in memory, lower priorities first, and tells if it
+// is. Chunks asked for are read on the next update, as many as fit in the budget.
+bool request_mesh_chunk(mesh_stream_t* stream, int index, float priority) {
+	mesh_chunk_t* chunk = &stream->chunks[index];
+	if (chunk->requested_frame != frame || priority < chunk->priority) {
+		chunk->priority = priority;
+	}
+	chunk->requested_frame = frame;
+	return SDL_AtomicGet(&chunk->state) == CHUNK_RESIDENT;
+}
+
+// Main thread side of the streaming, once per frame. Takes over the chunks
+// read since the last update, then starts reading the ones asked for in it,
+// making room by evicting the chunks least needed. Those that don't fit
+// without evicting more needed ones are left out. Returns the number of
+// chunks that can be drawn from now on.
+int update_mesh_streams(void) {
+	int num_published = 0;
+	int num_reading = 0;
+	int num_requests = 0;
+	for (int s = 0; s < num_streams; s++) {
+		for (int c = 0; c < streams[s]->num_chunks; c++) {
+			mesh_chunk_t* chunk = &streams[s]->chunks[c];
+			mesh_chunk_state_t state = SDL_AtomicGet(&chunk->state);
+			if (state == CHUNK_READ) {
+				SDL_AtomicSet(&chunk->state, CHUNK_RESIDENT);
+				num_published++;
+			}
+			if (state == CHUNK_READ_FAILED) {
+				fprintf(stderr, "Error reading a chunk of %s.\n", chunk->stream->filename);
+				SDL_AtomicSet(&chunk->state, CHUNK_FAILED);
+				resident_bytes -= get_chunk_bytes(chunk);
+			}
+			if (state == CHUNK_READING) {
+				num_reading++;
+			}
+			if (state == CHUNK_EVICTED && chunk->requested_frame == frame) {
+				requests[num_requests++] = (chunk_request_t) { chunk, chunk->priority };
+			}
+		}
+	}
+
+	if (num_requests > 0) {
+		qsort(requests, num_requests, sizeof(chunk_request_t), compare_requests);
+	}
+	for (int r = 0; r < num_requests && num_reading < MESH_STREAM_MAX_READS; r++) {
+		mesh_chunk_t* chunk = requests[r].chunk;
+		size_t bytes = get_chunk_bytes(chunk);
+		while (resident_bytes + bytes > budget) {
+			mesh_chunk_t* victim = find_eviction_victim(requests[r].priority);
+			if (victim == NULL) {
+				break;
+			}
+			evict_mesh_chunk(victim);
+		}
+		// The rest of the requests are needed even less
+		if (resident_bytes + bytes > budget) {
+			break;
+		}
+		resident_bytes += bytes;
+		peak_resident_bytes = resident_bytes > peak_resident_bytes ? resident_bytes : peak_resident_bytes;
+		chunk->stream->num_reads++;
+		num_reading++;
+		SDL_AtomicSet(&chunk->state, CHUNK_READING);
+		submit_load_job(read_mesh_chunk, chunk);
+	}
+
+	frame++;
+	return num_published;
+}
@@ -0,0 +1,70 @@
+#ifndef MESH_STREAM_H
+#define MESH_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <SDL.h>
+#include "mesh.h"
+#include "vector.h"
+
+// Chunked copy of a mesh too big to keep in memory, written next to its OBJ file with this extension
+#define MESH_STREAM_EXTENSION ".chunks"
+#define MESH_STREAM_MAGIC 0x4B4E4843	// "CHNK"
+// Bump whenever the header or any of the stored structs change
+#define MESH_STREAM_VERSION 1
+// Most faces in a chunk, the unit read from the file and evicted from memory
+#define MESH_STREAM_CHUNK_FACES 4096
+// Memory all the streamed meshes together may keep chunks in, unless set otherwise
+#define MESH_STREAM_DEFAULT_BUDGET (256 * 1024 * 1024)
+// Streamed meshes open at once
+#define MAX_NUM_MESH_STREAMS 8
+// Chunk reads in flight at once, so a sudden view change doesn't queue the whole mesh
+#define MESH_STREAM_MAX_READS 4
+
+typedef enum {
+	CHUNK_EVICTED,			// only the bounds and the placeholder are in memory
+	CHUNK_READING,			// on a loader thread, its memory already counted
+	CHUNK_READ,				// read, handed over to the main thread on the next update
+	CHUNK_READ_FAILED,
+	CHUNK_RESIDENT,
+	CHUNK_FAILED			// never read again, its placeholder stays
+} mesh_chunk_state_t;
+
+// Part of a streamed mesh over a compact region, with faces indexing its own vertices
+typedef struct {
+	struct mesh_stream* stream;
+	vec3_t bounds_min;		// local space axis-aligned bounding box
+	vec3_t bounds_max;
+	uint64_t offset;		// of its vertices, then texture coordinates and faces, in the file
+	int num_vertices;
+	int num_faces;
+	SDL_atomic_t state;		// only the loader thread reading it changes it while reading
+	mesh_t mesh;			// the faces while resident
+	mesh_t placeholder;		// box over the bounds drawn when it is not
+	int requested_frame;	// last update it was asked for in
+	float priority;			// lowest asked for in that update
+} mesh_chunk_t;
+
+struct mesh_stream {
+	char filename[260];
+	vec3_t bounds_min;		// of the whole mesh
+	vec3_t bounds_max;
+	vec3_t bounds_center;
+	float bounds_radius;
+	mesh_chunk_t* chunks;
+	int num_chunks;
+	int num_reads;			// chunks read since it was opened
+	int num_evictions;
+};
+
+void get_mesh_stream_filename(char* stream_filename, int size, const char* obj_filename);
+bool save_mesh_stream(mesh_t* mesh, const char* stream_filename);
+mesh_stream_t* open_mesh_stream(const char* filename);
+void close_mesh_stream(mesh_stream_t* stream);
+void print_mesh_stream_stats(const mesh_stream_t* stream);
+void set_mesh_stream_budget(size_t bytes);
+bool request_mesh_chunk(mesh_stream_t* stream, int index, float priority);
+int update_mesh_streams(void);
+
+#endif // !MESH_STREAM_H
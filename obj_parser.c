@@ -0,0 +1,399 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "array.h"
+#include "mapped_file.h"
+#include "obj_parser.h"
+
+enum obj_line_type {
+	OBJ_LINE_OTHER,
+	OBJ_LINE_VERTEX,
+	OBJ_LINE_TEX_COORD,
+	OBJ_LINE_FACE
+};
+
+// Corner of a face with zero based indices into the whole file, -1 for missing or invalid ones
+typedef struct {
+	int vertex;
+	int tex_coord;
+} obj_corner_t;
+
+// Run of whole lines parsed by one thread, straight into its part of the outputs
+typedef struct {
+	const char* begin;
+	const char* end;
+	int num_vertices;
+	int num_tex_coords;
+	int num_triangles;
+	int first_vertex;		// elements of the earlier chunks, known once every chunk is counted
+	int first_tex_coord;
+	int first_triangle;
+	vec3_t* vertices;
+	tex2_t* tex_coords;
+	obj_corner_t* corners;	// three per triangle, faces with more corners are split in fans
+} obj_chunk_t;
+
+static const double powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static const char* skip_spaces(const char* p, const char* end) {
+	while (p < end && is_space(*p)) {
+		p++;
+	}
+	return p;
+}
+
+static const char* find_line_end(const char* p, const char* end) {
+	const char* newline = memchr(p, '\n', end - p);
+	return newline != NULL ? newline : end;
+}
+
+// Type of the line and where its arguments start
+static const char* parse_keyword(const char* p, const char* end, int* type) {
+	p = skip_spaces(p, end);
+	*type = OBJ_LINE_OTHER;
+	if (end - p >= 2 && p[0] == 'v' && is_space(p[1])) {
+		*type = OBJ_LINE_VERTEX;
+		return p + 2;
+	}
+	if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && is_space(p[2])) {
+		*type = OBJ_LINE_TEX_COORD;
+		return p + 3;
+	}
+	if (end - p >= 2 && p[0] == 'f' && is_space(p[1])) {
+		*type = OBJ_LINE_FACE;
+		return p + 2;
+	}
+	return p;
+}
+
+// Decimal number with optional sign, fraction and exponent, independent of the locale.
+// Up to 19 significant digits are kept, which is exact for the float result.
+static const char* parse_float(const char* p, const char* end, float* value) {
+	p = skip_spaces(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int num_digits = 0;
+	int exponent = 0;
+	for (; p < end && is_digit(*p); p++) {
+		if (num_digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			num_digits += mantissa != 0;
+		}
+		else {
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && is_digit(*p); p++) {
+			if (num_digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				num_digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negative_exponent = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative_exponent = *p == '-';
+			p++;
+		}
+		int e = 0;
+		for (; p < end && is_digit(*p); p++) {
+			if (e < 10000) {
+				e = e * 10 + (*p - '0');
+			}
+		}
+		exponent += negative_exponent ? -e : e;
+	}
+
+	// A single multiplication or division is correctly rounded for the usual coordinates
+	double result = (double)mantissa;
+	while (exponent > 22) {
+		result *= 1e22;
+		exponent -= 22;
+	}
+	while (exponent < -22) {
+		result /= 1e22;
+		exponent += 22;
+	}
+	result = (exponent >= 0) ? result * powers_of_ten[exponent] : result / powers_of_ten[-exponent];
+	*value = (float)(negative ? -result : result);
+	return p;
+}
+
+// OBJ index, positive from the start of the file or negative back from the current line.
+// Returns -1 when there is none.
+static const char* parse_index(const char* p, const char* end, int count_so_far, int* index) {
+	bool negative = false;
+	if (p < end && *p == '-') {
+		negative = true;
+		p++;
+	}
+	if (p >= end || !is_digit(*p)) {
+		*index = -1;
+		return p;
+	}
+	int64_t n = 0;
+	for (; p < end && is_digit(*p); p++) {
+		if (n <= INT32_MAX) {
+			n = n * 10 + (*p - '0');
+		}
+	}
+	int64_t resolved = negative ? count_so_far - n : n - 1;
+	*index = (n == 0 || resolved < 0 || resolved > INT32_MAX) ? -1 : (int)resolved;
+	return p;
+}
+
+// Triangles of a face line, one less than the corners after the first
+static int count_face_triangles(const char* p, const char* end) {
+	int num_corners = 0;
+	for (p = skip_spaces(p, end); p < end; p = skip_spaces(p, end)) {
+		num_corners++;
+		while (p < end && !is_space(*p)) {
+			p++;
+		}
+	}
+	return num_corners > 2 ? num_corners - 2 : 0;
+}
+
+static const char* parse_corner(const char* p, const char* end, int num_vertices_so_far, int num_tex_coords_so_far, obj_corner_t* corner) {
+	p = parse_index(p, end, num_vertices_so_far, &corner->vertex);
+	corner->tex_coord = -1;
+	if (p < end && *p == '/') {
+		p = parse_index(p + 1, end, num_tex_coords_so_far, &corner->tex_coord);
+	}
+	// The normal index is not used, the renderer computes face normals itself
+	while (p < end && !is_space(*p)) {
+		p++;
+	}
+	return skip_spaces(p, end);
+}
+
+static int count_chunk(void* data) {
+	obj_chunk_t* chunk = data;
+	for (const char* line = chunk->begin; line < chunk->end;) {
+		const char* line_end = find_line_end(line, chunk->end);
+		int type;
+		const char* p = parse_keyword(line, line_end, &type);
+		chunk->num_vertices += type == OBJ_LINE_VERTEX;
+		chunk->num_tex_coords += type == OBJ_LINE_TEX_COORD;
+		if (type == OBJ_LINE_FACE) {
+			chunk->num_triangles += count_face_triangles(p, line_end);
+		}
+		line = line_end + 1;
+	}
+	return 0;
+}
+
+static int parse_chunk(void* data) {
+	obj_chunk_t* chunk = data;
+	vec3_t* vertex = chunk->vertices + chunk->first_vertex;
+	tex2_t* tex_coord = chunk->tex_coords + chunk->first_tex_coord;
+	obj_corner_t* corner = chunk->corners + chunk->first_triangle * 3;
+
+	for (const char* line = chunk->begin; line < chunk->end;) {
+		const char* line_end = find_line_end(line, chunk->end);
+		int type;
+		const char* p = parse_keyword(line, line_end, &type);
+
+		if (type == OBJ_LINE_VERTEX) {
+			p = parse_float(p, line_end, &vertex->x);
+			p = parse_float(p, line_end, &vertex->y);
+			p = parse_float(p, line_end, &vertex->z);
+			vertex++;
+		}
+		else if (type == OBJ_LINE_TEX_COORD) {
+			p = parse_float(p, line_end, &tex_coord->u);
+			p = parse_float(p, line_end, &tex_coord->v);
+			tex_coord++;
+		}
+		else if (type == OBJ_LINE_FACE) {
+			// Negative indices count back from the elements read before this line
+			int num_vertices_so_far = (int)(vertex - chunk->vertices);
+			int num_tex_coords_so_far = (int)(tex_coord - chunk->tex_coords);
+			int num_triangles = count_face_triangles(p, line_end);
+
+			// Every corner after the second makes a triangle with the first and the previous one
+			obj_corner_t first, previous;
+			if (num_triangles > 0) {
+				p = parse_corner(skip_spaces(p, line_end), line_end, num_vertices_so_far, num_tex_coords_so_far, &first);
+				p = parse_corner(p, line_end, num_vertices_so_far, num_tex_coords_so_far, &previous);
+			}
+			for (int i = 0; i < num_triangles; i++) {
+				corner[0] = first;
+				corner[1] = previous;
+				p = parse_corner(p, line_end, num_vertices_so_far, num_tex_coords_so_far, &corner[2]);
+				previous = corner[2];
+				corner += 3;
+			}
+		}
+		line = line_end + 1;
+	}
+	return 0;
+}
+
+// Every chunk runs on its own thread, the first one on the calling thread
+static void run_chunks(obj_chunk_t* chunks, int num_chunks, SDL_ThreadFunction function) {
+	SDL_Thread* threads[OBJ_MAX_CHUNKS];
+	for (int i = 1; i < num_chunks; i++) {
+		threads[i] = SDL_CreateThread(function, "obj_parse", &chunks[i]);
+	}
+	function(&chunks[0]);
+	for (int i = 1; i < num_chunks; i++) {
+		if (threads[i] != NULL) {
+			SDL_WaitThread(threads[i], NULL);
+		}
+		else {
+			function(&chunks[i]);
+		}
+	}
+}
+
+// Every distinct pair of position and texture coordinate of the corners
+// becomes one vertex. The pairs of each position are kept in a short list.
+typedef struct {
+	int* position_first;	// first vertex of each position, -1 for none
+	int* next;				// dynamic arrays, per vertex
+	int* position;
+	int* tex_coord;
+} obj_welder_t;
+
+static int weld_corner(obj_welder_t* welder, obj_corner_t corner) {
+	for (int v = welder->position_first[corner.vertex]; v >= 0; v = welder->next[v]) {
+		if (welder->tex_coord[v] == corner.tex_coord) {
+			return v;
+		}
+	}
+	int v = array_length(welder->position);
+	array_push(welder->next, welder->position_first[corner.vertex]);
+	array_push(welder->position, corner.vertex);
+	array_push(welder->tex_coord, corner.tex_coord);
+	welder->position_first[corner.vertex] = v;
+	return v;
+}
+
+// Reads an OBJ file into new dynamic arrays of vertices, their texture
+// coordinates and indexed triangles. Faces of any size are split into triangles.
+bool parse_obj_file(const char* filename, vec3_t** vertices, tex2_t** uvs, face_t** faces) {
+	mapped_file_t file;
+	if (!map_file(&file, filename)) {
+		return false;
+	}
+
+	// Split the file into chunks of whole lines, one per core
+	int num_chunks = SDL_GetCPUCount();
+	if (num_chunks > (int)(file.size / OBJ_MIN_CHUNK_SIZE)) num_chunks = (int)(file.size / OBJ_MIN_CHUNK_SIZE);
+	if (num_chunks > OBJ_MAX_CHUNKS) num_chunks = OBJ_MAX_CHUNKS;
+	if (num_chunks < 1) num_chunks = 1;
+
+	obj_chunk_t chunks[OBJ_MAX_CHUNKS];
+	memset(chunks, 0, sizeof(chunks));
+	const char* file_end = file.data + file.size;
+	const char* begin = file.data;
+	for (int i = 0; i < num_chunks; i++) {
+		const char* end = file.data + file.size * (i + 1) / num_chunks;
+		if (end < begin) {
+			end = begin;
+		}
+		if (end < file_end) {
+			end = find_line_end(end, file_end);
+			end += end < file_end;
+		}
+		chunks[i].begin = begin;
+		chunks[i].end = end;
+		begin = end;
+	}
+
+	// Counting first sizes the outputs exactly and tells each chunk where its elements go
+	run_chunks(chunks, num_chunks, count_chunk);
+	int num_positions = 0;
+	int num_tex_coords = 0;
+	int num_triangles = 0;
+	for (int i = 0; i < num_chunks; i++) {
+		chunks[i].first_vertex = num_positions;
+		chunks[i].first_tex_coord = num_tex_coords;
+		chunks[i].first_triangle = num_triangles;
+		num_positions += chunks[i].num_vertices;
+		num_tex_coords += chunks[i].num_tex_coords;
+		num_triangles += chunks[i].num_triangles;
+	}
+
+	vec3_t* positions = malloc(sizeof(vec3_t) * (num_positions > 0 ? num_positions : 1));
+	tex2_t* tex_coords = malloc(sizeof(tex2_t) * (num_tex_coords > 0 ? num_tex_coords : 1));
+	obj_corner_t* corners = malloc(sizeof(obj_corner_t) * 3 * (num_triangles > 0 ? num_triangles : 1));
+	for (int i = 0; i < num_chunks; i++) {
+		chunks[i].vertices = positions;
+		chunks[i].tex_coords = tex_coords;
+		chunks[i].corners = corners;
+	}
+	run_chunks(chunks, num_chunks, parse_chunk);
+	unmap_file(&file);
+
+	// Triangles with a corner outside of the positions are dropped, missing
+	// texture coordinates are all welded together as (0, 0)
+	int num_faces = 0;
+	for (int i = 0; i < num_triangles * 3; i++) {
+		if (corners[i].vertex >= num_positions) {
+			corners[i].vertex = -1;
+		}
+		if (corners[i].tex_coord >= num_tex_coords) {
+			corners[i].tex_coord = -1;
+		}
+	}
+	for (int t = 0; t < num_triangles; t++) {
+		num_faces += corners[t * 3].vertex >= 0 && corners[t * 3 + 1].vertex >= 0 && corners[t * 3 + 2].vertex >= 0;
+	}
+
+	obj_welder_t welder = { malloc(sizeof(int) * (num_positions > 0 ? num_positions : 1)), NULL, NULL, NULL };
+	memset(welder.position_first, -1, sizeof(int) * num_positions);
+	face_t* file_faces = (num_faces > 0) ? array_hold(NULL, num_faces, sizeof(face_t)) : NULL;
+	face_t* face = file_faces;
+	for (int t = 0; t < num_triangles; t++) {
+		const obj_corner_t* c = &corners[t * 3];
+		if (c[0].vertex >= 0 && c[1].vertex >= 0 && c[2].vertex >= 0) {
+			face->a = weld_corner(&welder, c[0]);
+			face->b = weld_corner(&welder, c[1]);
+			face->c = weld_corner(&welder, c[2]);
+			face++;
+		}
+	}
+
+	int num_vertices = array_length(welder.position);
+	vec3_t* file_vertices = (num_vertices > 0) ? array_hold(NULL, num_vertices, sizeof(vec3_t)) : NULL;
+	tex2_t* file_uvs = (num_vertices > 0) ? array_hold(NULL, num_vertices, sizeof(tex2_t)) : NULL;
+	for (int v = 0; v < num_vertices; v++) {
+		file_vertices[v] = positions[welder.position[v]];
+		file_uvs[v] = (welder.tex_coord[v] >= 0) ? tex_coords[welder.tex_coord[v]] : (tex2_t){ 0, 0 };
+	}
+
+	free(welder.position_first);
+	array_free(welder.next);
+	array_free(welder.position);
+	array_free(welder.tex_coord);
+	free(positions);
+	free(tex_coords);
+	free(corners);
+	*vertices = file_vertices;
+	*uvs = file_uvs;
+	*faces = file_faces;
+	return true;
+}
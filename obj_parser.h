@@ -0,0 +1,14 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include <stdbool.h>
+#include "triangle.h"
+#include "vector.h"
+
+// Files smaller than this are parsed on the calling thread alone
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+#define OBJ_MAX_CHUNKS 64
+
+bool parse_obj_file(const char* filename, vec3_t** vertices, tex2_t** uvs, face_t** faces);
+
+#endif // !OBJ_PARSER_H
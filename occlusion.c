@@ -0,0 +1,242 @@
+#include <math.h>
+#include <string.h>
+#include "array.h"
+#include "mesh.h"
+#include "mesh_quantize.h"
+#include "occlusion.h"
+#include "simd.h"
+
+typedef struct {
+	float x;
+	float y;
+	float inverse_w;
+} occlusion_vertex_t;
+
+// Clip space to occlusion buffer pixels, false for points in front of the near plane
+static bool to_occlusion_vertex(vec4_t clip, occlusion_vertex_t* vertex) {
+	if (clip.z < 0 || clip.w <= 0) {
+		return false;
+	}
+	vertex->inverse_w = 1.0f / clip.w;
+	vertex->x = (clip.x * vertex->inverse_w * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH;
+	vertex->y = (0.5f - clip.y * vertex->inverse_w * 0.5f) * OCCLUSION_BUFFER_HEIGHT;
+	return true;
+}
+
+// Only pixels entirely inside the triangle are written, with the smallest
+// 1 / w over the pixel, so the buffer never claims more than the occluder hides
+static void rasterize_occluder_triangle(occlusion_buffer_t* buffer, occlusion_vertex_t v0, occlusion_vertex_t v1, occlusion_vertex_t v2) {
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (fabsf(area) < 1e-6f) {
+		return;
+	}
+	if (area < 0) {
+		occlusion_vertex_t swap = v1;
+		v1 = v2;
+		v2 = swap;
+		area = -area;
+	}
+
+	int min_x = (int)floorf(fminf(v0.x, fminf(v1.x, v2.x)));
+	int max_x = (int)ceilf(fmaxf(v0.x, fmaxf(v1.x, v2.x)));
+	int min_y = (int)floorf(fminf(v0.y, fminf(v1.y, v2.y)));
+	int max_y = (int)ceilf(fmaxf(v0.y, fmaxf(v1.y, v2.y)));
+	if (min_x < 0) min_x = 0;
+	if (min_y < 0) min_y = 0;
+	if (max_x > OCCLUSION_BUFFER_WIDTH) max_x = OCCLUSION_BUFFER_WIDTH;
+	if (max_y > OCCLUSION_BUFFER_HEIGHT) max_y = OCCLUSION_BUFFER_HEIGHT;
+	if (min_x >= max_x || min_y >= max_y) {
+		return;
+	}
+
+	// Edge functions e = a * x + b * y + c, positive inside, taken at the corner
+	// of the pixel where they are smallest
+	occlusion_vertex_t vertices[3] = { v0, v1, v2 };
+	float edge_a[3], edge_b[3], edge_c[3];
+	for (int i = 0; i < 3; i++) {
+		occlusion_vertex_t p = vertices[i];
+		occlusion_vertex_t q = vertices[(i + 1) % 3];
+		edge_a[i] = p.y - q.y;
+		edge_b[i] = q.x - p.x;
+		edge_c[i] = p.x * q.y - p.y * q.x + fminf(edge_a[i], 0) + fminf(edge_b[i], 0);
+	}
+
+	// 1 / w is linear in screen space, also taken at its smallest corner
+	float depth_a = ((v1.inverse_w - v0.inverse_w) * (v2.y - v0.y) - (v2.inverse_w - v0.inverse_w) * (v1.y - v0.y)) / area;
+	float depth_b = ((v2.inverse_w - v0.inverse_w) * (v1.x - v0.x) - (v1.inverse_w - v0.inverse_w) * (v2.x - v0.x)) / area;
+	float depth_c = v0.inverse_w - depth_a * v0.x - depth_b * v0.y + fminf(depth_a, 0) + fminf(depth_b, 0);
+
+	for (int y = min_y; y < max_y; y++) {
+		float* row = buffer->depth + y * OCCLUSION_BUFFER_WIDTH;
+		int x = min_x;
+#ifdef SIMD_WIDTH
+		// Whole groups of pixels at once, the buffer width is a multiple of the group size
+		x = min_x & ~(SIMD_WIDTH - 1);
+		simd_float_t zero = simd_set1(0);
+		simd_float_t ramp = simd_setr_ramp();
+		for (; x < max_x; x += SIMD_WIDTH) {
+			simd_float_t xs = simd_add(simd_set1((float)x), ramp);
+			simd_float_t ys = simd_set1((float)y);
+			simd_float_t inside = simd_cmpge(simd_add(simd_add(simd_mul(simd_set1(edge_a[0]), xs), simd_mul(simd_set1(edge_b[0]), ys)), simd_set1(edge_c[0])), zero);
+			inside = simd_and(inside, simd_cmpge(simd_add(simd_add(simd_mul(simd_set1(edge_a[1]), xs), simd_mul(simd_set1(edge_b[1]), ys)), simd_set1(edge_c[1])), zero));
+			inside = simd_and(inside, simd_cmpge(simd_add(simd_add(simd_mul(simd_set1(edge_a[2]), xs), simd_mul(simd_set1(edge_b[2]), ys)), simd_set1(edge_c[2])), zero));
+			if (simd_movemask(inside) == 0) {
+				continue;
+			}
+			simd_float_t depth = simd_add(simd_add(simd_mul(simd_set1(depth_a), xs), simd_mul(simd_set1(depth_b), ys)), simd_set1(depth_c));
+			simd_float_t current = simd_load(row + x);
+			simd_float_t nearer = simd_max(current, depth);
+			simd_store(row + x, simd_or(simd_and(inside, nearer), simd_andnot(inside, current)));
+		}
+#else
+		for (; x < max_x; x++) {
+			if (edge_a[0] * x + edge_b[0] * y + edge_c[0] < 0 ||
+				edge_a[1] * x + edge_b[1] * y + edge_c[1] < 0 ||
+				edge_a[2] * x + edge_b[2] * y + edge_c[2] < 0) {
+				continue;
+			}
+			float depth = depth_a * x + depth_b * y + depth_c;
+			if (depth > row[x]) {
+				row[x] = depth;
+			}
+		}
+#endif
+	}
+}
+
+static float occluder_size(instance_t* instance, mat4_t view_matrix, mat4_t proj_matrix) {
+	mesh_t* mesh = get_mesh_ptr(instance->mesh_handle);
+	mat4_t world_view_matrix = mat4_mul_mat4(view_matrix, get_instance_world_matrix(instance));
+	vec3_t center = vec3_from_vec4(mat4_mul_vec4(world_view_matrix, vec4_from_vec3(mesh->bounds_center)));
+	float max_scale = fmaxf(fabsf(instance->scale.x), fmaxf(fabsf(instance->scale.y), fabsf(instance->scale.z)));
+	float radius = mesh->bounds_radius * max_scale;
+	float distance = vec3_length(center);
+	if (distance <= radius || center.z <= 0) {
+		return 0;
+	}
+	return radius * proj_matrix.m[1][1] / distance;
+}
+
+// Draw the biggest instances on screen into the occlusion buffer, using their
+// full detail faces. The simplified levels can bulge past the real surface and
+// would hide instances that are in sight.
+void render_occluders(occlusion_buffer_t* buffer, int* instances, int num_instances, mat4_t view_matrix, mat4_t proj_matrix) {
+	memset(buffer->depth, 0, sizeof(buffer->depth));
+
+	int occluders[OCCLUSION_MAX_OCCLUDERS];
+	float sizes[OCCLUSION_MAX_OCCLUDERS];
+	int num_occluders = 0;
+	for (int i = 0; i < num_instances; i++) {
+		// Placeholders are bigger than the meshes they stand for, and streamed
+		// meshes only have some of their chunks in memory
+		instance_t* instance = get_instance_ptr(instances[i]);
+		mesh_t* mesh = get_mesh_ptr(instance->mesh_handle);
+		if (mesh == NULL || mesh->load_state < MESH_UNTEXTURED || mesh->stream != NULL) {
+			continue;
+		}
+		float size = occluder_size(instance, view_matrix, proj_matrix);
+		if (size < OCCLUSION_MIN_OCCLUDER_SIZE) {
+			continue;
+		}
+		// Keep the list sorted by size, dropping the smallest when it is full
+		int slot = num_occluders < OCCLUSION_MAX_OCCLUDERS ? num_occluders++ : OCCLUSION_MAX_OCCLUDERS;
+		while (slot > 0 && sizes[slot - 1] < size) {
+			if (slot < OCCLUSION_MAX_OCCLUDERS) {
+				occluders[slot] = occluders[slot - 1];
+				sizes[slot] = sizes[slot - 1];
+			}
+			slot--;
+		}
+		if (slot < OCCLUSION_MAX_OCCLUDERS) {
+			occluders[slot] = instances[i];
+			sizes[slot] = size;
+		}
+	}
+
+	buffer->num_occluders = num_occluders;
+
+	for (int i = 0; i < num_occluders; i++) {
+		instance_t* instance = get_instance_ptr(occluders[i]);
+		mesh_t* mesh = get_mesh_ptr(instance->mesh_handle);
+		mat4_t world_view_matrix = mat4_mul_mat4(view_matrix, get_instance_world_matrix(instance));
+		mat4_t world_view_projection_matrix = mat4_mul_mat4(proj_matrix, world_view_matrix);
+
+		face_t* faces = mesh->faces;
+		int num_faces = array_length(faces);
+		for (int f = 0; f < num_faces; f++) {
+			int indices[3] = { faces[f].a, faces[f].b, faces[f].c };
+			occlusion_vertex_t vertices[3];
+			bool in_front = true;
+			for (int j = 0; j < 3 && in_front; j++) {
+				vec4_t clip = mat4_mul_vec4(world_view_projection_matrix, vec4_from_vec3(get_mesh_vertex(mesh, indices[j])));
+				in_front = to_occlusion_vertex(clip, &vertices[j]);
+			}
+			// Leaving out a triangle only makes the buffer hide less
+			if (in_front) {
+				rasterize_occluder_triangle(buffer, vertices[0], vertices[1], vertices[2]);
+			}
+		}
+	}
+}
+
+// An instance is hidden when every pixel its bounding box touches has an
+// occluder nearer than the nearest corner of the box
+bool is_instance_occluded(const occlusion_buffer_t* buffer, instance_t* instance, mat4_t view_projection_matrix) {
+	if (buffer->num_occluders == 0) {
+		return false;
+	}
+
+	// Nothing is drawn for an unloaded mesh
+	mesh_t* mesh = get_mesh_ptr(instance->mesh_handle);
+	if (mesh == NULL) {
+		return false;
+	}
+	mat4_t world_view_projection_matrix = mat4_mul_mat4(view_projection_matrix, get_instance_world_matrix(instance));
+
+	float min_x = OCCLUSION_BUFFER_WIDTH, max_x = 0;
+	float min_y = OCCLUSION_BUFFER_HEIGHT, max_y = 0;
+	float nearest = 0;
+	for (int i = 0; i < 8; i++) {
+		vec3_t corner = {
+			(i & 1) ? mesh->bounds_max.x : mesh->bounds_min.x,
+			(i & 2) ? mesh->bounds_max.y : mesh->bounds_min.y,
+			(i & 4) ? mesh->bounds_max.z : mesh->bounds_min.z
+		};
+		occlusion_vertex_t vertex;
+		if (!to_occlusion_vertex(mat4_mul_vec4(world_view_projection_matrix, vec4_from_vec3(corner)), &vertex)) {
+			return false;
+		}
+		min_x = fminf(min_x, vertex.x);
+		max_x = fmaxf(max_x, vertex.x);
+		min_y = fminf(min_y, vertex.y);
+		max_y = fmaxf(max_y, vertex.y);
+		nearest = fmaxf(nearest, vertex.inverse_w);
+	}
+
+	int x0 = (int)floorf(min_x) < 0 ? 0 : (int)floorf(min_x);
+	int y0 = (int)floorf(min_y) < 0 ? 0 : (int)floorf(min_y);
+	int x1 = (int)ceilf(max_x) > OCCLUSION_BUFFER_WIDTH ? OCCLUSION_BUFFER_WIDTH : (int)ceilf(max_x);
+	int y1 = (int)ceilf(max_y) > OCCLUSION_BUFFER_HEIGHT ? OCCLUSION_BUFFER_HEIGHT : (int)ceilf(max_y);
+	if (x0 >= x1 || y0 >= y1) {
+		return false;
+	}
+
+	for (int y = y0; y < y1; y++) {
+		const float* row = buffer->depth + y * OCCLUSION_BUFFER_WIDTH;
+		int x = x0;
+#ifdef SIMD_WIDTH
+		simd_float_t box_depth = simd_set1(nearest);
+		for (; x + SIMD_WIDTH <= x1; x += SIMD_WIDTH) {
+			if (simd_movemask(simd_cmple(simd_load(row + x), box_depth)) != 0) {
+				return false;
+			}
+		}
+#endif
+		for (; x < x1; x++) {
+			if (row[x] <= nearest) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,24 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stdbool.h>
+#include "instance.h"
+#include "matrix.h"
+
+#define OCCLUSION_BUFFER_WIDTH 256
+#define OCCLUSION_BUFFER_HEIGHT 128
+#define OCCLUSION_MAX_OCCLUDERS 8
+// Radius of the bounding sphere in normalized device coordinates an instance needs to be an occluder
+#define OCCLUSION_MIN_OCCLUDER_SIZE 0.15
+
+// Every pixel keeps 1 / w of the farthest point of the occluders fully
+// covering it, 0 where nothing covers the whole pixel
+typedef struct {
+	float depth[OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT];
+	int num_occluders;
+} occlusion_buffer_t;
+
+void render_occluders(occlusion_buffer_t* buffer, int* instances, int num_instances, mat4_t view_matrix, mat4_t proj_matrix);
+bool is_instance_occluded(const occlusion_buffer_t* buffer, instance_t* instance, mat4_t view_projection_matrix);
+
+#endif // !OCCLUSION_H
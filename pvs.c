@@ -0,0 +1,265 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "arena.h"
+#include "array.h"
+#include "instance.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "mesh_quantize.h"
+#include "occlusion.h"
+#include "pvs.h"
+
+#define PVS_FILE_MAGIC 0x31535650	// "PVS1"
+#define PVS_MAX_THREADS 16
+#define PVS_QUERY_ARENA_SIZE (64 * 1024)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t scene_hash;
+	float origin[3];
+	float cell_size;
+	int32_t size_x, size_y, size_z;
+	int32_t num_instances;
+} pvs_file_header_t;
+
+// Shared by the worker threads, which take the cells one at a time
+typedef struct {
+	pvs_t* pvs;
+	scene_bvh_t* bvh;
+	mat4_t proj_matrix;
+	SDL_atomic_t next_cell;
+} pvs_job_t;
+
+// A camera looking down each axis, the six views together see every direction
+static const vec3_t view_directions[6] = {
+	{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+};
+static const vec3_t view_ups[6] = {
+	{ 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1, 0 }
+};
+
+static uint32_t hash_bytes(uint32_t hash, const void* data, size_t size) {
+	const unsigned char* bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// FNV-1a over the placement of the instances and the size of their meshes,
+// so sets built for another scene are never used
+static uint32_t compute_scene_hash(void) {
+	uint32_t hash = 2166136261u;
+	int num_instances = get_num_instances();
+	hash = hash_bytes(hash, &num_instances, sizeof(num_instances));
+	for (int i = 0; i < num_instances; i++) {
+		instance_t* instance = get_instance_ptr(i);
+		mesh_t* mesh = get_mesh_ptr(instance->mesh_handle);
+		int mesh_sizes[2] = { 0, 0 };
+		if (mesh != NULL) {
+			mesh_sizes[0] = get_mesh_num_vertices(mesh);
+			mesh_sizes[1] = array_length(mesh->faces);
+		}
+		hash = hash_bytes(hash, &instance->mesh_handle, sizeof(instance->mesh_handle));
+		hash = hash_bytes(hash, &instance->scale, sizeof(instance->scale));
+		hash = hash_bytes(hash, &instance->rotation, sizeof(instance->rotation));
+		hash = hash_bytes(hash, &instance->translation, sizeof(instance->translation));
+		hash = hash_bytes(hash, mesh_sizes, sizeof(mesh_sizes));
+	}
+	return hash;
+}
+
+// Same culling as a frame: frustum through the scene hierarchy, then the occlusion buffer
+static void mark_visible_from(pvs_job_t* job, vec3_t eye, occlusion_buffer_t* occlusion, arena_t* arena, uint32_t* bits) {
+	for (int d = 0; d < 6; d++) {
+		arena_reset(arena);
+		mat4_t view_matrix = mat4_look_at(eye, vec3_add(eye, view_directions[d]), view_ups[d]);
+		mat4_t view_projection_matrix = mat4_mul_mat4(job->proj_matrix, view_matrix);
+
+		int num_visible;
+		int* visible = scene_bvh_query_frustum(job->bvh, view_projection_matrix, arena, &num_visible);
+		render_occluders(occlusion, visible, num_visible, view_matrix, job->proj_matrix);
+		for (int i = 0; i < num_visible; i++) {
+			if (!is_instance_occluded(occlusion, get_instance_ptr(visible[i]), view_projection_matrix)) {
+				bits[visible[i] >> 5] |= 1u << (visible[i] & 31);
+			}
+		}
+	}
+}
+
+static int build_thread_main(void* data) {
+	pvs_job_t* job = data;
+	pvs_t* pvs = job->pvs;
+	int num_cells = pvs->size_x * pvs->size_y * pvs->size_z;
+
+	// Every thread has its own buffer and query memory, the scene is only read
+	occlusion_buffer_t* occlusion = malloc(sizeof(occlusion_buffer_t));
+	arena_t arena;
+	arena_init(&arena, PVS_QUERY_ARENA_SIZE);
+
+	for (int cell = SDL_AtomicAdd(&job->next_cell, 1); cell < num_cells; cell = SDL_AtomicAdd(&job->next_cell, 1)) {
+		int x = cell % pvs->size_x;
+		int y = (cell / pvs->size_x) % pvs->size_y;
+		int z = cell / (pvs->size_x * pvs->size_y);
+		uint32_t* bits = pvs->bits + (size_t)cell * pvs->words_per_cell;
+		vec3_t corner = vec3_add(pvs->origin, vec3_mul(vec3_new(x, y, z), pvs->cell_size));
+
+		// Sample the camera at the corners and the center of the cell
+		for (int s = 0; s < 9; s++) {
+			vec3_t offset = (s < 8)
+				? vec3_new(s & 1, (s >> 1) & 1, (s >> 2) & 1)
+				: vec3_new(0.5, 0.5, 0.5);
+			vec3_t eye = vec3_add(corner, vec3_mul(offset, pvs->cell_size));
+			mark_visible_from(job, eye, occlusion, &arena, bits);
+		}
+	}
+
+	arena_free(&arena);
+	free(occlusion);
+	return 0;
+}
+
+// Voxelize the space around the scene and find what can be seen from every
+// cell, splitting the cells between a thread per core
+void pvs_build(pvs_t* pvs, scene_bvh_t* bvh, float znear, float zfar) {
+	memset(pvs, 0, sizeof(pvs_t));
+	pvs->num_instances = get_num_instances();
+	pvs->words_per_cell = (pvs->num_instances + 31) / 32;
+	pvs->scene_hash = compute_scene_hash();
+	if (bvh->tree.num_nodes == 0) {
+		return;
+	}
+
+	aabb_t bounds = bvh->tree.nodes[0].bounds;
+	vec3_t margin = vec3_new(PVS_MARGIN, PVS_MARGIN, PVS_MARGIN);
+	bounds.min = vec3_sub(bounds.min, margin);
+	bounds.max = vec3_add(bounds.max, margin);
+	vec3_t extent = vec3_sub(bounds.max, bounds.min);
+	float largest_extent = fmaxf(extent.x, fmaxf(extent.y, extent.z));
+
+	pvs->origin = bounds.min;
+	pvs->cell_size = fmaxf(PVS_CELL_SIZE, largest_extent / PVS_MAX_CELLS_PER_AXIS);
+	pvs->size_x = (int)ceilf(extent.x / pvs->cell_size);
+	pvs->size_y = (int)ceilf(extent.y / pvs->cell_size);
+	pvs->size_z = (int)ceilf(extent.z / pvs->cell_size);
+	int num_cells = pvs->size_x * pvs->size_y * pvs->size_z;
+	pvs->bits = calloc((size_t)num_cells * pvs->words_per_cell, sizeof(uint32_t));
+
+	pvs_job_t job = {
+		.pvs = pvs,
+		.bvh = bvh,
+		.proj_matrix = mat4_make_perspective(M_PI / 2.0, 1.0, znear, zfar)
+	};
+	SDL_AtomicSet(&job.next_cell, 0);
+
+	int num_threads = SDL_GetCPUCount();
+	if (num_threads < 1) num_threads = 1;
+	if (num_threads > PVS_MAX_THREADS) num_threads = PVS_MAX_THREADS;
+
+	// The calling thread works too, so the build finishes even without extra threads
+	Uint32 start_time = SDL_GetTicks();
+	SDL_Thread* threads[PVS_MAX_THREADS];
+	for (int i = 1; i < num_threads; i++) {
+		threads[i] = SDL_CreateThread(build_thread_main, "pvs_build", &job);
+	}
+	build_thread_main(&job);
+	for (int i = 1; i < num_threads; i++) {
+		if (threads[i] != NULL) {
+			SDL_WaitThread(threads[i], NULL);
+		}
+	}
+
+	long total_visible = 0;
+	for (size_t i = 0; i < (size_t)num_cells * pvs->words_per_cell; i++) {
+		for (uint32_t word = pvs->bits[i]; word != 0; word &= word - 1) {
+			total_visible++;
+		}
+	}
+	printf(
+		"Potentially visible sets: %dx%dx%d cells of %.1f, %d threads, %.2f s, %.1f of %d instances per cell\n",
+		pvs->size_x, pvs->size_y, pvs->size_z, pvs->cell_size, num_threads,
+		(SDL_GetTicks() - start_time) / 1000.0,
+		(double)total_visible / num_cells, pvs->num_instances
+	);
+}
+
+bool pvs_save(const pvs_t* pvs, const char* filename) {
+	FILE* fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		return false;
+	}
+
+	pvs_file_header_t header = {
+		PVS_FILE_MAGIC,
+		pvs->scene_hash,
+		{ pvs->origin.x, pvs->origin.y, pvs->origin.z },
+		pvs->cell_size,
+		pvs->size_x, pvs->size_y, pvs->size_z,
+		pvs->num_instances
+	};
+	size_t num_words = (size_t)pvs->size_x * pvs->size_y * pvs->size_z * pvs->words_per_cell;
+	bool written =
+		fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		fwrite(pvs->bits, sizeof(uint32_t), num_words, fp) == num_words;
+	fclose(fp);
+	return written;
+}
+
+// Only sets built for the current scene are loaded
+bool pvs_load(pvs_t* pvs, const char* filename) {
+	memset(pvs, 0, sizeof(pvs_t));
+	FILE* fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		return false;
+	}
+
+	pvs_file_header_t header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+		header.magic != PVS_FILE_MAGIC ||
+		header.scene_hash != compute_scene_hash() ||
+		header.num_instances != get_num_instances() ||
+		header.size_x <= 0 || header.size_y <= 0 || header.size_z <= 0) {
+		fclose(fp);
+		return false;
+	}
+
+	pvs->origin = vec3_new(header.origin[0], header.origin[1], header.origin[2]);
+	pvs->cell_size = header.cell_size;
+	pvs->size_x = header.size_x;
+	pvs->size_y = header.size_y;
+	pvs->size_z = header.size_z;
+	pvs->num_instances = header.num_instances;
+	pvs->words_per_cell = (header.num_instances + 31) / 32;
+	pvs->scene_hash = header.scene_hash;
+
+	size_t num_words = (size_t)pvs->size_x * pvs->size_y * pvs->size_z * pvs->words_per_cell;
+	pvs->bits = malloc(sizeof(uint32_t) * (num_words > 0 ? num_words : 1));
+	bool read = fread(pvs->bits, sizeof(uint32_t), num_words, fp) == num_words;
+	fclose(fp);
+	if (!read) {
+		pvs_free(pvs);
+	}
+	return read;
+}
+
+// Bits of the instances that can be seen from a position, NULL outside the grid
+const uint32_t* pvs_lookup(const pvs_t* pvs, vec3_t position) {
+	if (pvs->bits == NULL) {
+		return NULL;
+	}
+	int x = (int)floorf((position.x - pvs->origin.x) / pvs->cell_size);
+	int y = (int)floorf((position.y - pvs->origin.y) / pvs->cell_size);
+	int z = (int)floorf((position.z - pvs->origin.z) / pvs->cell_size);
+	if (x < 0 || y < 0 || z < 0 || x >= pvs->size_x || y >= pvs->size_y || z >= pvs->size_z) {
+		return NULL;
+	}
+	return pvs->bits + ((size_t)(z * pvs->size_y + y) * pvs->size_x + x) * pvs->words_per_cell;
+}
+
+void pvs_free(pvs_t* pvs) {
+	free(pvs->bits);
+	memset(pvs, 0, sizeof(pvs_t));
+}
@@ -0,0 +1,33 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "scene_bvh.h"
+#include "vector.h"
+
+#define PVS_FILENAME "./assets/scene.pvs"
+#define PVS_CELL_SIZE 2.0
+#define PVS_MAX_CELLS_PER_AXIS 64
+// The camera can go this far away from the bounds of the scene and still use the sets
+#define PVS_MARGIN 8.0
+
+// Potentially visible sets of a static scene, one bitset over the instances
+// for every cell of a grid of camera positions
+typedef struct {
+	vec3_t origin;			// minimum corner of the grid
+	float cell_size;
+	int size_x, size_y, size_z;
+	int num_instances;
+	int words_per_cell;
+	uint32_t scene_hash;	// the scene the sets were built for
+	uint32_t* bits;
+} pvs_t;
+
+void pvs_build(pvs_t* pvs, scene_bvh_t* bvh, float znear, float zfar);
+bool pvs_save(const pvs_t* pvs, const char* filename);
+bool pvs_load(pvs_t* pvs, const char* filename);
+const uint32_t* pvs_lookup(const pvs_t* pvs, vec3_t position);
+void pvs_free(pvs_t* pvs);
+
+#endif // !PVS_H
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include "refinement.h"
+
+static bool enabled = false;
+static bool restart_pending = true;
+static bool refresh_pending = false;
+static Uint32 restart_ticks = 0;		// when the view last changed
+static int stage = REFINEMENT_PREVIEW;
+static int sample_index = 0;			// jittered frames taken of the current view
+
+static render_target_t preview_target;
+static uint32_t* accumulation = NULL;	// sums of the red, green and blue of the samples
+static int accumulation_width = 0;
+static int accumulation_height = 0;
+
+// Low discrepancy sequence, spreads the samples evenly over the pixel
+static float halton(int index, int base) {
+	float result = 0;
+	float fraction = 1.0f / base;
+	while (index > 0) {
+		result += fraction * (index % base);
+		index /= base;
+		fraction /= base;
+	}
+	return result;
+}
+
+void init_refinement(int width, int height) {
+	preview_target.width = (int)(width * REFINEMENT_PREVIEW_SCALE);
+	preview_target.height = (int)(height * REFINEMENT_PREVIEW_SCALE);
+	preview_target.pitch = preview_target.width;
+	preview_target.color_buffer = malloc(sizeof(uint32_t) * preview_target.width * preview_target.height);
+	preview_target.z_buffer = malloc(sizeof(float) * preview_target.width * preview_target.height);
+
+	accumulation_width = width;
+	accumulation_height = height;
+	accumulation = malloc(sizeof(uint32_t) * 3 * width * height);
+}
+
+void set_progressive_rendering(bool is_enabled) {
+	enabled = is_enabled;
+	restart_refinement();
+	set_texture_filter(TEXTURE_FILTER_NEAREST);
+}
+
+bool is_progressive_rendering(void) {
+	return enabled;
+}
+
+// Anything that changes the view starts again from a preview
+void restart_refinement(void) {
+	restart_pending = true;
+	restart_ticks = SDL_GetTicks();
+}
+
+// Changes to how the same view is drawn start again from full resolution
+void refresh_refinement(void) {
+	refresh_pending = true;
+}
+
+// Each frame without changes improves the image one step
+void begin_refinement_frame(void) {
+	if (!enabled) {
+		return;
+	}
+	if (restart_pending) {
+		stage = REFINEMENT_PREVIEW;
+		sample_index = 0;
+		restart_pending = false;
+		refresh_pending = false;
+	}
+	else if (stage == REFINEMENT_PREVIEW && SDL_GetTicks() - restart_ticks < REFINEMENT_IDLE_MS) {
+		// The view may still be changing
+	}
+	else if (refresh_pending) {
+		stage = REFINEMENT_FULL;
+		sample_index = 0;
+		refresh_pending = false;
+	}
+	else if (stage == REFINEMENT_ACCUMULATE) {
+		sample_index++;
+		if (sample_index >= REFINEMENT_NUM_SAMPLES) {
+			stage = REFINEMENT_CONVERGED;
+		}
+	}
+	else if (stage != REFINEMENT_CONVERGED) {
+		stage++;
+		if (stage == REFINEMENT_ACCUMULATE) {
+			sample_index = 1;
+		}
+	}
+	set_texture_filter(stage >= REFINEMENT_FILTERED ? TEXTURE_FILTER_BILINEAR : TEXTURE_FILTER_NEAREST);
+}
+
+int get_refinement_stage(void) {
+	return stage;
+}
+
+int get_refinement_lod_bias(void) {
+	return (enabled && stage == REFINEMENT_PREVIEW) ? REFINEMENT_PREVIEW_LOD_BIAS : 0;
+}
+
+float get_refinement_resolution_scale(void) {
+	return (enabled && stage == REFINEMENT_PREVIEW) ? REFINEMENT_PREVIEW_SCALE : 1;
+}
+
+// Offset of the sample inside the pixel, in pixels, none outside the accumulation
+vec2_t get_refinement_jitter(void) {
+	if (!enabled || stage != REFINEMENT_ACCUMULATE) {
+		return vec2_new(0, 0);
+	}
+	return vec2_new(halton(sample_index, 2) - 0.5f, halton(sample_index, 3) - 0.5f);
+}
+
+const render_target_t* get_refinement_preview_target(void) {
+	return &preview_target;
+}
+
+// Nearest neighbor scale of the preview to the current render target
+void upscale_refinement_preview(void) {
+	const render_target_t* target = get_render_target();
+	for (int y = 0; y < target->height; y++) {
+		const uint32_t* source = preview_target.color_buffer + preview_target.pitch * (y * preview_target.height / target->height);
+		uint32_t* row = target->color_buffer + target->pitch * y;
+		for (int x = 0; x < target->width; x++) {
+			row[x] = source[x * preview_target.width / target->width];
+		}
+	}
+}
+
+// Add the frame in the current render target to the average, and replace it
+// by the average of all the samples so far
+void accumulate_refinement_sample(void) {
+	const render_target_t* target = get_render_target();
+	int num_samples = (stage == REFINEMENT_ACCUMULATE) ? sample_index + 1 : 1;
+	int width = target->width < accumulation_width ? target->width : accumulation_width;
+	int height = target->height < accumulation_height ? target->height : accumulation_height;
+
+	for (int y = 0; y < height; y++) {
+		uint32_t* row = target->color_buffer + target->pitch * y;
+		uint32_t* sums = accumulation + 3 * accumulation_width * y;
+		for (int x = 0; x < width; x++) {
+			uint32_t color = row[x];
+			uint32_t average = 0xFF000000;
+			for (int c = 0; c < 3; c++) {
+				uint32_t channel = (color >> (c * 8)) & 0xFF;
+				uint32_t* sum = &sums[x * 3 + c];
+				*sum = (num_samples == 1) ? channel : *sum + channel;
+				average |= ((*sum + num_samples / 2) / num_samples) << (c * 8);
+			}
+			if (num_samples > 1) {
+				row[x] = average;
+			}
+		}
+	}
+}
+
+void free_refinement(void) {
+	free(preview_target.color_buffer);
+	free(preview_target.z_buffer);
+	free(accumulation);
+	preview_target.color_buffer = NULL;
+	preview_target.z_buffer = NULL;
+	accumulation = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef REFINEMENT_H
+#define REFINEMENT_H
+
+#include <stdbool.h>
+#include "display.h"
+#include "vector.h"
+
+// Previews render at a fraction of the window size with coarser levels of detail
+#define REFINEMENT_PREVIEW_SCALE 0.5
+#define REFINEMENT_PREVIEW_LOD_BIAS 1
+// Previews go on until the view has stayed the same this long, held keys repeat faster than that
+#define REFINEMENT_IDLE_MS 300
+// Jittered frames averaged together before the view counts as converged
+#define REFINEMENT_NUM_SAMPLES 16
+
+// Steps the progressive mode goes through while the view stays the same
+enum refinement_stage {
+	REFINEMENT_PREVIEW,		// reduced resolution and coarse levels of detail, while the view changes
+	REFINEMENT_FULL,		// full resolution
+	REFINEMENT_FILTERED,	// bilinear texture filtering, the first sample of the average
+	REFINEMENT_ACCUMULATE,	// one more jittered sample averaged in every frame
+	REFINEMENT_CONVERGED	// nothing left to improve, the last image stays on screen
+};
+
+void init_refinement(int width, int height);
+void set_progressive_rendering(bool enabled);
+bool is_progressive_rendering(void);
+void restart_refinement(void);
+void refresh_refinement(void);
+void begin_refinement_frame(void);
+int get_refinement_stage(void);
+int get_refinement_lod_bias(void);
+float get_refinement_resolution_scale(void);
+vec2_t get_refinement_jitter(void);
+const render_target_t* get_refinement_preview_target(void);
+void upscale_refinement_preview(void);
+void accumulate_refinement_sample(void);
+void free_refinement(void);
+
+#endif // !REFINEMENT_H
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include "registry.h"
+
+static handle_t make_handle(int slot, uint32_t generation) {
+	return (generation << HANDLE_INDEX_BITS) | (uint32_t)slot;
+}
+
+// Slot of a live item, -1 for a handle of a destroyed item or no item at all.
+// Generation 0 marks a retired slot, so NULL_HANDLE never matches one.
+static int find_slot(const registry_t* registry, handle_t handle) {
+	int slot = (int)(handle & HANDLE_INDEX_MASK);
+	uint32_t generation = handle >> HANDLE_INDEX_BITS;
+	if (generation == 0 || slot >= registry->num_slots || registry->slots[slot].generation != generation) {
+		return -1;
+	}
+	return slot;
+}
+
+// Adds a zeroed item, NULL_HANDLE when every handle index is taken. Slots of
+// destroyed items are reused first.
+handle_t registry_create(registry_t* registry) {
+	int slot = registry->free_slot;
+	if (slot >= 0) {
+		registry->free_slot = registry->slots[slot].dense_index;
+	}
+	else {
+		if (registry->num_slots > (int)HANDLE_INDEX_MASK) {
+			return NULL_HANDLE;
+		}
+		if (registry->num_slots == registry->slot_capacity) {
+			registry->slot_capacity = registry->slot_capacity ? registry->slot_capacity * 2 : 16;
+			registry->slots = realloc(registry->slots, sizeof(registry_slot_t) * registry->slot_capacity);
+		}
+		slot = registry->num_slots++;
+		registry->slots[slot].generation = 1;
+	}
+
+	if (registry->count == registry->capacity) {
+		registry->capacity = registry->capacity ? registry->capacity * 2 : 16;
+		registry->items = realloc(registry->items, (size_t)registry->item_size * registry->capacity);
+		registry->handles = realloc(registry->handles, sizeof(handle_t) * registry->capacity);
+	}
+	int index = registry->count++;
+	handle_t handle = make_handle(slot, registry->slots[slot].generation);
+	memset(registry->items + (size_t)index * registry->item_size, 0, registry->item_size);
+	registry->handles[index] = handle;
+	registry->slots[slot].dense_index = index;
+	return handle;
+}
+
+// The item of the handle, NULL once it was destroyed
+void* registry_get(const registry_t* registry, handle_t handle) {
+	int slot = find_slot(registry, handle);
+	if (slot < 0) {
+		return NULL;
+	}
+	return registry->items + (size_t)registry->slots[slot].dense_index * registry->item_size;
+}
+
+// The last item moves into the place of the destroyed one, so the items stay
+// packed. A slot is retired instead of reused once its generation runs out.
+bool registry_destroy(registry_t* registry, handle_t handle) {
+	int slot = find_slot(registry, handle);
+	if (slot < 0) {
+		return false;
+	}
+	int index = registry->slots[slot].dense_index;
+	int last = --registry->count;
+	if (index != last) {
+		memcpy(registry->items + (size_t)index * registry->item_size, registry->items + (size_t)last * registry->item_size, registry->item_size);
+		registry->handles[index] = registry->handles[last];
+		registry->slots[registry->handles[index] & HANDLE_INDEX_MASK].dense_index = index;
+	}
+
+	registry_slot_t* freed = &registry->slots[slot];
+	if (freed->generation == HANDLE_MAX_GENERATION) {
+		freed->generation = 0;
+		return true;
+	}
+	freed->generation++;
+	freed->dense_index = registry->free_slot;
+	registry->free_slot = slot;
+	return true;
+}
+
+// Items by position, from 0 to count, for walking all of them
+void* registry_item(const registry_t* registry, int index) {
+	return registry->items + (size_t)index * registry->item_size;
+}
+
+handle_t registry_handle(const registry_t* registry, int index) {
+	return registry->handles[index];
+}
+
+// Drops every item, the registry can be used again afterwards
+void registry_free(registry_t* registry) {
+	free(registry->items);
+	free(registry->handles);
+	free(registry->slots);
+	int item_size = registry->item_size;
+	memset(registry, 0, sizeof(registry_t));
+	registry->item_size = item_size;
+	registry->free_slot = -1;
+}
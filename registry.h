@@ -0,0 +1,46 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Generational handle, the slot of the item in the low bits and how many times
+// the slot was reused in the high ones. Once the item is destroyed the handle
+// stops resolving, even after the slot holds another item.
+typedef uint32_t handle_t;
+
+// Generations start at 1, so no item ever gets this handle
+#define NULL_HANDLE 0
+#define HANDLE_INDEX_BITS 20
+#define HANDLE_INDEX_MASK ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_MAX_GENERATION ((1u << (32 - HANDLE_INDEX_BITS)) - 1)
+
+typedef struct {
+	uint32_t generation;	// of the item in the slot, or of the next one while free
+	int dense_index;		// of the item, or the next free slot while free
+} registry_slot_t;
+
+// Items kept one after the other for iteration, found from their handle
+// through the slots. Pointers to items only hold until the next create or destroy.
+typedef struct {
+	int item_size;
+	char* items;			// the live items, in no particular order
+	handle_t* handles;		// handle of each item
+	int count;
+	int capacity;
+	registry_slot_t* slots;
+	int num_slots;
+	int slot_capacity;
+	int free_slot;			// first of the free slots, -1 for none
+} registry_t;
+
+#define REGISTRY_INITIALIZER(type) { .item_size = sizeof(type), .free_slot = -1 }
+
+handle_t registry_create(registry_t* registry);
+void* registry_get(const registry_t* registry, handle_t handle);
+bool registry_destroy(registry_t* registry, handle_t handle);
+void* registry_item(const registry_t* registry, int index);
+handle_t registry_handle(const registry_t* registry, int index);
+void registry_free(registry_t* registry);
+
+#endif // !REGISTRY_H
@@ -0,0 +1,187 @@
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "display.h"
+#include "render_queue.h"
+
+#define RENDER_QUEUE_INITIAL_CAPACITY 1024
+
+// Bytes taken by one triangle across all the streams
+#define TRIANGLE_STREAMS_SIZE \
+	(sizeof(vec2_t) * 3 + sizeof(float) * 3 + sizeof(tex2_t) * 3 + sizeof(uint32_t) + sizeof(uint64_t))
+
+static void carve_streams(render_queue_t* queue, char* memory, int capacity) {
+	queue->points = (vec2_t*)memory;
+	memory += sizeof(vec2_t) * 3 * capacity;
+	queue->keys = (uint64_t*)memory;
+	memory += sizeof(uint64_t) * capacity;
+	queue->w = (float*)memory;
+	memory += sizeof(float) * 3 * capacity;
+	queue->texcoords = (tex2_t*)memory;
+	memory += sizeof(tex2_t) * 3 * capacity;
+	queue->colors = (uint32_t*)memory;
+}
+
+static void grow_streams(render_queue_t* queue) {
+	render_queue_t old = *queue;
+	int capacity = queue->capacity * 2;
+
+	// All the streams share one allocation, copy each of them to its new place
+	carve_streams(queue, arena_alloc(queue->arena, TRIANGLE_STREAMS_SIZE * capacity), capacity);
+	memcpy(queue->points, old.points, sizeof(vec2_t) * 3 * old.num_triangles);
+	memcpy(queue->keys, old.keys, sizeof(uint64_t) * old.num_triangles);
+	memcpy(queue->w, old.w, sizeof(float) * 3 * old.num_triangles);
+	memcpy(queue->texcoords, old.texcoords, sizeof(tex2_t) * 3 * old.num_triangles);
+	memcpy(queue->colors, old.colors, sizeof(uint32_t) * old.num_triangles);
+	queue->capacity = capacity;
+}
+
+void render_queue_init(render_queue_t* queue, arena_t* arena) {
+	memset(queue, 0, sizeof(render_queue_t));
+	queue->arena = arena;
+	queue->capacity = RENDER_QUEUE_INITIAL_CAPACITY;
+	carve_streams(queue, arena_alloc(arena, TRIANGLE_STREAMS_SIZE * queue->capacity), queue->capacity);
+}
+
+int render_queue_add_texture(render_queue_t* queue, texture_t* texture) {
+	for (int i = 0; i < queue->num_textures; i++) {
+		if (queue->textures[i] == texture) {
+			return i;
+		}
+	}
+	if (queue->num_textures == MAX_QUEUE_TEXTURES) {
+		return -1;
+	}
+
+	// The list of textures doubles each time it reaches a power of two
+	if ((queue->num_textures & (queue->num_textures - 1)) == 0) {
+		int capacity = queue->num_textures ? queue->num_textures * 2 : 8;
+		queue->textures = arena_realloc(
+			queue->arena, queue->textures, sizeof(texture_t*) * queue->num_textures, sizeof(texture_t*) * capacity
+		);
+	}
+	queue->textures[queue->num_textures] = texture;
+	return queue->num_textures++;
+}
+
+// How the triangles using a texture are rasterized with the current render method
+int render_queue_choose_pass(const render_queue_t* queue, int texture_index) {
+	if (should_render_textured_triangles() && texture_index >= 0 && queue->textures[texture_index]->pixels != NULL) {
+		return RENDER_PASS_TEXTURED;
+	}
+	if (should_render_filled_triangles() || should_render_textured_triangles()) {
+		return RENDER_PASS_FILL;
+	}
+	return RENDER_PASS_NONE;
+}
+
+// Make room for more triangles, for the callers writing the streams themselves
+void render_queue_reserve(render_queue_t* queue, int num_triangles) {
+	while (queue->num_triangles + num_triangles > queue->capacity) {
+		grow_streams(queue);
+	}
+}
+
+void render_queue_push(render_queue_t* queue, vec4_t points[3], tex2_t texcoords[3], uint32_t color, int texture_index, int pass) {
+	render_queue_reserve(queue, 1);
+
+	// Only the textured pass cares about the texture, the rest share a single run
+	if (pass != RENDER_PASS_TEXTURED) {
+		texture_index = 0;
+	}
+
+	// The nearest vertex gives the depth, positive floats sort like integers
+	float depth = points[0].w;
+	if (points[1].w < depth) depth = points[1].w;
+	if (points[2].w < depth) depth = points[2].w;
+	uint32_t depth_bits;
+	memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+	int i = queue->num_triangles;
+	for (int j = 0; j < 3; j++) {
+		queue->points[i * 3 + j] = vec2_from_vec4(points[j]);
+		queue->w[i * 3 + j] = points[j].w;
+		queue->texcoords[i * 3 + j] = texcoords[j];
+	}
+	queue->colors[i] = color;
+	queue->keys[i] =
+		((uint64_t)texture_index << RENDER_KEY_TEXTURE_SHIFT) |
+		((uint64_t)pass << RENDER_KEY_PASS_SHIFT) |
+		depth_bits;
+	queue->num_triangles++;
+}
+
+// Pixels the triangles from first_triangle on can touch, grown by a margin
+screen_rect_t render_queue_bounds(const render_queue_t* queue, int first_triangle, int margin) {
+	if (first_triangle >= queue->num_triangles) {
+		return screen_rect_empty();
+	}
+	float min_x = FLT_MAX, min_y = FLT_MAX;
+	float max_x = -FLT_MAX, max_y = -FLT_MAX;
+	for (int i = first_triangle * 3; i < queue->num_triangles * 3; i++) {
+		min_x = fminf(min_x, queue->points[i].x);
+		min_y = fminf(min_y, queue->points[i].y);
+		max_x = fmaxf(max_x, queue->points[i].x);
+		max_y = fmaxf(max_y, queue->points[i].y);
+	}
+	return screen_rect_new(
+		(int)floorf(min_x) - margin, (int)floorf(min_y) - margin,
+		(int)ceilf(max_x) + 1 + margin, (int)ceilf(max_y) + 1 + margin
+	);
+}
+
+// Whether the rasterized triangle may reach a pixel of the rectangle
+bool render_queue_triangle_overlaps(const render_queue_t* queue, int triangle, screen_rect_t rect) {
+	const vec2_t* points = queue->points + triangle * 3;
+	float min_x = fminf(points[0].x, fminf(points[1].x, points[2].x));
+	float min_y = fminf(points[0].y, fminf(points[1].y, points[2].y));
+	float max_x = fmaxf(points[0].x, fmaxf(points[1].x, points[2].x));
+	float max_y = fmaxf(points[0].y, fmaxf(points[1].y, points[2].y));
+	return min_x - 1 < rect.x1 && max_x + 1 >= rect.x0 && min_y - 1 < rect.y1 && max_y + 1 >= rect.y0;
+}
+
+void render_queue_sort(render_queue_t* queue) {
+	int n = queue->num_triangles;
+	int* order = arena_alloc(queue->arena, sizeof(int) * n);
+	int* scratch = arena_alloc(queue->arena, sizeof(int) * n);
+	for (int i = 0; i < n; i++) {
+		order[i] = i;
+	}
+
+	// Count every byte of the keys at once for a least significant digit radix sort
+	static int histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+	for (int i = 0; i < n; i++) {
+		uint64_t key = queue->keys[i];
+		for (int digit = 0; digit < 8; digit++) {
+			histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+		}
+	}
+
+	for (int digit = 0; digit < 8; digit++) {
+		int* counts = histograms[digit];
+		int shift = digit * 8;
+
+		// Skip the bytes that are the same in every key
+		if (n == 0 || counts[(queue->keys[0] >> shift) & 0xFF] == n) {
+			continue;
+		}
+
+		int offset = 0;
+		for (int b = 0; b < 256; b++) {
+			int count = counts[b];
+			counts[b] = offset;
+			offset += count;
+		}
+		for (int i = 0; i < n; i++) {
+			int index = order[i];
+			scratch[counts[(queue->keys[index] >> shift) & 0xFF]++] = index;
+		}
+
+		int* swap = order;
+		order = scratch;
+		scratch = swap;
+	}
+
+	queue->order = order;
+}
@@ -0,0 +1,53 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "arena.h"
+#include "screen_rect.h"
+#include "texture.h"
+#include "vector.h"
+
+// How the inside of a triangle is rasterized, the wireframe is drawn on top in its own pass
+enum render_pass {
+	RENDER_PASS_NONE,
+	RENDER_PASS_FILL,
+	RENDER_PASS_TEXTURED
+};
+
+// Sort keys keep the texture in the highest bits, then the render pass, and
+// the depth in the lowest 32 bits so runs of the same state go front to back
+#define RENDER_KEY_TEXTURE_SHIFT 48
+#define RENDER_KEY_PASS_SHIFT 40
+#define RENDER_KEY_STATE(key) ((key) >> RENDER_KEY_PASS_SHIFT)
+#define RENDER_KEY_TEXTURE(key) ((int)((key) >> RENDER_KEY_TEXTURE_SHIFT))
+#define RENDER_KEY_PASS(key) ((int)(((key) >> RENDER_KEY_PASS_SHIFT) & 0xFF))
+
+#define MAX_QUEUE_TEXTURES 0xFFFF
+
+// Screen space triangles waiting to be rasterized, stored as separate streams
+// of attributes and allocated from a per-frame arena
+typedef struct {
+	arena_t* arena;
+	int num_triangles;
+	int capacity;
+	vec2_t* points;			// screen positions, three per triangle
+	float* w;				// view depth of the vertices for perspective correction, three per triangle
+	tex2_t* texcoords;		// three per triangle
+	uint32_t* colors;		// one per triangle
+	uint64_t* keys;			// one per triangle
+	int* order;				// triangle indices sorted by key
+	texture_t** textures;	// textures used this frame, indexed by the keys
+	int num_textures;
+} render_queue_t;
+
+void render_queue_init(render_queue_t* queue, arena_t* arena);
+int render_queue_add_texture(render_queue_t* queue, texture_t* texture);
+int render_queue_choose_pass(const render_queue_t* queue, int texture_index);
+void render_queue_reserve(render_queue_t* queue, int num_triangles);
+void render_queue_push(render_queue_t* queue, vec4_t points[3], tex2_t texcoords[3], uint32_t color, int texture_index, int pass);
+screen_rect_t render_queue_bounds(const render_queue_t* queue, int first_triangle, int margin);
+bool render_queue_triangle_overlaps(const render_queue_t* queue, int triangle, screen_rect_t rect);
+void render_queue_sort(render_queue_t* queue);
+
+#endif // !RENDER_QUEUE_H
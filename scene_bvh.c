@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+#include "instance.h"
+#include "mesh.h"
+#include "scene_bvh.h"
+
+// Traversal stack, deep enough for any tree the binned build produces
+#define SCENE_BVH_STACK_SIZE 64
+
+static aabb_t instance_world_bounds(instance_t* instance) {
+	// An instance of an unloaded mesh is left as a point where it is
+	mesh_t* mesh = get_mesh_ptr(instance->mesh_handle);
+	aabb_t local = { vec3_new(0, 0, 0), vec3_new(0, 0, 0) };
+	if (mesh != NULL) {
+		local = (aabb_t) { mesh->bounds_min, mesh->bounds_max };
+	}
+	return aabb_transform(local, get_instance_world_matrix(instance));
+}
+
+static void free_tree(scene_bvh_tree_t* tree) {
+	free(tree->nodes);
+	free(tree->items);
+	free(tree->item_leaves);
+	memset(tree, 0, sizeof(scene_bvh_tree_t));
+}
+
+static float centroid_axis(aabb_t box, int axis) {
+	vec3_t center = aabb_center(box);
+	return axis == 0 ? center.x : axis == 1 ? center.y : center.z;
+}
+
+// Split the items of a node with the surface area heuristic over a few bins
+// along the longest axis of their centers, and recurse into both halves
+static void build_node(scene_bvh_tree_t* tree, const aabb_t* bounds, int node_index) {
+	scene_bvh_node_t* node = &tree->nodes[node_index];
+	int first = node->first;
+	int count = node->count;
+
+	node->bounds = aabb_empty();
+	aabb_t centers = aabb_empty();
+	for (int i = first; i < first + count; i++) {
+		node->bounds = aabb_union(node->bounds, bounds[tree->items[i]]);
+		centers = aabb_expand(centers, aabb_center(bounds[tree->items[i]]));
+	}
+	tree->area += aabb_surface_area(node->bounds);
+
+	node->left = -1;
+	if (count <= SCENE_BVH_MAX_LEAF_SIZE) {
+		for (int i = first; i < first + count; i++) {
+			tree->item_leaves[tree->items[i]] = node_index;
+		}
+		return;
+	}
+
+	vec3_t extent = vec3_sub(centers.max, centers.min);
+	int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z) ? 1 : 2;
+	float axis_min = axis == 0 ? centers.min.x : axis == 1 ? centers.min.y : centers.min.z;
+	float axis_extent = axis == 0 ? extent.x : axis == 1 ? extent.y : extent.z;
+
+	int split = first + count / 2;
+	if (axis_extent > 0) {
+		int bin_counts[SCENE_BVH_NUM_BINS] = { 0 };
+		aabb_t bin_bounds[SCENE_BVH_NUM_BINS];
+		for (int b = 0; b < SCENE_BVH_NUM_BINS; b++) {
+			bin_bounds[b] = aabb_empty();
+		}
+		float bin_scale = SCENE_BVH_NUM_BINS / axis_extent * 0.9999f;
+		for (int i = first; i < first + count; i++) {
+			int b = (int)((centroid_axis(bounds[tree->items[i]], axis) - axis_min) * bin_scale);
+			bin_counts[b]++;
+			bin_bounds[b] = aabb_union(bin_bounds[b], bounds[tree->items[i]]);
+		}
+
+		// Sweep from the right to know the cost of every plane between two bins
+		float right_areas[SCENE_BVH_NUM_BINS];
+		int right_counts[SCENE_BVH_NUM_BINS];
+		aabb_t right = aabb_empty();
+		int right_count = 0;
+		for (int b = SCENE_BVH_NUM_BINS - 1; b > 0; b--) {
+			right = aabb_union(right, bin_bounds[b]);
+			right_count += bin_counts[b];
+			right_areas[b] = aabb_surface_area(right);
+			right_counts[b] = right_count;
+		}
+
+		int best_plane = -1;
+		float best_cost = 0;
+		aabb_t left = aabb_empty();
+		int left_count = 0;
+		for (int b = 1; b < SCENE_BVH_NUM_BINS; b++) {
+			left = aabb_union(left, bin_bounds[b - 1]);
+			left_count += bin_counts[b - 1];
+			if (left_count == 0 || right_counts[b] == 0) continue;
+			float cost = aabb_surface_area(left) * left_count + right_areas[b] * right_counts[b];
+			if (best_plane < 0 || cost < best_cost) {
+				best_plane = b;
+				best_cost = cost;
+			}
+		}
+
+		if (best_plane > 0) {
+			int i = first;
+			int j = first + count - 1;
+			while (i <= j) {
+				int b = (int)((centroid_axis(bounds[tree->items[i]], axis) - axis_min) * bin_scale);
+				if (b < best_plane) {
+					i++;
+				}
+				else {
+					int swap = tree->items[i];
+					tree->items[i] = tree->items[j];
+					tree->items[j--] = swap;
+				}
+			}
+			split = i;
+		}
+	}
+
+	// Both children are allocated together, so the right one is always left + 1
+	int left_index = tree->num_nodes;
+	tree->num_nodes += 2;
+	scene_bvh_node_t left_child = { .parent = node_index, .first = first, .count = split - first };
+	scene_bvh_node_t right_child = { .parent = node_index, .first = split, .count = first + count - split };
+	tree->nodes[left_index] = left_child;
+	tree->nodes[left_index + 1] = right_child;
+	tree->nodes[node_index].left = left_index;
+
+	build_node(tree, bounds, left_index);
+	build_node(tree, bounds, left_index + 1);
+}
+
+static void build_tree(scene_bvh_tree_t* tree, const aabb_t* bounds, int num_items) {
+	memset(tree, 0, sizeof(scene_bvh_tree_t));
+	tree->num_items = num_items;
+	tree->nodes = malloc(sizeof(scene_bvh_node_t) * (num_items > 0 ? 2 * num_items - 1 : 1));
+	tree->items = malloc(sizeof(int) * (num_items > 0 ? num_items : 1));
+	tree->item_leaves = malloc(sizeof(int) * (num_items > 0 ? num_items : 1));
+	for (int i = 0; i < num_items; i++) {
+		tree->items[i] = i;
+	}
+
+	scene_bvh_node_t root = { .parent = -1, .first = 0, .count = num_items };
+	tree->nodes[0] = root;
+	tree->num_nodes = 1;
+	build_node(tree, bounds, 0);
+}
+
+// Recompute the boxes from the leaf of a moved instance up to the root, they can shrink as well as grow
+static void refit_item(scene_bvh_tree_t* tree, const aabb_t* bounds, int item) {
+	int node_index = tree->item_leaves[item];
+	scene_bvh_node_t* leaf = &tree->nodes[node_index];
+
+	aabb_t leaf_bounds = aabb_empty();
+	for (int i = leaf->first; i < leaf->first + leaf->count; i++) {
+		leaf_bounds = aabb_union(leaf_bounds, bounds[tree->items[i]]);
+	}
+	tree->area += aabb_surface_area(leaf_bounds) - aabb_surface_area(leaf->bounds);
+	leaf->bounds = leaf_bounds;
+
+	for (node_index = leaf->parent; node_index >= 0; node_index = tree->nodes[node_index].parent) {
+		scene_bvh_node_t* node = &tree->nodes[node_index];
+		aabb_t node_bounds = aabb_union(tree->nodes[node->left].bounds, tree->nodes[node->left + 1].bounds);
+		tree->area += aabb_surface_area(node_bounds) - aabb_surface_area(node->bounds);
+		node->bounds = node_bounds;
+	}
+}
+
+static int rebuild_thread_main(void* data) {
+	scene_bvh_t* bvh = data;
+	build_tree(&bvh->rebuilt_tree, bvh->rebuild_bounds, bvh->tree.num_items);
+	SDL_AtomicSet(&bvh->rebuild_done, 1);
+	return 0;
+}
+
+static void wait_for_rebuild(scene_bvh_t* bvh) {
+	if (bvh->rebuild_thread != NULL) {
+		SDL_WaitThread(bvh->rebuild_thread, NULL);
+		bvh->rebuild_thread = NULL;
+		free_tree(&bvh->rebuilt_tree);
+	}
+}
+
+void scene_bvh_init(scene_bvh_t* bvh) {
+	memset(bvh, 0, sizeof(scene_bvh_t));
+	SDL_AtomicSet(&bvh->rebuild_done, 0);
+}
+
+void scene_bvh_update(scene_bvh_t* bvh) {
+	int num_instances = get_num_instances();
+
+	// Added instances don't have a leaf yet, build the whole tree again right away
+	if (num_instances != bvh->tree.num_items || bvh->tree.nodes == NULL) {
+		wait_for_rebuild(bvh);
+		free_tree(&bvh->tree);
+		bvh->instance_bounds = realloc(bvh->instance_bounds, sizeof(aabb_t) * (num_instances + 1));
+		bvh->rebuild_bounds = realloc(bvh->rebuild_bounds, sizeof(aabb_t) * (num_instances + 1));
+		bvh->moved_during_rebuild = realloc(bvh->moved_during_rebuild, sizeof(bool) * (num_instances + 1));
+		memset(bvh->moved_during_rebuild, false, sizeof(bool) * (num_instances + 1));
+		for (int i = 0; i < num_instances; i++) {
+			bvh->instance_bounds[i] = instance_world_bounds(get_instance_ptr(i));
+		}
+		build_tree(&bvh->tree, bvh->instance_bounds, num_instances);
+		bvh->built_area = bvh->tree.area;
+		bvh->num_rebuilds++;
+		clear_dirty_instances();
+		return;
+	}
+
+	// Refit the current tree for the instances that moved since the last update
+	int num_dirty;
+	int* dirty = get_dirty_instances(&num_dirty);
+	for (int i = 0; i < num_dirty; i++) {
+		int index = dirty[i];
+		bvh->instance_bounds[index] = instance_world_bounds(get_instance_ptr(index));
+		refit_item(&bvh->tree, bvh->instance_bounds, index);
+		if (bvh->rebuild_thread != NULL) {
+			bvh->moved_during_rebuild[index] = true;
+		}
+	}
+	clear_dirty_instances();
+
+	// Swap in a finished rebuild, catching up with what moved while it was built
+	if (bvh->rebuild_thread != NULL && SDL_AtomicGet(&bvh->rebuild_done)) {
+		SDL_WaitThread(bvh->rebuild_thread, NULL);
+		bvh->rebuild_thread = NULL;
+		free_tree(&bvh->tree);
+		bvh->tree = bvh->rebuilt_tree;
+		memset(&bvh->rebuilt_tree, 0, sizeof(scene_bvh_tree_t));
+		bvh->built_area = bvh->tree.area;
+		bvh->num_rebuilds++;
+		for (int i = 0; i < num_instances; i++) {
+			if (bvh->moved_during_rebuild[i]) {
+				refit_item(&bvh->tree, bvh->instance_bounds, i);
+				bvh->moved_during_rebuild[i] = false;
+			}
+		}
+	}
+
+	if (bvh->rebuild_thread == NULL && bvh->tree.area > bvh->built_area * SCENE_BVH_REBUILD_RATIO) {
+		memcpy(bvh->rebuild_bounds, bvh->instance_bounds, sizeof(aabb_t) * num_instances);
+		SDL_AtomicSet(&bvh->rebuild_done, 0);
+		bvh->rebuild_thread = SDL_CreateThread(rebuild_thread_main, "scene_bvh_rebuild", bvh);
+	}
+}
+
+// The frustum planes come from the rows of the view projection matrix, with
+// the normals pointing inside and clip space z going from 0 to w
+static void extract_frustum_planes(mat4_t m, float planes[6][4]) {
+	for (int i = 0; i < 4; i++) {
+		planes[0][i] = m.m[3][i] + m.m[0][i];	// left
+		planes[1][i] = m.m[3][i] - m.m[0][i];	// right
+		planes[2][i] = m.m[3][i] + m.m[1][i];	// bottom
+		planes[3][i] = m.m[3][i] - m.m[1][i];	// top
+		planes[4][i] = m.m[2][i];				// near
+		planes[5][i] = m.m[3][i] - m.m[2][i];	// far
+	}
+}
+
+// Returns -1 if the box is outside of a plane, 1 if inside all of them and 0 otherwise
+static int classify_box(aabb_t box, float planes[6][4]) {
+	int result = 1;
+	for (int p = 0; p < 6; p++) {
+		const float* plane = planes[p];
+		// Corners of the box furthest along and against the plane normal
+		float far_distance =
+			plane[0] * (plane[0] > 0 ? box.max.x : box.min.x) +
+			plane[1] * (plane[1] > 0 ? box.max.y : box.min.y) +
+			plane[2] * (plane[2] > 0 ? box.max.z : box.min.z) + plane[3];
+		if (far_distance < 0) {
+			return -1;
+		}
+		float near_distance =
+			plane[0] * (plane[0] > 0 ? box.min.x : box.max.x) +
+			plane[1] * (plane[1] > 0 ? box.min.y : box.max.y) +
+			plane[2] * (plane[2] > 0 ? box.min.z : box.max.z) + plane[3];
+		if (near_distance < 0) {
+			result = 0;
+		}
+	}
+	return result;
+}
+
+// Instances whose world bounds may be inside the frustum, the array lives in the arena
+int* scene_bvh_query_frustum(scene_bvh_t* bvh, mat4_t view_projection, arena_t* arena, int* num_visible) {
+	scene_bvh_tree_t* tree = &bvh->tree;
+	int* visible = arena_alloc(arena, sizeof(int) * (tree->num_items > 0 ? tree->num_items : 1));
+	*num_visible = 0;
+	if (tree->num_items == 0) {
+		return visible;
+	}
+
+	float planes[6][4];
+	extract_frustum_planes(view_projection, planes);
+
+	int stack[SCENE_BVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0) {
+		scene_bvh_node_t* node = &tree->nodes[stack[--stack_size]];
+		int classification = classify_box(node->bounds, planes);
+		if (classification < 0) {
+			continue;
+		}
+
+		// Whole subtrees inside the frustum are taken without testing their children
+		if (classification > 0 || node->left < 0 || stack_size + 2 > SCENE_BVH_STACK_SIZE) {
+			memcpy(visible + *num_visible, tree->items + node->first, sizeof(int) * node->count);
+			*num_visible += node->count;
+			continue;
+		}
+		stack[stack_size++] = node->left + 1;
+		stack[stack_size++] = node->left;
+	}
+	return visible;
+}
+
+void scene_bvh_free(scene_bvh_t* bvh) {
+	wait_for_rebuild(bvh);
+	free_tree(&bvh->tree);
+	free(bvh->instance_bounds);
+	free(bvh->rebuild_bounds);
+	free(bvh->moved_during_rebuild);
+	memset(bvh, 0, sizeof(scene_bvh_t));
+}
@@ -0,0 +1,54 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <stdbool.h>
+#include <SDL.h>
+#include "aabb.h"
+#include "arena.h"
+#include "matrix.h"
+
+#define SCENE_BVH_MAX_LEAF_SIZE 4
+#define SCENE_BVH_NUM_BINS 12
+// Refits keep the shape of the tree, so its area drifts above what a fresh build over the moved
+// boxes would give. Rebuild once it passes this ratio of the area at the last build
+#define SCENE_BVH_REBUILD_RATIO 1.5
+
+typedef struct {
+	aabb_t bounds;
+	int left;				// first child, the second one follows it, -1 for leaves
+	int parent;
+	int first;				// items of the subtree, contiguous in the item list
+	int count;
+} scene_bvh_node_t;
+
+// Flattened hierarchy over a set of boxes
+typedef struct {
+	scene_bvh_node_t* nodes;
+	int num_nodes;
+	int* items;				// instance indices grouped by leaf
+	int* item_leaves;		// leaf node of every instance
+	int num_items;
+	float area;				// sum of the surface areas of all the nodes
+} scene_bvh_tree_t;
+
+// Bounding volume hierarchy over the world bounds of the instances, refit when
+// they move and rebuilt on a background thread when the refits degrade it
+typedef struct {
+	scene_bvh_tree_t tree;
+	aabb_t* instance_bounds;
+	float built_area;		// area of the tree when it was built
+
+	SDL_Thread* rebuild_thread;
+	SDL_atomic_t rebuild_done;
+	scene_bvh_tree_t rebuilt_tree;
+	aabb_t* rebuild_bounds;	// snapshot of the bounds the new tree is built from
+	bool* moved_during_rebuild;
+	int num_rebuilds;
+} scene_bvh_t;
+
+void scene_bvh_init(scene_bvh_t* bvh);
+void scene_bvh_update(scene_bvh_t* bvh);
+int* scene_bvh_query_frustum(scene_bvh_t* bvh, mat4_t view_projection, arena_t* arena, int* num_visible);
+void scene_bvh_free(scene_bvh_t* bvh);
+
+#endif // !SCENE_BVH_H
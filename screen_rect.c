@@ -0,0 +1,42 @@
+#include "screen_rect.h"
+
+screen_rect_t screen_rect_new(int x0, int y0, int x1, int y1) {
+	screen_rect_t rect = { x0, y0, x1, y1 };
+	return rect;
+}
+
+screen_rect_t screen_rect_empty(void) {
+	screen_rect_t rect = { 0, 0, 0, 0 };
+	return rect;
+}
+
+bool screen_rect_is_empty(screen_rect_t rect) {
+	return rect.x0 >= rect.x1 || rect.y0 >= rect.y1;
+}
+
+// Smallest rectangle holding both, an empty one adds nothing
+screen_rect_t screen_rect_union(screen_rect_t a, screen_rect_t b) {
+	if (screen_rect_is_empty(a)) return b;
+	if (screen_rect_is_empty(b)) return a;
+	screen_rect_t rect = {
+		a.x0 < b.x0 ? a.x0 : b.x0,
+		a.y0 < b.y0 ? a.y0 : b.y0,
+		a.x1 > b.x1 ? a.x1 : b.x1,
+		a.y1 > b.y1 ? a.y1 : b.y1
+	};
+	return rect;
+}
+
+screen_rect_t screen_rect_intersect(screen_rect_t a, screen_rect_t b) {
+	screen_rect_t rect = {
+		a.x0 > b.x0 ? a.x0 : b.x0,
+		a.y0 > b.y0 ? a.y0 : b.y0,
+		a.x1 < b.x1 ? a.x1 : b.x1,
+		a.y1 < b.y1 ? a.y1 : b.y1
+	};
+	return screen_rect_is_empty(rect) ? screen_rect_empty() : rect;
+}
+
+bool screen_rect_overlaps(screen_rect_t a, screen_rect_t b) {
+	return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
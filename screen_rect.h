@@ -0,0 +1,21 @@
+#ifndef SCREEN_RECT_H
+#define SCREEN_RECT_H
+
+#include <stdbool.h>
+
+// Pixels from (x0, y0) up to but not including (x1, y1)
+typedef struct {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+} screen_rect_t;
+
+screen_rect_t screen_rect_new(int x0, int y0, int x1, int y1);
+screen_rect_t screen_rect_empty(void);
+bool screen_rect_is_empty(screen_rect_t rect);
+screen_rect_t screen_rect_union(screen_rect_t a, screen_rect_t b);
+screen_rect_t screen_rect_intersect(screen_rect_t a, screen_rect_t b);
+bool screen_rect_overlaps(screen_rect_t a, screen_rect_t b);
+
+#endif // !SCREEN_RECT_H
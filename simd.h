@@ -0,0 +1,44 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// The widest float vectors the compiler targets, SIMD_WIDTH lanes each. Left
+// undefined without SSE2, the callers fall back to scalar loops then.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 simd_float_t;
+#define simd_load(p) _mm256_loadu_ps(p)
+#define simd_store(p, a) _mm256_storeu_ps(p, a)
+#define simd_set1(f) _mm256_set1_ps(f)
+#define simd_setr_ramp() _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)
+#define simd_add(a, b) _mm256_add_ps(a, b)
+#define simd_sub(a, b) _mm256_sub_ps(a, b)
+#define simd_mul(a, b) _mm256_mul_ps(a, b)
+#define simd_max(a, b) _mm256_max_ps(a, b)
+#define simd_and(a, b) _mm256_and_ps(a, b)
+#define simd_andnot(a, b) _mm256_andnot_ps(a, b)
+#define simd_or(a, b) _mm256_or_ps(a, b)
+#define simd_cmpge(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define simd_cmple(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define simd_movemask(a) _mm256_movemask_ps(a)
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 simd_float_t;
+#define simd_load(p) _mm_loadu_ps(p)
+#define simd_store(p, a) _mm_storeu_ps(p, a)
+#define simd_set1(f) _mm_set1_ps(f)
+#define simd_setr_ramp() _mm_setr_ps(0, 1, 2, 3)
+#define simd_add(a, b) _mm_add_ps(a, b)
+#define simd_sub(a, b) _mm_sub_ps(a, b)
+#define simd_mul(a, b) _mm_mul_ps(a, b)
+#define simd_max(a, b) _mm_max_ps(a, b)
+#define simd_and(a, b) _mm_and_ps(a, b)
+#define simd_andnot(a, b) _mm_andnot_ps(a, b)
+#define simd_or(a, b) _mm_or_ps(a, b)
+#define simd_cmpge(a, b) _mm_cmpge_ps(a, b)
+#define simd_cmple(a, b) _mm_cmple_ps(a, b)
+#define simd_movemask(a) _mm_movemask_ps(a)
+#endif
+
+#endif // !SIMD_H
@@ -1,7 +1,104 @@
+#include <math.h>
+#include <stddef.h>
 #include "texture.h"
 
+// A texture and the decoded PNG that owns its pixels
+typedef struct {
+  texture_t texture;
+  upng_t* png_image;
+} texture_entry_t;
+
+static registry_t textures = REGISTRY_INITIALIZER(texture_entry_t);
+
 tex2_t tex2_clone(tex2_t* t)
 {
   tex2_t result = { t->u, t->v };
   return result;
 }
+
+texture_t texture_from_png(upng_t* png_image)
+{
+  texture_t texture = {
+    upng_get_width(png_image),
+    upng_get_height(png_image),
+    (uint32_t*)upng_get_buffer(png_image)
+  };
+  return texture;
+}
+
+// Takes over a decoded PNG, NULL_HANDLE for none
+texture_handle_t create_texture(upng_t* png_image)
+{
+  if (png_image == NULL) {
+    return NULL_HANDLE;
+  }
+  texture_handle_t handle = registry_create(&textures);
+  texture_entry_t* entry = registry_get(&textures, handle);
+  if (entry == NULL) {
+    upng_free(png_image);
+    return NULL_HANDLE;
+  }
+  entry->texture = texture_from_png(png_image);
+  entry->png_image = png_image;
+  return handle;
+}
+
+// NULL for NULL_HANDLE or a destroyed texture. Textures move when others are
+// destroyed, the pointer is only good until then.
+texture_t* get_texture_ptr(texture_handle_t handle)
+{
+  texture_entry_t* entry = registry_get(&textures, handle);
+  return entry != NULL ? &entry->texture : NULL;
+}
+
+void destroy_texture(texture_handle_t handle)
+{
+  texture_entry_t* entry = registry_get(&textures, handle);
+  if (entry != NULL) {
+    upng_free(entry->png_image);
+    registry_destroy(&textures, handle);
+  }
+}
+
+void free_textures(void)
+{
+  for (int i = 0; i < textures.count; i++) {
+    texture_entry_t* entry = registry_item(&textures, i);
+    upng_free(entry->png_image);
+  }
+  registry_free(&textures);
+}
+
+// Blend of the four texels around (u, v), wrapping around the edges like the nearest lookup
+uint32_t texture_sample_bilinear(const texture_t* texture, float u, float v)
+{
+  float x = u * texture->width - 0.5f;
+  float y = v * texture->height - 0.5f;
+  float x_floor = floorf(x);
+  float y_floor = floorf(y);
+  float fx = x - x_floor;
+  float fy = y - y_floor;
+
+  int x0 = ((int)x_floor % texture->width + texture->width) % texture->width;
+  int y0 = ((int)y_floor % texture->height + texture->height) % texture->height;
+  int x1 = (x0 + 1) % texture->width;
+  int y1 = (y0 + 1) % texture->height;
+
+  uint32_t texels[4] = {
+    texture->pixels[y0 * texture->width + x0],
+    texture->pixels[y0 * texture->width + x1],
+    texture->pixels[y1 * texture->width + x0],
+    texture->pixels[y1 * texture->width + x1]
+  };
+  float weights[4] = { (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy };
+
+  uint32_t result = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    float channel = 0;
+    for (int i = 0; i < 4; i++) {
+      channel += ((texels[i] >> shift) & 0xFF) * weights[i];
+    }
+    result |= (uint32_t)(channel + 0.5f) << shift;
+  }
+  return result;
+}
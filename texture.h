@@ -2,6 +2,7 @@
 #define TEXTURE_H
 
 #include <stdint.h>
+#include "registry.h"
 #include "upng.h"
 
 typedef struct {
@@ -9,6 +10,22 @@ typedef struct {
 	float v;
 } tex2_t;
 
+// Pixels sampled by the textured rasterizer, texels with zero alpha are skipped
+typedef struct {
+	int width;
+	int height;
+	uint32_t* pixels;
+} texture_t;
+
+// Texture in the registry of textures, see texture.c
+typedef handle_t texture_handle_t;
+
 tex2_t tex2_clone(tex2_t* t);
+texture_t texture_from_png(upng_t* png_image);
+texture_handle_t create_texture(upng_t* png_image);
+texture_t* get_texture_ptr(texture_handle_t handle);
+void destroy_texture(texture_handle_t handle);
+void free_textures(void);
+uint32_t texture_sample_bilinear(const texture_t* texture, float u, float v);
 
 #endif // !TEXTURE_H
@@ -34,7 +34,7 @@ void draw_triangle_pixel(
 }
 
 void draw_texel(
-	int x, int y, upng_t* texture,
+	int x, int y, texture_t* texture,
 	vec4_t a, vec4_t b, vec4_t c,
 	tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
 ) {
@@ -63,8 +63,8 @@ void draw_texel(
 	interpolated_u /= interpolated_reciprocal_w;
 	interpolated_v /= interpolated_reciprocal_w;
 
-	int texture_width = upng_get_width(texture);
-	int texture_height = upng_get_height(texture);
+	int texture_width = texture->width;
+	int texture_height = texture->height;
 
 	// hack: use modulo to not overflow texture buffer when pixels get outside the triangle
 	int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
@@ -77,19 +77,24 @@ void draw_texel(
 	// hack: using 1 - 1 / w so that less "depth" means closer to camera
 	float depth = 1.0 - interpolated_reciprocal_w;
 	if (depth < get_zbuffer_at(x, y)) {
-		// Get the buffer of colors from the texture
-		uint32_t* texture_buffer = (uint32_t*)upng_get_buffer(texture);
+		// Transparent texels leave both the color and the depth untouched
+		uint32_t texel = (get_texture_filter() == TEXTURE_FILTER_BILINEAR)
+			? texture_sample_bilinear(texture, interpolated_u, interpolated_v)
+			: texture->pixels[tex_idx];
+		if ((texel >> 24) == 0) {
+			return;
+		}
 
-		draw_pixel(x, y, texture_buffer[tex_idx]);
+		draw_pixel(x, y, texel);
 		// update z-buffer
 		update_zbuffer_at(x, y, depth);
 	}
 }
 
 void draw_filled_triangle(
-	int x0, int y0, float z0, float w0,
-	int x1, int y1, float z1, float w1,
-	int x2, int y2, float z2, float w2,
+	int x0, int y0, float w0,
+	int x1, int y1, float w1,
+	int x2, int y2, float w2,
 	uint32_t color
 )
 {
@@ -97,28 +102,27 @@ void draw_filled_triangle(
 	if (y0 > y1) {
 		int_swap(&y0, &y1);
 		int_swap(&x0, &x1);
-		float_swap(&z0, &z1);
 		float_swap(&w0, &w1);
 	}
 	if (y1 > y2) {
 		int_swap(&y1, &y2);
 		int_swap(&x1, &x2);
-		float_swap(&z1, &z2);
 		float_swap(&w1, &w2);
 
 	}
 	if (y0 > y1) {
 		int_swap(&y0, &y1);
 		int_swap(&x0, &x1);
-		float_swap(&z0, &z1);
 		float_swap(&w0, &w1);
 
 	}
 
+	screen_rect_t scissor = get_scissor_rect();
+
 	// Create vector points and texture coords
-	vec4_t a = { x0, y0, z0, w0 };
-	vec4_t b = { x1, y1, z1, w1 };
-	vec4_t c = { x2, y2, z2, w2 };
+	vec4_t a = { x0, y0, 0, w0 };
+	vec4_t b = { x1, y1, 0, w1 };
+	vec4_t c = { x2, y2, 0, w2 };
 
 	// Render the upper part of the triangle (flat-bottom)
 	float inv_slope_1 = 0;
@@ -128,13 +132,16 @@ void draw_filled_triangle(
 	if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
 	if (y1 - y0 != 0) {
-		for (int y = y0; y <= y1; y++) {
+		// Scissor the scanlines, the clipper leaves a guard band around the screen
+		for (int y = (y0 < scissor.y0) ? scissor.y0 : y0; y <= y1 && y < scissor.y1; y++) {
 			int x_start = x1 + (y - y1) * inv_slope_1;
 			int x_end = x0 + (y - y0) * inv_slope_2;
 
 			if (x_end < x_start) {
 				int_swap(&x_start, &x_end);
 			}
+			if (x_start < scissor.x0) x_start = scissor.x0;
+			if (x_end >= scissor.x1) x_end = scissor.x1 - 1;
 
 			for (int x = x_start; x <= x_end; x++) {
 				draw_triangle_pixel(x, y, color, a, b, c);
@@ -150,13 +157,15 @@ void draw_filled_triangle(
 	if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
 	if (y2 - y1 != 0) {
-		for (int y = y1; y <= y2; y++) {
+		for (int y = (y1 < scissor.y0) ? scissor.y0 : y1; y <= y2 && y < scissor.y1; y++) {
 			int x_start = x1 + (y - y1) * inv_slope_1;
 			int x_end = x0 + (y - y0) * inv_slope_2;
 
 			if (x_end < x_start) {
 				int_swap(&x_start, &x_end);
 			}
+			if (x_start < scissor.x0) x_start = scissor.x0;
+			if (x_end >= scissor.x1) x_end = scissor.x1 - 1;
 
 			for (int x = x_start; x <= x_end; x++) {
 				draw_triangle_pixel(x, y, color, a, b, c);
@@ -166,17 +175,16 @@ void draw_filled_triangle(
 }
 
 void draw_textured_triangle(
-	int x0, int y0, float z0, float w0, float u0, float v0,
-	int x1, int y1, float z1, float w1, float u1, float v1,
-	int x2, int y2, float z2, float w2, float u2, float v2,
-	upng_t* texture
+	int x0, int y0, float w0, float u0, float v0,
+	int x1, int y1, float w1, float u1, float v1,
+	int x2, int y2, float w2, float u2, float v2,
+	texture_t* texture
 )
 {
 	// Sort vertices by y-coordinate ascending (y0 < y1 < y2)
 	if (y0 > y1) {
 		int_swap(&y0, &y1);
 		int_swap(&x0, &x1);
-		float_swap(&z0, &z1);
 		float_swap(&w0, &w1);
 		float_swap(&u0, &u1);
 		float_swap(&v0, &v1);
@@ -184,7 +192,6 @@ void draw_textured_triangle(
 	if (y1 > y2) {
 		int_swap(&y1, &y2);
 		int_swap(&x1, &x2);
-		float_swap(&z1, &z2);
 		float_swap(&w1, &w2);
 		float_swap(&u1, &u2);
 		float_swap(&v1, &v2);
@@ -192,7 +199,6 @@ void draw_textured_triangle(
 	if (y0 > y1) {
 		int_swap(&y0, &y1);
 		int_swap(&x0, &x1);
-		float_swap(&z0, &z1);
 		float_swap(&w0, &w1);
 		float_swap(&u0, &u1);
 		float_swap(&v0, &v1);
@@ -202,10 +208,12 @@ void draw_textured_triangle(
 	v1 = 1.0 - v1;
 	v2 = 1.0 - v2;
 
+	screen_rect_t scissor = get_scissor_rect();
+
 	// Create vector points and texture coords
-	vec4_t a = { x0, y0, z0, w0 };
-	vec4_t b = { x1, y1, z1, w1 };
-	vec4_t c = { x2, y2, z2, w2 };
+	vec4_t a = { x0, y0, 0, w0 };
+	vec4_t b = { x1, y1, 0, w1 };
+	vec4_t c = { x2, y2, 0, w2 };
 	tex2_t a_uv = { u0, v0 };
 	tex2_t b_uv = { u1, v1 };
 	tex2_t c_uv = { u2, v2 };
@@ -218,13 +226,16 @@ void draw_textured_triangle(
 	if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
 	if (y1 - y0 != 0) {
-		for (int y = y0; y <= y1; y++) {
+		// Scissor the scanlines, the clipper leaves a guard band around the screen
+		for (int y = (y0 < scissor.y0) ? scissor.y0 : y0; y <= y1 && y < scissor.y1; y++) {
 			int x_start = x1 + (y - y1) * inv_slope_1;
 			int x_end = x0 + (y - y0) * inv_slope_2;
 
 			if (x_end < x_start) {
 				int_swap(&x_start, &x_end);
 			}
+			if (x_start < scissor.x0) x_start = scissor.x0;
+			if (x_end >= scissor.x1) x_end = scissor.x1 - 1;
 
 			for (int x = x_start; x <= x_end; x++) {
 				draw_texel(x, y, texture, a, b, c, a_uv, b_uv, c_uv);
@@ -240,13 +251,15 @@ void draw_textured_triangle(
 	if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
 	if (y2 - y1 != 0) {
-		for (int y = y1; y <= y2; y++) {
+		for (int y = (y1 < scissor.y0) ? scissor.y0 : y1; y <= y2 && y < scissor.y1; y++) {
 			int x_start = x1 + (y - y1) * inv_slope_1;
 			int x_end = x0 + (y - y0) * inv_slope_2;
 
 			if (x_end < x_start) {
 				int_swap(&x_start, &x_end);
 			}
+			if (x_start < scissor.x0) x_start = scissor.x0;
+			if (x_end >= scissor.x1) x_end = scissor.x1 - 1;
 
 			for (int x = x_start; x <= x_end; x++) {
 				draw_texel(x, y, texture, a, b, c, a_uv, b_uv, c_uv);
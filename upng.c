@@ -28,6 +28,7 @@ freely, subject to the following restrictions:
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 
 #include "upng.h"
 
@@ -98,6 +99,8 @@ struct upng_t {
 
 	upng_state		state;
 	upng_source		source;
+
+	upng_stats		stats;
 };
 
 typedef struct huffman_tree {
@@ -900,6 +903,14 @@ static upng_format determine_format(upng_t* upng) {
 	}
 }
 
+/*wall clock time in seconds, loads of several images may run on different threads */
+static double upng_seconds(void)
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
 static void upng_free_source(upng_t* upng)
 {
 	if (upng->source.owning != 0) {
@@ -988,6 +999,7 @@ upng_error upng_decode(upng_t* upng)
 	unsigned long compressed_size = 0, compressed_index = 0;
 	unsigned long inflated_size;
 	upng_error error;
+	double start;
 
 	/* if we have an error state, bail now */
 	if (upng->error != UPNG_EOK) {
@@ -1097,7 +1109,11 @@ upng_error upng_decode(upng_t* upng)
 	}
 
 	/* decompress image data */
+	start = upng_seconds();
 	error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
+	upng->stats.inflate_seconds = upng_seconds() - start;
+	upng->stats.source_size = upng->source.size;
+	upng->stats.peak_size = upng->source.size + compressed_size + inflated_size;
 	if (error != UPNG_EOK) {
 		free(compressed);
 		free(inflated);
@@ -1118,8 +1134,13 @@ upng_error upng_decode(upng_t* upng)
 	}
 
 	/* unfilter scanlines */
+	start = upng_seconds();
 	post_process_scanlines(upng, upng->buffer, inflated, upng);
 	free(inflated);
+	upng->stats.unfilter_seconds = upng_seconds() - start;
+	if (upng->source.size + inflated_size + upng->size > upng->stats.peak_size) {
+		upng->stats.peak_size = upng->source.size + inflated_size + upng->size;
+	}
 
 	if (upng->error != UPNG_EOK) {
 		free(upng->buffer);
@@ -1163,6 +1184,8 @@ static upng_t* upng_new(void)
 	upng->source.size = 0;
 	upng->source.owning = 0;
 
+	memset(&upng->stats, 0, sizeof(upng->stats));
+
 	return upng;
 }
 
@@ -1186,13 +1209,15 @@ upng_t* upng_new_from_file(const char* filename)
 	unsigned char* buffer;
 	FILE* file;
 	long size;
+	double start;
 
 	upng = upng_new();
 	if (upng == NULL) {
 		return NULL;
 	}
 
-	fopen_s(&file, filename, "rb");
+	start = upng_seconds();
+	file = fopen(filename, "rb");
 	if (file == NULL) {
 		SET_ERROR(upng, UPNG_ENOTFOUND);
 		return upng;
@@ -1212,6 +1237,7 @@ upng_t* upng_new_from_file(const char* filename)
 	}
 	fread(buffer, 1, (unsigned long)size, file);
 	fclose(file);
+	upng->stats.read_seconds = upng_seconds() - start;
 
 	/* set the read buffer as our source buffer, with owning flag set */
 	upng->source.buffer = buffer;
@@ -1302,3 +1328,8 @@ unsigned upng_get_size(const upng_t* upng)
 {
 	return upng->size;
 }
+
+const upng_stats* upng_get_stats(const upng_t* upng)
+{
+	return &upng->stats;
+}
@@ -57,6 +57,15 @@ typedef enum upng_format {
 
 typedef struct upng_t upng_t;
 
+/* where the time and memory of reading and decoding an image went, for load profiling */
+typedef struct upng_stats {
+	unsigned long	source_size;		/* bytes of PNG data read */
+	unsigned long	peak_size;			/* most bytes the buffers held at once while decoding */
+	double			read_seconds;		/* reading the file, none for an image in memory */
+	double			inflate_seconds;
+	double			unfilter_seconds;
+} upng_stats;
+
 upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size);
 upng_t* upng_new_from_file(const char* path);
 void		upng_free(upng_t* upng);
@@ -77,5 +86,6 @@ upng_format	upng_get_format(const upng_t* upng);
 
 const unsigned char* upng_get_buffer(const upng_t* upng);
 unsigned				upng_get_size(const upng_t* upng);
+const upng_stats*		upng_get_stats(const upng_t* upng);
 
 #endif /*defined(UPNG_H)*/